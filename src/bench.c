@@ -0,0 +1,1105 @@
+/**
+ * @file   bench.c
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  Benchmark comparing tsqueue configurations.
+ *
+ * One producer puts jobs in to the queue while a varying number of consumers
+ * pop them, in the same way as task() and cpu(). For each configuration the
+ * throughput is reported along with the rank error, the distance between the
+ * position a job was put in to the queue and the position it was popped. A
+ * strict FIFO queue still shows a small rank error as consumers can be
+ * preempted between popping a job and recording it.
+ *
+ * The idle dispatch latency is then measured by putting single jobs in to
+ * the queue far enough apart that every consumer is waiting, and timing how
+ * long it takes for one of them to return from tsqueue_pop().
+ *
+ * The uncontended cost of an operation is measured by a single thread putting
+ * and popping jobs, comparing the generic tsqueue with a typed queue from
+ * tsqueue_typed.h.
+ *
+ * Each kind of lock in lock.h is then measured on its own, with every
+ * thread repeatedly taking the lock for a short critical section. The
+ * throughput is reported along with the longest time any thread waited for
+ * the lock, which shows how fair the lock is.
+ *
+ * Finally each backend in log_writer.h is measured by threads appending
+ * records like those written by cpu() to a temporary file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tsqueue.h"
+#include "ready_queue.h"
+#include "job.h"
+#include "error.h"
+#include "lock.h"
+#include "log_writer.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/** The number of jobs the benchmark queues can hold. */
+static const size_t BENCH_QUEUE_CAPACITY = 256;
+
+/** The number of jobs the producer puts in to the queue at once. */
+static const size_t BENCH_PUT_BATCH = 8;
+
+/** The number of jobs to pass through the queue if not given. */
+static const unsigned long BENCH_DEFAULT_JOBS = 1000000;
+
+/** The numbers of consumers to run each configuration with. */
+static const size_t BENCH_CONSUMERS[] = {8, 16, 32, 64, 128};
+
+/** The number of jobs to time when measuring idle dispatch latency. */
+static const size_t BENCH_LATENCY_JOBS = 2000;
+
+/** The time between jobs when measuring idle dispatch latency, long enough
+ * for every consumer to be waiting. */
+static const struct timespec BENCH_LATENCY_GAP = {.tv_nsec = 200000};
+
+/** The numbers of consumers to measure idle dispatch latency with. */
+static const size_t BENCH_LATENCY_CONSUMERS[] = {1, 3, 8};
+
+/** The number of jobs to pass through the queue when measuring the cost of
+ * an operation. */
+static const unsigned long BENCH_OP_JOBS = 10000000;
+
+/** The total number of times the lock is taken in each lock benchmark. */
+static const unsigned long BENCH_LOCK_OPS = 400000;
+
+/** The numbers of threads to contend for each kind of lock with. */
+static const size_t BENCH_LOCK_THREADS[] = {2, 4, 8, 16, 32, 64};
+
+/** The number of cache lines written inside the lock in the lock
+ * benchmark. */
+#define BENCH_LOCK_LINES 4
+
+/** The total number of records written in each log benchmark. */
+static const unsigned long BENCH_LOG_RECORDS = 200000;
+
+/** The numbers of threads to write the log with. */
+static const size_t BENCH_LOG_THREADS[] = {1, 2, 4, 8, 16, 32, 64};
+
+/** A log backend to benchmark. */
+struct bench_log
+{
+    /** The name used in the results. */
+    const char *name;
+
+    /** The backend. */
+    enum log_backend backend;
+};
+
+/** The parameters of a thread in a log benchmark. */
+struct bench_log_thread
+{
+    /** The log being written. */
+    struct log_writer *writer;
+
+    /** The id of the thread, written in its records. */
+    unsigned id;
+
+    /** The number of records to write. */
+    unsigned long n_records;
+
+    /** Zero if every record was written, else a POSIX error number. */
+    int retval;
+};
+
+/** A kind of lock to benchmark. */
+struct bench_lock
+{
+    /** The name used in the results. */
+    const char *name;
+
+    /** The kind of lock. */
+    enum lock_kind kind;
+};
+
+/** Shared state of a single lock benchmark run. */
+struct bench_lock_run
+{
+    /** The lock being benchmarked. */
+    struct lock lock;
+
+    /** The number of times each thread takes the lock. */
+    unsigned long n_ops;
+
+    /** Data written inside the lock, one counter per cache line. */
+    struct
+    {
+        _Alignas(64) unsigned long count;
+    } lines[BENCH_LOCK_LINES];
+
+    /** The longest time any thread waited for the lock in nanoseconds. */
+    atomic_long max_wait;
+};
+
+/** A queue configuration to benchmark. */
+struct bench_queue
+{
+    /** The name used in the results. */
+    const char *name;
+
+    /** Creates an empty queue for @p n_consumers consumers, see
+     * tsqueue_create(). */
+    int (*create)(tsqueue **queue, void *data, size_t capacity,
+                  size_t n_consumers);
+};
+
+/** Shared state of a single benchmark run. */
+struct bench_run
+{
+    /** The queue being benchmarked. */
+    tsqueue *queue;
+
+    /** The number of jobs to put in to the queue. */
+    unsigned long n_jobs;
+
+    /** The number of jobs popped so far, this is the rank a job would have in
+     * a strict FIFO queue. */
+    atomic_ulong n_popped;
+
+    /** The sum of the rank errors of all jobs. */
+    atomic_ullong total_rank_error;
+
+    /** The largest rank error of any job. */
+    atomic_ulong max_rank_error;
+
+    /** The return value of the producer. */
+    int producer_retval;
+
+    /** The dispatch latency of each job in nanoseconds when measuring
+     * latency, otherwise NULL. */
+    long *latencies;
+};
+
+/**
+ * @brief Creates a strict FIFO queue, see bench_queue.
+ */
+static int create_fifo(tsqueue **queue, void *data, size_t capacity,
+                       size_t n_consumers);
+
+/**
+ * @brief Creates a relaxed queue with two sub-queues per consumer, see
+ *        bench_queue.
+ */
+static int create_relaxed(tsqueue **queue, void *data, size_t capacity,
+                          size_t n_consumers);
+
+/**
+ * @brief Creates a flat combining queue with a record for each thread, see
+ *        bench_queue.
+ */
+static int create_combining(tsqueue **queue, void *data, size_t capacity,
+                            size_t n_consumers);
+
+/**
+ * @brief Puts bench_run.n_jobs jobs in to the queue, numbered in order.
+ *
+ * @param data The bench_run.
+ *
+ * @return NULL, see bench_run.producer_retval for the return value.
+ */
+static void *bench_producer(void *data);
+
+/**
+ * @brief Pops jobs until the queue is done, recording rank errors.
+ *
+ * @param data The bench_run.
+ *
+ * @return NULL.
+ */
+static void *bench_consumer(void *data);
+
+/**
+ * @brief Puts bench_run.n_jobs jobs in to the queue one at a time, separated
+ *        by BENCH_LATENCY_GAP and stamped with the time they were put.
+ *
+ * @param data The bench_run.
+ *
+ * @return NULL, see bench_run.producer_retval for the return value.
+ */
+static void *latency_producer(void *data);
+
+/**
+ * @brief Pops jobs until the queue is done, recording the time since each
+ *        was put.
+ *
+ * @param data The bench_run.
+ *
+ * @return NULL.
+ */
+static void *latency_consumer(void *data);
+
+/**
+ * @brief Runs a producer and @p n_consumers consumers on a new queue.
+ *
+ * @param[in] bq The configuration.
+ * @param n_consumers The number of consumer threads.
+ * @param[in,out] run The run, queue will be set and destroyed.
+ * @param producer The producer thread function.
+ * @param consumer The consumer thread function.
+ * @param[out] seconds The time taken.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int bench_threads(const struct bench_queue *bq, size_t n_consumers,
+                         struct bench_run *run, void *(*producer)(void *),
+                         void *(*consumer)(void *), double *seconds);
+
+/**
+ * @brief Measures the idle dispatch latency of one configuration and prints
+ *        the results.
+ *
+ * @param[in] bq The configuration.
+ * @param n_consumers The number of consumer threads.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int bench_latency(const struct bench_queue *bq, size_t n_consumers);
+
+/**
+ * @brief Measures the uncontended cost of a put or pop on a generic FIFO
+ *        tsqueue.
+ *
+ * @param[out] seconds The time taken to pass BENCH_OP_JOBS jobs through the
+ *                     queue.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int op_cost_generic(double *seconds);
+
+/**
+ * @brief Measures the uncontended cost of a put or pop on a typed queue, see
+ *        op_cost_generic().
+ */
+static int op_cost_typed(double *seconds);
+
+/**
+ * @brief Takes the lock bench_lock_run.n_ops times, recording the longest
+ *        wait.
+ *
+ * @param data The bench_lock_run.
+ *
+ * @return NULL.
+ */
+static void *lock_thread(void *data);
+
+/**
+ * @brief Measures one kind of lock and prints the results.
+ *
+ * @param[in] bl The kind of lock.
+ * @param n_threads The number of threads contending for the lock.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int bench_lock(const struct bench_lock *bl, size_t n_threads);
+
+/**
+ * @brief Writes bench_log_thread.n_records records to the log.
+ *
+ * @param data The bench_log_thread.
+ *
+ * @return NULL.
+ */
+static void *log_thread(void *data);
+
+/**
+ * @brief Measures one log backend and prints the results.
+ *
+ * @param[in] bl The backend.
+ * @param n_threads The number of threads writing to the log.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int bench_log(const struct bench_log *bl, size_t n_threads);
+
+/**
+ * @brief Compares two longs for qsort().
+ */
+static int compare_long(const void *a, const void *b);
+
+/**
+ * @brief Runs one configuration and prints the results.
+ *
+ * @param[in] bq The configuration.
+ * @param n_consumers The number of consumer threads.
+ * @param n_jobs The number of jobs to pass through the queue.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int bench_one(const struct bench_queue *bq, size_t n_consumers,
+                     unsigned long n_jobs);
+
+/** The configurations to benchmark. */
+static const struct bench_queue BENCH_QUEUES[] = {
+    {"fifo", &create_fifo},
+    {"relaxed", &create_relaxed},
+    {"combining", &create_combining}
+};
+
+/** The kinds of lock to benchmark. */
+static const struct bench_lock BENCH_LOCKS[] = {
+    {"mutex", LOCK_MUTEX},
+    {"adaptive", LOCK_ADAPTIVE},
+    {"ticket", LOCK_TICKET},
+    {"mcs", LOCK_MCS}
+};
+
+/** The log backends to benchmark. */
+static const struct bench_log BENCH_LOGS[] = {
+    {"stdio", LOG_BACKEND_STDIO},
+    {"writev", LOG_BACKEND_WRITEV},
+    {"pwrite", LOG_BACKEND_PWRITE},
+    {"io_uring", LOG_BACKEND_URING}
+};
+
+int main(int argc, char **argv)
+{
+    int retval = 0;
+    unsigned long n_jobs = BENCH_DEFAULT_JOBS;
+
+    if (argc > 2)
+    {
+        retval = AE_WRONG_NUM_ARGS;
+    }
+    else if (argc == 2)
+    {
+        char *end;
+        errno = 0;
+        uintmax_t tmp = strtoumax(argv[1], &end, 10);
+        if (errno)
+        {
+            retval = errno;
+        }
+        else if (*end != '\0' || tmp == 0 || tmp > UINT_MAX)
+        {
+            retval = AE_STR_NOT_A_NUMBER;
+        }
+        else
+        {
+            n_jobs = (unsigned long)tmp;
+        }
+    }
+
+    if (retval == 0)
+    {
+        printf("%-12s %9s %14s %16s %15s\n", "queue", "consumers", "jobs/s",
+               "mean rank error", "max rank error");
+    }
+
+    for (size_t i = 0;
+         retval == 0 && i < sizeof(BENCH_QUEUES) / sizeof(*BENCH_QUEUES); ++i)
+    {
+        for (size_t j = 0;
+             retval == 0
+             && j < sizeof(BENCH_CONSUMERS) / sizeof(*BENCH_CONSUMERS);
+             ++j)
+        {
+            retval = bench_one(&BENCH_QUEUES[i], BENCH_CONSUMERS[j], n_jobs);
+        }
+    }
+
+    if (retval == 0)
+    {
+        printf("\n%-12s %9s %14s %14s %14s\n", "queue", "consumers",
+               "mean latency", "median", "99th pct");
+    }
+
+    for (size_t i = 0;
+         retval == 0 && i < sizeof(BENCH_QUEUES) / sizeof(*BENCH_QUEUES); ++i)
+    {
+        for (size_t j = 0;
+             retval == 0
+             && j < sizeof(BENCH_LATENCY_CONSUMERS)
+                    / sizeof(*BENCH_LATENCY_CONSUMERS);
+             ++j)
+        {
+            retval = bench_latency(&BENCH_QUEUES[i],
+                                   BENCH_LATENCY_CONSUMERS[j]);
+        }
+    }
+
+    if (retval == 0)
+    {
+        printf("\n%-12s %14s\n", "queue", "ns per op");
+    }
+
+    // Each job is put once and popped once.
+    double seconds;
+    if (retval == 0)
+    {
+        retval = op_cost_generic(&seconds);
+        if (retval == 0)
+        {
+            printf("%-12s %14.1f\n", "fifo",
+                   seconds * 1e9 / BENCH_OP_JOBS / 2);
+        }
+    }
+
+    if (retval == 0)
+    {
+        retval = op_cost_typed(&seconds);
+        if (retval == 0)
+        {
+            printf("%-12s %14.1f\n", "typed",
+                   seconds * 1e9 / BENCH_OP_JOBS / 2);
+        }
+    }
+
+    if (retval == 0)
+    {
+        printf("\n%-12s %9s %14s %14s\n", "lock", "threads", "locks/s",
+               "max wait");
+    }
+
+    for (size_t i = 0;
+         retval == 0 && i < sizeof(BENCH_LOCKS) / sizeof(*BENCH_LOCKS); ++i)
+    {
+        for (size_t j = 0;
+             retval == 0
+             && j < sizeof(BENCH_LOCK_THREADS) / sizeof(*BENCH_LOCK_THREADS);
+             ++j)
+        {
+            retval = bench_lock(&BENCH_LOCKS[i], BENCH_LOCK_THREADS[j]);
+        }
+    }
+
+    if (retval == 0)
+    {
+        printf("\n%-12s %9s %14s %14s\n", "log", "threads", "records/s",
+               "MB/s");
+    }
+
+    for (size_t i = 0;
+         retval == 0 && i < sizeof(BENCH_LOGS) / sizeof(*BENCH_LOGS); ++i)
+    {
+        for (size_t j = 0;
+             retval == 0
+             && j < sizeof(BENCH_LOG_THREADS) / sizeof(*BENCH_LOG_THREADS);
+             ++j)
+        {
+            retval = bench_log(&BENCH_LOGS[i], BENCH_LOG_THREADS[j]);
+        }
+    }
+
+    if (retval != 0)
+    {
+        fprintf(stderr, "%s\nUsage: %s [number of jobs]\n",
+                errno_or_ae_to_str(retval), argv[0]);
+    }
+
+    return retval;
+}
+
+static int create_fifo(tsqueue **queue, void *data, size_t capacity,
+                       size_t n_consumers)
+{
+    // A strict FIFO queue is the same for any number of consumers.
+    (void)n_consumers;
+    return tsqueue_create(queue, data, capacity, sizeof(struct job_struct),
+                          0, LOCK_MUTEX);
+}
+
+static int create_relaxed(tsqueue **queue, void *data, size_t capacity,
+                          size_t n_consumers)
+{
+    return tsqueue_create_relaxed(queue, data, capacity,
+                                  sizeof(struct job_struct), 0,
+                                  2 * n_consumers, LOCK_MUTEX);
+}
+
+static int create_combining(tsqueue **queue, void *data, size_t capacity,
+                            size_t n_consumers)
+{
+    return tsqueue_create_combining(queue, data, capacity,
+                                    sizeof(struct job_struct), 0,
+                                    n_consumers + 1, LOCK_MUTEX);
+}
+
+static void *bench_producer(void *data)
+{
+    struct bench_run *run = data;
+    struct job_struct batch[BENCH_PUT_BATCH];
+    int retval = 0;
+
+    unsigned long next = 0;
+    while (retval == 0 && next < run->n_jobs)
+    {
+        size_t n = 0;
+        while (n < BENCH_PUT_BATCH && next < run->n_jobs)
+        {
+            batch[n++] = (struct job_struct){.id = next++};
+        }
+        retval = tsqueue_put(run->queue, n, batch);
+    }
+
+    tsqueue_set_done(run->queue, true);
+    run->producer_retval = retval;
+    return NULL;
+}
+
+static void *bench_consumer(void *data)
+{
+    struct bench_run *run = data;
+    unsigned long long total_error = 0;
+    unsigned long max_error = 0;
+
+    size_t n = 1;
+    while (n == 1)
+    {
+        struct job_struct job;
+        n = 1;
+        if (tsqueue_pop(run->queue, &n, &job) != 0)
+        {
+            n = 0;
+        }
+
+        if (n == 1)
+        {
+            unsigned long rank = atomic_fetch_add(&run->n_popped, 1);
+            unsigned long error =
+                (rank > job.id) ? rank - job.id : job.id - rank;
+            total_error += error;
+            if (error > max_error)
+            {
+                max_error = error;
+            }
+        }
+    }
+
+    atomic_fetch_add(&run->total_rank_error, total_error);
+    unsigned long current = atomic_load(&run->max_rank_error);
+    while (current < max_error
+           && !atomic_compare_exchange_weak(&run->max_rank_error, &current,
+                                            max_error))
+    {
+    }
+
+    return NULL;
+}
+
+static void *latency_producer(void *data)
+{
+    struct bench_run *run = data;
+    int retval = 0;
+
+    for (unsigned long i = 0; retval == 0 && i < run->n_jobs; ++i)
+    {
+        struct timespec gap = BENCH_LATENCY_GAP;
+        while (clock_nanosleep(CLOCK_MONOTONIC, 0, &gap, &gap) != 0)
+        {
+        }
+
+        struct job_struct job = {.id = i};
+        clock_gettime(CLOCK_MONOTONIC, &job.arrival_mono);
+        retval = tsqueue_put(run->queue, 1, &job);
+    }
+
+    tsqueue_set_done(run->queue, true);
+    run->producer_retval = retval;
+    return NULL;
+}
+
+static void *latency_consumer(void *data)
+{
+    struct bench_run *run = data;
+
+    size_t n = 1;
+    while (n == 1)
+    {
+        struct job_struct job;
+        if (tsqueue_pop(run->queue, &n, &job) != 0)
+        {
+            n = 0;
+        }
+
+        if (n == 1)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            run->latencies[atomic_fetch_add(&run->n_popped, 1)] =
+                (now.tv_sec - job.arrival_mono.tv_sec) * 1000000000L
+                + (now.tv_nsec - job.arrival_mono.tv_nsec);
+        }
+    }
+
+    return NULL;
+}
+
+static int bench_threads(const struct bench_queue *bq, size_t n_consumers,
+                         struct bench_run *run, void *(*producer)(void *),
+                         void *(*consumer)(void *), double *seconds)
+{
+    int retval = 0;
+
+    struct job_struct *data = NULL;
+    pthread_t *consumers = NULL;
+
+    data = malloc(sizeof(*data) * BENCH_QUEUE_CAPACITY);
+    consumers = malloc(sizeof(*consumers) * n_consumers);
+    if (data == NULL || consumers == NULL)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        retval = bq->create(&run->queue, data, BENCH_QUEUE_CAPACITY,
+                            n_consumers);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t n_started = 0;
+    while (retval == 0 && n_started < n_consumers)
+    {
+        retval = pthread_create(&consumers[n_started], NULL, consumer, run);
+        if (retval == 0)
+        {
+            ++n_started;
+        }
+    }
+
+    pthread_t producer_thread;
+    bool producer_started = false;
+    if (retval == 0)
+    {
+        retval = pthread_create(&producer_thread, NULL, producer, run);
+        producer_started = (retval == 0);
+    }
+
+    if (retval != 0 && run->queue != NULL)
+    {
+        tsqueue_close(run->queue);
+    }
+
+    if (producer_started)
+    {
+        pthread_join(producer_thread, NULL);
+        retval = run->producer_retval;
+    }
+
+    for (size_t i = 0; i < n_started; ++i)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (double)(end.tv_sec - start.tv_sec)
+               + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (run->queue != NULL)
+    {
+        tsqueue_destroy(run->queue, NULL);
+        run->queue = NULL;
+    }
+    free(consumers);
+    free(data);
+
+    return retval;
+}
+
+static int bench_latency(const struct bench_queue *bq, size_t n_consumers)
+{
+    int retval = 0;
+    struct bench_run run = {.n_jobs = BENCH_LATENCY_JOBS};
+
+    run.latencies = malloc(sizeof(*run.latencies) * BENCH_LATENCY_JOBS);
+    if (run.latencies == NULL)
+    {
+        retval = errno;
+    }
+
+    double seconds;
+    if (retval == 0)
+    {
+        retval = bench_threads(bq, n_consumers, &run, &latency_producer,
+                               &latency_consumer, &seconds);
+    }
+
+    if (retval == 0)
+    {
+        size_t n = run.n_popped;
+        long long total = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            total += run.latencies[i];
+        }
+        qsort(run.latencies, n, sizeof(*run.latencies), &compare_long);
+        printf("%-12s %9zu %11.1f us %11.1f us %11.1f us\n", bq->name,
+               n_consumers, (double)total / n / 1000,
+               run.latencies[n / 2] / 1000.0,
+               run.latencies[n * 99 / 100] / 1000.0);
+    }
+
+    free(run.latencies);
+
+    return retval;
+}
+
+static int op_cost_generic(double *seconds)
+{
+    int retval = 0;
+    struct job_struct data[BENCH_PUT_BATCH];
+    struct job_struct batch[BENCH_PUT_BATCH];
+    tsqueue *queue = NULL;
+
+    retval = tsqueue_create(&queue, data, BENCH_PUT_BATCH, sizeof(*data), 0,
+                            LOCK_MUTEX);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Put jobs in batches and pop them one at a time, as task() and cpu()
+    // do.
+    for (unsigned long i = 0; retval == 0 && i < BENCH_OP_JOBS;
+         i += BENCH_PUT_BATCH)
+    {
+        for (size_t j = 0; j < BENCH_PUT_BATCH; ++j)
+        {
+            batch[j].id = i + j;
+        }
+        retval = tsqueue_put(queue, BENCH_PUT_BATCH, batch);
+
+        for (size_t j = 0; retval == 0 && j < BENCH_PUT_BATCH; ++j)
+        {
+            size_t n = 1;
+            retval = tsqueue_pop(queue, &n, &batch[j]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (double)(end.tv_sec - start.tv_sec)
+               + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (queue != NULL)
+    {
+        tsqueue_destroy(queue, NULL);
+    }
+
+    return retval;
+}
+
+static int op_cost_typed(double *seconds)
+{
+    int retval = 0;
+    struct job_struct data[BENCH_PUT_BATCH];
+    struct job_struct batch[BENCH_PUT_BATCH];
+    job_queue *queue = NULL;
+
+    retval = job_queue_create(&queue, data, BENCH_PUT_BATCH, 0, LOCK_MUTEX);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned long i = 0; retval == 0 && i < BENCH_OP_JOBS;
+         i += BENCH_PUT_BATCH)
+    {
+        for (size_t j = 0; j < BENCH_PUT_BATCH; ++j)
+        {
+            batch[j].id = i + j;
+        }
+        retval = job_queue_put(queue, BENCH_PUT_BATCH, batch);
+
+        for (size_t j = 0; retval == 0 && j < BENCH_PUT_BATCH; ++j)
+        {
+            size_t n = 1;
+            retval = job_queue_pop(queue, &n, &batch[j]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (double)(end.tv_sec - start.tv_sec)
+               + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (queue != NULL)
+    {
+        job_queue_destroy(queue, NULL);
+    }
+
+    return retval;
+}
+
+static void *lock_thread(void *data)
+{
+    struct bench_lock_run *run = data;
+    long max_wait = 0;
+
+    for (unsigned long i = 0; i < run->n_ops; ++i)
+    {
+        struct timespec start;
+        struct timespec acquired;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lock_acquire(&run->lock);
+        clock_gettime(CLOCK_MONOTONIC, &acquired);
+
+        for (size_t j = 0; j < BENCH_LOCK_LINES; ++j)
+        {
+            ++run->lines[j].count;
+        }
+
+        lock_release(&run->lock);
+
+        long wait = (acquired.tv_sec - start.tv_sec) * 1000000000L
+                    + (acquired.tv_nsec - start.tv_nsec);
+        if (wait > max_wait)
+        {
+            max_wait = wait;
+        }
+    }
+
+    long current = atomic_load(&run->max_wait);
+    while (current < max_wait
+           && !atomic_compare_exchange_weak(&run->max_wait, &current,
+                                            max_wait))
+    {
+    }
+
+    return NULL;
+}
+
+static int bench_lock(const struct bench_lock *bl, size_t n_threads)
+{
+    int retval = 0;
+
+    struct bench_lock_run *run = NULL;
+    pthread_t *threads = NULL;
+
+    run = aligned_alloc(64, sizeof(*run));
+    threads = malloc(sizeof(*threads) * n_threads);
+    if (run == NULL || threads == NULL)
+    {
+        retval = errno;
+    }
+
+    bool lock_initialised = false;
+    if (retval == 0)
+    {
+        *run = (struct bench_lock_run){.n_ops = BENCH_LOCK_OPS / n_threads};
+        retval = lock_init(&run->lock, bl->kind);
+        lock_initialised = (retval == 0);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t n_started = 0;
+    while (retval == 0 && n_started < n_threads)
+    {
+        retval = pthread_create(&threads[n_started], NULL, &lock_thread, run);
+        if (retval == 0)
+        {
+            ++n_started;
+        }
+    }
+
+    for (size_t i = 0; i < n_started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec)
+                     + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (retval == 0)
+    {
+        printf("%-12s %9zu %14.0f %11.1f us\n", bl->name, n_threads,
+               run->n_ops * n_threads / seconds,
+               (long)run->max_wait / 1000.0);
+    }
+
+    if (lock_initialised)
+    {
+        lock_destroy(&run->lock);
+    }
+    free(threads);
+    free(run);
+
+    return retval;
+}
+
+static void *log_thread(void *data)
+{
+    struct bench_log_thread *thread = data;
+
+    for (unsigned long i = 0; i < thread->n_records && thread->retval == 0;
+         ++i)
+    {
+        thread->retval = log_writer_printf(thread->writer,
+                                           "Statistics for CPU %u:\n"
+                                           "Job #%lu\n"
+                                           "Arrival time: %02d:%02d:%02d\n"
+                                           "Service time: %02d:%02d:%02d\n\n",
+                                           thread->id, i, 12, 34, 56, 12, 34,
+                                           57);
+    }
+
+    int flush_retval = log_writer_flush(thread->writer);
+    if (thread->retval == 0)
+    {
+        thread->retval = flush_retval;
+    }
+
+    return NULL;
+}
+
+static int bench_log(const struct bench_log *bl, size_t n_threads)
+{
+    int retval = 0;
+
+    struct bench_log_thread *params = calloc(n_threads, sizeof(*params));
+    pthread_t *threads = malloc(sizeof(*threads) * n_threads);
+    if (params == NULL || threads == NULL)
+    {
+        retval = errno;
+    }
+
+    char path[] = "/tmp/scheduler-bench-log-XXXXXX";
+    int fd = -1;
+    if (retval == 0)
+    {
+        fd = mkstemp(path);
+        if (fd == -1)
+        {
+            retval = errno;
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    struct log_writer writer;
+    bool writer_open = false;
+    if (retval == 0)
+    {
+        retval = log_writer_open(&writer, path, bl->backend);
+        writer_open = (retval == 0);
+    }
+
+    // io_uring falls back to pwrite() when it is not available.
+    const char *name = bl->name;
+    if (writer_open && bl->backend == LOG_BACKEND_URING
+        && !log_async_uses_uring(writer.async))
+    {
+        name = "no io_uring";
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t n_started = 0;
+    while (retval == 0 && n_started < n_threads)
+    {
+        params[n_started] = (struct bench_log_thread){
+            .writer = &writer,
+            .id = (unsigned)n_started + 1,
+            .n_records = BENCH_LOG_RECORDS / n_threads
+        };
+        retval = pthread_create(&threads[n_started], NULL, &log_thread,
+                                &params[n_started]);
+        if (retval == 0)
+        {
+            ++n_started;
+        }
+    }
+
+    for (size_t i = 0; i < n_started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        if (retval == 0)
+        {
+            retval = params[i].retval;
+        }
+    }
+
+    if (writer_open)
+    {
+        int close_retval = log_writer_close(&writer);
+        if (retval == 0)
+        {
+            retval = close_retval;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec)
+                     + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    struct stat st;
+    if (retval == 0 && stat(path, &st) != 0)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        unsigned long n_records = BENCH_LOG_RECORDS / n_threads * n_threads;
+        printf("%-12s %9zu %14.0f %14.1f\n", name, n_threads,
+               n_records / seconds, st.st_size / seconds / 1e6);
+    }
+
+    if (fd != -1)
+    {
+        unlink(path);
+    }
+    free(threads);
+    free(params);
+
+    return retval;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static int bench_one(const struct bench_queue *bq, size_t n_consumers,
+                     unsigned long n_jobs)
+{
+    int retval = 0;
+    struct bench_run run = {.n_jobs = n_jobs};
+
+    double seconds;
+    retval = bench_threads(bq, n_consumers, &run, &bench_producer,
+                           &bench_consumer, &seconds);
+
+    if (retval == 0)
+    {
+        printf("%-12s %9zu %14.0f %16.2f %15lu\n", bq->name, n_consumers,
+               n_jobs / seconds,
+               (double)run.total_rank_error / n_jobs,
+               (unsigned long)run.max_rank_error);
+    }
+
+    return retval;
+}
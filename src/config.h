@@ -9,7 +9,13 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "tsqueue.h"
+#include "lock.h"
+#include "log_writer.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 /** The number of cpu function threads to spawn. */
 static const unsigned int CPU_COUNT = 3;
@@ -24,6 +30,228 @@ static const size_t QUEUE_SIZE_MAX = 10;
  * the queue. */
 static const size_t TASK_JOB_BUFFER_LENGTH = 2;
 
+/** The kinds of ready-queue that can be used. */
+enum ready_queue_type
+{
+    /** Jobs are run in the order they arrive. */
+    READY_QUEUE_FIFO,
+
+    /** Jobs are run in priority order, see PRIORITY_LEVELS. */
+    READY_QUEUE_PRIORITY,
+
+    /** Jobs are run in approximately the order they arrive. Scales to many
+     * more cpu threads than READY_QUEUE_FIFO. */
+    READY_QUEUE_RELAXED,
+
+    /** Jobs are run in the order they arrive. Whichever cpu thread holds the
+     * queue lock carries out the requests of all the others, which performs
+     * better than READY_QUEUE_FIFO when many cpu threads contend for it. */
+    READY_QUEUE_COMBINING,
+
+    /** Jobs are run in the order they arrive. The queue is created in shared
+     * memory named SHARED_QUEUE_NAME so other processes can submit jobs
+     * using tsqueue_open_shared(). */
+    READY_QUEUE_SHARED
+};
+
+/** The kind of ready-queue to use. */
+static const enum ready_queue_type READY_QUEUE_TYPE = READY_QUEUE_FIFO;
+
+/** The order that idle cpu threads are woken in when jobs arrive. LIFO keeps
+ * work on the most recently busy threads when the load is light. Ignored by
+ * READY_QUEUE_RELAXED, READY_QUEUE_COMBINING and READY_QUEUE_SHARED. */
+static const enum tsqueue_wake_order READY_QUEUE_WAKE_ORDER = TSQUEUE_WAKE_LIFO;
+
+/** The kind of lock protecting the ready-queue, see lock.h. Ignored by
+ * READY_QUEUE_SHARED, which uses a process-shared mutex. */
+static const enum lock_kind READY_QUEUE_LOCK = LOCK_MUTEX;
+
+/** The kind of lock protecting the statistics shared by the cpu threads. */
+static const enum lock_kind STATS_LOCK = LOCK_MUTEX;
+
+/** The kind of lock protecting the jobs reserved by cpu threads, see
+ * LOOKAHEAD_HORIZON and AFFINITY_DISPATCH. */
+static const enum lock_kind LOOKAHEAD_LOCK = LOCK_MUTEX;
+
+/** The number of sub-queues to use for each cpu thread when READY_QUEUE_TYPE
+ * is READY_QUEUE_RELAXED. */
+static const unsigned RELAXED_SUBQUEUES_PER_CPU = 2;
+
+/** The name of the shared memory segment used when READY_QUEUE_TYPE is
+ * READY_QUEUE_SHARED, see shm_open(). */
+static const char *const SHARED_QUEUE_NAME = "/scheduler-ready-queue";
+
+/** The number of job priority levels, priorities in the job file must be less
+ * than this. This is a macro rather than a constant as it is used as an array
+ * size. */
+#define PRIORITY_LEVELS 8
+
+/** The time a job must wait in the ready-queue to gain one level of
+ * priority. */
+static const struct timespec PRIORITY_AGING_INTERVAL = {.tv_sec = 1};
+
+/** How long before a cpu thread finishes its job it takes the next job from
+ * the ready-queue, so the next job can start as soon as the current one
+ * completes. A reserved job is taken back by an idle cpu thread if the
+ * ready-queue empties, and no job is reserved while a cpu thread is waiting
+ * for the ready-queue. Zero disables this. Has no effect with
+ * READY_QUEUE_SHARED. */
+static const struct timespec LOOKAHEAD_HORIZON = {0};
+
+/** The burst in the job file is treated as an estimate, and each job runs
+ * for its burst multiplied by exp(N(0, RUNTIME_NOISE_SIGMA^2)). Zero runs
+ * every job for exactly its burst. Run times are chosen from the job id, so
+ * a job file gives the same run times under every READY_QUEUE_TYPE. */
+static const double RUNTIME_NOISE_SIGMA = 0;
+
+/** The probability that a job is a straggler, which runs STRAGGLER_FACTOR
+ * times longer than RUNTIME_NOISE_SIGMA alone would make it. */
+static const double STRAGGLER_PROBABILITY = 0;
+
+/** See STRAGGLER_PROBABILITY. */
+static const double STRAGGLER_FACTOR = 4;
+
+/** Once the ready-queue is empty and no more jobs will arrive, idle cpu
+ * threads start a backup copy of any job which has run for this many times
+ * its burst. Whichever copy finishes first completes the job and the other is
+ * cancelled. Zero disables this. Only useful with RUNTIME_NOISE_SIGMA or
+ * STRAGGLER_PROBABILITY set. */
+static const double SPECULATION_FACTOR = 0;
+
+/** The time a cpu spends switching to each job it dispatches before the
+ * job's burst starts. Zero makes dispatching free. */
+static const struct timespec CONTEXT_SWITCH_COST = {0};
+
+/** Extra time a cpu spends before a job's burst when the job's working set is
+ * not in its cache, that is when the job last ran on a different cpu, or when
+ * it has not run yet and the cpu's previous job came from a different job
+ * file. Zero disables this. */
+static const struct timespec CACHE_MIGRATION_PENALTY = {0};
+
+/** If true a cpu which takes a job that last ran on another cpu leaves it for
+ * that cpu instead, provided that cpu is expected to finish its current job
+ * within CACHE_MIGRATION_PENALTY and has no job waiting for it. The job is
+ * taken back by an idle cpu if the ready-queue empties. */
+static const bool AFFINITY_DISPATCH = false;
+
+/** The number of frequencies a cpu can run at. This is a macro rather than a
+ * constant as it is used as an array size. */
+#define CPU_FREQUENCY_LEVELS 3
+
+/** The frequencies a cpu can run at as fractions of the highest, in
+ * decreasing order. Bursts in the job file are run times at the highest
+ * frequency. */
+static const double CPU_FREQUENCIES[CPU_FREQUENCY_LEVELS] = {1.0, 0.8, 0.6};
+
+/** The power drawn by a busy cpu at each of CPU_FREQUENCIES in watts. */
+static const double CPU_ACTIVE_WATTS[CPU_FREQUENCY_LEVELS] = {4.0, 2.6, 1.6};
+
+/** The power drawn by an idle cpu in watts. */
+static const double CPU_IDLE_WATTS = 0.5;
+
+/** The power drawn by a cpu in deep idle in watts. */
+static const double CPU_DEEP_IDLE_WATTS = 0.05;
+
+/** How long a cpu stays idle before entering deep idle. */
+static const struct timespec DEEP_IDLE_AFTER = {.tv_nsec = 10000000};
+
+/** The time a cpu takes to wake from deep idle before it can start a job. */
+static const struct timespec DEEP_IDLE_WAKE_LATENCY = {0};
+
+/** The ways a cpu can choose the frequency to run each job at. */
+enum cpu_power_policy
+{
+    /** Always run at the highest frequency, finishing jobs as soon as
+     * possible to spend longer idle. */
+    POWER_RACE_TO_IDLE,
+
+    /** Run at the lowest frequency which covers the recent utilisation of
+     * the cpu with 25% headroom, in the manner of the Linux schedutil
+     * governor. */
+    POWER_FREQUENCY_SCALING
+};
+
+/** The way cpus choose their frequency. */
+static const enum cpu_power_policy CPU_POWER_POLICY = POWER_RACE_TO_IDLE;
+
+/** Every NOISE_TICK_PERIOD each cpu loses NOISE_TICK_COST to a timer tick,
+ * delaying the job it is running. The ticks of different cpus are spread
+ * evenly over the period. Zero disables ticks. Ticks, random bursts and the
+ * tenant together must take less than all of a cpu's time, which is checked
+ * when the simulation starts. */
+static const struct timespec NOISE_TICK_PERIOD = {0};
+
+/** See NOISE_TICK_PERIOD. */
+static const struct timespec NOISE_TICK_COST = {.tv_nsec = 50000};
+
+/** The average number of times a second that each cpu loses a random burst
+ * of time, with exponentially distributed lengths averaging NOISE_BURST_MEAN.
+ * Zero disables random bursts. */
+static const double NOISE_BURST_RATE = 0;
+
+/** See NOISE_BURST_RATE. */
+static const struct timespec NOISE_BURST_MEAN = {.tv_nsec = 1000000};
+
+/** The number of cpus shared with a noisy co-located tenant, which uses
+ * NOISE_TENANT_SHARE of each of them, running once at a random point in
+ * every NOISE_TENANT_PERIOD. Zero disables the tenant. */
+static const unsigned NOISE_TENANT_CPUS = 0;
+
+/** See NOISE_TENANT_CPUS. */
+static const double NOISE_TENANT_SHARE = 0.25;
+
+/** See NOISE_TENANT_CPUS. */
+static const struct timespec NOISE_TENANT_PERIOD = {.tv_nsec = 100000000};
+
+/** How much is written to the simulation log. Each level includes the ones
+ * before it. The statistics in the summary always cover every job. */
+enum log_level
+{
+    /** Only the summary written at the end of the run. */
+    LOG_LEVEL_SUMMARY,
+
+    /** The totals of each cpu() and task() thread. */
+    LOG_LEVEL_TOTALS,
+
+    /** The arrival, service, blocking and completion of one in
+     * LOG_SAMPLE_PERIOD jobs, chosen by id so the same jobs are logged on
+     * every run. */
+    LOG_LEVEL_SAMPLED,
+
+    /** The events of every job. */
+    LOG_LEVEL_FULL
+};
+
+/** How much is written to the simulation log. */
+static const enum log_level LOG_LEVEL = LOG_LEVEL_FULL;
+
+/** One in this many jobs are logged at LOG_LEVEL_SAMPLED, must not be
+ * zero. */
+static const uint64_t LOG_SAMPLE_PERIOD = 100;
+
+/** How records are written to the simulation log, see log_writer.h. */
+static const enum log_backend LOG_BACKEND = LOG_BACKEND_STDIO;
+
+/** If true each cpu() and task() thread writes its own shard of the
+ * simulation log, named after LOG_FILE_PATH, and the main thread writes the
+ * summary to another. Build scheduler-logmerge to merge them in to a single
+ * log. */
+static const bool LOG_SHARDS = false;
+
+/** The size at which the simulation log, or each shard, is moved aside and a
+ * new segment started, zero to never start one for size. Segments are
+ * preallocated to this size, unless LOG_BACKEND_WRITEV is used without
+ * LOG_SHARDS. See log_writer.h. */
+static const uint64_t LOG_SEGMENT_BYTES = 0;
+
+/** The time after which a new segment of the simulation log is started, zero
+ * to never start one for time. */
+static const struct timespec LOG_SEGMENT_PERIOD = {0};
+
+/** The number of old segments of the simulation log to keep, the newest
+ * being LOG_FILE_PATH followed by ".1", zero to keep all of them. */
+static const unsigned LOG_SEGMENTS_KEPT = 0;
+
 /** The path of the simulation log to write to. */
 static const char *const LOG_FILE_PATH = "simulation_log";
 
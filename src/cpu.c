@@ -9,29 +9,396 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "cpu.h"
+#include "config.h"
 #include "job.h"
 #include "log.h"
 #include <pthread.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+/** The interference on one cpu, see NOISE_TICK_PERIOD, NOISE_BURST_RATE and
+ * NOISE_TENANT_CPUS. Each kind of interference is a series of events, and
+ * the next event of each kind is kept here. */
+struct cpu_noise
+{
+    /** The state of the generator for random times. */
+    uint64_t rng;
+
+    /** The start of the next timer tick. */
+    struct timespec next_tick;
+
+    /** The start of the next random burst. */
+    struct timespec next_burst;
+
+    /** The length of the next random burst in nanoseconds. */
+    long long burst_ns;
+
+    /** True if the noisy tenant shares this cpu. */
+    bool has_tenant;
+
+    /** The start of the tenant's current period. */
+    struct timespec tenant_period;
+
+    /** When the tenant next runs, within its current period. */
+    struct timespec next_tenant;
+};
 
 /**
- * @brief Logs service time, waits for @p job.cpu_burst seconds, then logs
+ * @brief Logs service time, waits for @p job.cpu_burst_ns, then logs
  *        completion time. Also increments all values in @p stats.
  *
- * Calls log_service() before waiting and log_completion() after.
+ * Calls log_service() before waiting and log_completion() after. If
+ * look-ahead is enabled the next job is reserved while waiting.
  *
  * @param[in] job The job to handle.
- * @param[in,out] log_file The file to log to.
- * @param cpu_id The id to be used in log messages.
- * @param[in,out] stats Stats to modify.
+ * @param[in] params The parameters of the cpu() thread.
+ * @param[in,out] power The power states of the cpu.
+ * @param[in,out] noise The interference on the cpu.
+ * @param[in] last_completion The time the previous job of this cpu completed,
+ *                            NULL if this is the first job.
+ * @param last_source The source of the previous job of this cpu, zero if this
+ *                    is the first job.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int handle_job(struct job_struct *job, const struct cpu_params *params,
+                      struct cpu_power *power, struct cpu_noise *noise,
+                      const struct timespec *last_completion,
+                      unsigned last_source);
+
+/**
+ * @brief Waits until @p job has run for its overhead and burst, reserving the
+ *        next job LOOKAHEAD_HORIZON before the end if look-ahead is enabled.
+ *
+ * @param[in] job The job, service_mono, overhead_ns, frequency, stolen_ns
+ *                and actual_burst_ns must be set.
+ * @param[in] params The parameters of the cpu() thread.
+ *
+ * @return True if the job completed, false if it was cancelled because a
+ *         backup copy completed first.
+ */
+static bool run_job(const struct job_struct *job,
+                    const struct cpu_params *params);
+
+/**
+ * @brief Called once a CPU burst of @p job has completed. Sends the job to
+ *        the blocked set if it has an I/O burst next, otherwise records its
+ *        turnaround time and logs its completion.
+ *
+ * @param[in,out] job The job, completion times must be set. Set up for its
+ *                    next CPU burst if it has one.
+ * @param[in] params The parameters of the cpu() thread.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int finish_burst(struct job_struct *job,
+                        const struct cpu_params *params);
+
+/**
+ * @brief Start backup copies of jobs running on other cpus once they exceed
+ *        SPECULATION_FACTOR times their burst, until every running job has
+ *        a backup or has finished.
+ *
+ * @param[in] params The parameters of the cpu() thread, speculation must not
+ *                   be NULL.
+ * @param[in,out] power The power states of the cpu.
+ * @param[in,out] noise The interference on the cpu.
  *
  * @return Zero if the function succeeds, else an error code that can be
  *         passed to errno_or_ae_to_str().
  */
-static int handle_job(struct job_struct *job, FILE *log_file, unsigned cpu_id,
-                      struct cpu_shared_stats *stats);
+static int run_backups(const struct cpu_params *params,
+                       struct cpu_power *power, struct cpu_noise *noise);
+
+/**
+ * @brief Publish the job about to run on this cpu so that a backup copy can
+ *        be started, does nothing if speculative backups are disabled.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ * @param[in] job The job, service_mono must be set.
+ * @param[in] end The time the job will complete.
+ */
+static void speculation_start(const struct cpu_params *params,
+                              const struct job_struct *job,
+                              const struct timespec *end);
+
+/**
+ * @brief Remove the job running on this cpu from the shared table. If the
+ *        job has another copy running, the copy that calls this first
+ *        completes the job and the other is cancelled.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ *
+ * @return True if this copy completed the job, always true if speculative
+ *         backups are disabled.
+ */
+static bool speculation_finish(const struct cpu_params *params);
+
+/**
+ * @brief Sleep until @p time, or until the job running on this cpu is
+ *        cancelled if speculative backups are enabled.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ * @param[in] time The time to wake.
+ *
+ * @return False if the job was cancelled.
+ */
+static bool wait_until(const struct cpu_params *params,
+                       const struct timespec *time);
+
+/**
+ * @brief Takes the next job from the ready-queue. If look-ahead is enabled
+ *        and the queue is empty a job reserved by another cpu is stolen
+ *        instead of waiting.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ * @param[in,out] n_jobs See ready_queue_pop(), must be one.
+ * @param[out] job The job.
+ *
+ * @return See ready_queue_pop().
+ */
+static int take_job(const struct cpu_params *params, size_t *n_jobs,
+                    struct job_struct *job);
+
+/**
+ * @brief Leaves @p job for the cpu it last ran on if that cpu will be free
+ *        sooner than the cost of moving the job, see AFFINITY_DISPATCH.
+ *
+ * @param[in] params The parameters of the cpu() thread, lookahead must not be
+ *                   NULL.
+ * @param[in] job The job.
+ *
+ * @return True if the job was left for another cpu.
+ */
+static bool leave_for_last_cpu(const struct cpu_params *params,
+                               const struct job_struct *job);
+
+/**
+ * @brief Returns the time this cpu spends switching to @p job before its
+ *        burst, see CONTEXT_SWITCH_COST and CACHE_MIGRATION_PENALTY.
+ *
+ * @param[in] job The job.
+ * @param cpu_id The id of this cpu.
+ * @param last_source The source of the previous job of this cpu, zero if
+ *                    there was none.
+ * @param[out] is_cold Set to true if the job's working set is not in the
+ *                     cache of this cpu.
+ *
+ * @return The overhead in nanoseconds.
+ */
+static uint64_t switch_cost_ns(const struct job_struct *job, unsigned cpu_id,
+                               unsigned last_source, bool *is_cold);
+
+/**
+ * @brief Records the overhead of dispatching a job in the shared statistics.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ * @param is_cold True if the job paid CACHE_MIGRATION_PENALTY.
+ */
+static void count_switch(const struct cpu_params *params, bool is_cold);
+
+/**
+ * @brief Reserves the next job from the ready-queue without waiting, does
+ *        nothing if the queue is empty or a job is already reserved.
+ *
+ * @param[in] params The parameters of the cpu() thread, lookahead must not be
+ *                   NULL.
+ */
+static void reserve_job(const struct cpu_params *params);
+
+/**
+ * @brief Takes the job reserved by this cpu if it has not been stolen.
+ *
+ * @param[in] params The parameters of the cpu() thread.
+ * @param[out] job The job.
+ *
+ * @return True if a job was taken.
+ */
+static bool claim_job(const struct cpu_params *params,
+                      struct job_struct *job);
+
+/**
+ * @brief Takes the job that has waited the longest out of those reserved by
+ *        any cpu.
+ *
+ * @param[in] params The parameters of the cpu() thread, lookahead must not be
+ *                   NULL.
+ * @param[out] job The job.
+ * @param will_wait True if the cpu will wait in ready_queue_pop() when there is
+ *                  nothing to steal. The cpu is then counted in n_waiting,
+ *                  see struct cpu_lookahead, until it calls stop_waiting().
+ *
+ * @return True if a job was taken.
+ */
+static bool steal_job(const struct cpu_params *params,
+                      struct job_struct *job, bool will_wait);
+
+/**
+ * @brief Stops counting a cpu which waited in ready_queue_pop() after
+ *        steal_job() as waiting.
+ *
+ * @param[in] params The parameters of the cpu() thread, lookahead must not be
+ *                   NULL.
+ */
+static void stop_waiting(const struct cpu_params *params);
+
+/**
+ * @brief Choose how long a job actually runs for, see RUNTIME_NOISE_SIGMA.
+ *
+ * The choice depends only on the job id, the burst and @p attempt, so it is
+ * the same whichever cpu runs the job and in whatever order.
+ *
+ * @param[in] job The job.
+ * @param attempt Zero for the first run of the job, different values give
+ *                independent run times.
+ * @param[out] is_straggler Set to true if the job is a straggler.
+ *
+ * @return The run time in nanoseconds.
+ */
+static uint64_t noisy_burst_ns(const struct job_struct *job, unsigned attempt,
+                               bool *is_straggler);
+
+/**
+ * @brief Returns the next value of the splitmix64 generator with state
+ *        @p state.
+ */
+static uint64_t splitmix64(uint64_t *state);
+
+/**
+ * @brief Accounts for the time a cpu has been idle up to @p now, see
+ *        DEEP_IDLE_AFTER.
+ *
+ * @param[in,out] power The power states of the cpu.
+ * @param[in] now The time the cpu stops being idle.
+ *
+ * @return True if the cpu had entered deep idle.
+ */
+static bool power_idle(struct cpu_power *power, const struct timespec *now);
+
+/**
+ * @brief Accounts for a cpu running at CPU_FREQUENCIES[@p level] from
+ *        @p start until @p end, after which it is idle.
+ *
+ * @param[in,out] power The power states of the cpu.
+ * @param level The index in CPU_FREQUENCIES.
+ * @param[in] start The time the cpu became busy.
+ * @param[in] end The time the cpu became idle.
+ *
+ * @return The energy used in joules.
+ */
+static double power_run(struct cpu_power *power, unsigned level,
+                        const struct timespec *start,
+                        const struct timespec *end);
+
+/**
+ * @brief Returns the index in CPU_FREQUENCIES that the next job should run
+ *        at, see CPU_POWER_POLICY.
+ */
+static unsigned choose_frequency(const struct cpu_power *power);
+
+/**
+ * @brief Returns the time @p job occupies its cpu for @p burst_ns at the
+ *        highest frequency, including its overhead.
+ *
+ * @param[in] job The job, overhead_ns and frequency must be set.
+ * @param burst_ns The burst in nanoseconds at the highest frequency.
+ *
+ * @return The time in nanoseconds.
+ */
+static long long busy_time_ns(const struct job_struct *job, uint64_t burst_ns);
+
+/**
+ * @brief Start the interference on a cpu.
+ *
+ * @param[out] noise The interference.
+ * @param cpu_id The id of the cpu, which decides when its interference
+ *               happens.
+ * @param[in] start The time the cpu starts.
+ */
+static void noise_init(struct cpu_noise *noise, unsigned cpu_id,
+                       const struct timespec *start);
+
+/**
+ * @brief Returns the start of the next interference event, or NULL if there
+ *        is no interference.
+ *
+ * @param[in] noise The interference.
+ * @param[out] length_ns Set to the length of the event in nanoseconds.
+ *
+ * @return A pointer to the start time of the event within @p noise.
+ */
+static struct timespec *noise_next(struct cpu_noise *noise,
+                                   long long *length_ns);
+
+/**
+ * @brief Move on to the event after @p next, which must have been returned
+ *        by noise_next().
+ *
+ * @param[in,out] noise The interference.
+ * @param[in,out] next The start of the event.
+ */
+static void noise_advance(struct cpu_noise *noise, struct timespec *next);
+
+/**
+ * @brief Returns how long interference delays a burst which needs @p busy_ns
+ *        of the cpu from @p start, consuming the events which hit it.
+ *
+ * @param[in,out] noise The interference on the cpu.
+ * @param[in] start The time the burst starts.
+ * @param busy_ns The time the burst needs on the cpu in nanoseconds.
+ *
+ * @return The delay in nanoseconds.
+ */
+static long long noise_steal_ns(struct cpu_noise *noise,
+                                const struct timespec *start,
+                                long long busy_ns);
+
+/**
+ * @brief Returns a value from an exponential distribution with mean
+ *        @p mean, drawn using @p state.
+ */
+static double exponential(uint64_t *state, double mean);
+
+/**
+ * @brief Returns @p duration in nanoseconds.
+ */
+static long long duration_ns(const struct timespec *duration);
+
+/**
+ * @brief Returns the time from @p start to @p end in nanoseconds.
+ *
+ * @param[in] start The start time.
+ * @param[in] end The end time.
+ *
+ * @return The difference, negative if @p end is before @p start.
+ */
+static long long elapsed_ns(const struct timespec *start,
+                            const struct timespec *end);
+
+/**
+ * @brief Returns @p time plus @p ns nanoseconds.
+ *
+ * @param[in] time The time.
+ * @param ns The nanoseconds to add, may be negative.
+ *
+ * @return The sum.
+ */
+static struct timespec add_ns(const struct timespec *time, long long ns);
+
+/**
+ * @brief clock_nanosleep() until @p time on the monotonic clock, restarting
+ *        if interrupted.
+ *
+ * @param[in] time The time to wake.
+ */
+static void sleep_until(const struct timespec *time);
 
 void *cpu(void *ptr)
 {
@@ -39,78 +406,1096 @@ void *cpu(void *ptr)
 
     // Input arguments
     struct cpu_params *params = ptr;
-    struct cpu_shared_stats *stats = params->stats;
-    tsqueue *queue = params->queue;
     unsigned cpu_id = params->id;
-    FILE *log_file = params->log_file;
+    struct log_writer *log_file = params->log_file;
 
     // Total number of jobs inserted
     unsigned long n_jobs = 0;
 
+    struct job_struct job;
+    // True if job already holds the next job, reserved while running the
+    // previous one.
+    bool have_job = false;
+    struct timespec last_completion;
+    unsigned last_source = 0;
+
+    struct cpu_power *power = &params->power;
+    clock_gettime(CLOCK_MONOTONIC, &power->idle_since);
+    struct cpu_noise noise;
+    noise_init(&noise, cpu_id, &power->idle_since);
+
     size_t jobs_from_queue = 1;
     // The only time this will be non-zero is if the queue is closed due to an
     // error occurring elsewhere.
-    int queue_retval;
+    int queue_retval = 0;
     do
     {
-        struct job_struct job;
-        queue_retval = tsqueue_pop(queue, &jobs_from_queue, &job);
+        if (!have_job)
+        {
+            queue_retval = take_job(params, &jobs_from_queue, &job);
+        }
         if (jobs_from_queue == 1 && queue_retval == 0)
         {
+            retval = handle_job(&job, params, power, &noise,
+                                (n_jobs != 0) ? &last_completion : NULL,
+                                last_source);
             ++n_jobs;
-            retval = handle_job(&job, log_file, cpu_id, stats);
+            last_completion = job.completion_mono;
+            last_source = job.source;
+            have_job = claim_job(params, &job);
         }
     } while (retval == 0 && jobs_from_queue == 1 && queue_retval == 0);
 
-    if (retval == 0 && queue_retval == 0)
+    if (retval == 0 && queue_retval == 0 && params->speculation != NULL)
     {
-        retval = log_cpu_done(log_file, cpu_id, n_jobs);
+        retval = run_backups(params, power, &noise);
     }
 
-    params->retval = retval;
-    return NULL;
-}
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    power_idle(power, &now);
+    lock_acquire(&params->stats->lock);
+    params->stats->total_energy_j += power->energy_j;
+    lock_release(&params->stats->lock);
 
+    // Jobs this thread was running may never finish, so nothing else can
+    // decide when the queue is done.
+    if (retval != 0)
+    {
+        ready_queue_close(params->queue);
+    }
 
+    if (retval == 0 && queue_retval == 0)
+    {
+        retval = log_cpu_done(log_file, cpu_id, n_jobs,
+                              tsqueue_thread_wakeups(), power);
+    }
 
-static void run_job(const struct job_struct *job)
-{
-    struct timespec ts = {.tv_sec = job->cpu_burst};
-    // I have chosen to use clock_nanosleep instead of sleep here because it
-    // allows us to use a monotonic clock explicitly.
-    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) != 0)
+    int flush_retval = log_writer_flush(log_file);
+    if (retval == 0)
     {
+        retval = flush_retval;
     }
+
+    params->retval = retval;
+    return NULL;
 }
 
-static int handle_job(struct job_struct *job, FILE *log_file, unsigned cpu_id,
-                      struct cpu_shared_stats *stats)
+static int handle_job(struct job_struct *job, const struct cpu_params *params,
+                      struct cpu_power *power, struct cpu_noise *noise,
+                      const struct timespec *last_completion,
+                      unsigned last_source)
 {
     int retval = 0;
+    struct cpu_shared_stats *stats = params->stats;
 
     clock_gettime(CLOCK_MONOTONIC, &job->service_mono);
     clock_gettime(CLOCK_REALTIME, &job->service_real);
 
-    pthread_mutex_lock(&stats->lock);
-    ++stats->num_tasks;
-    stats->total_waiting_time +=
-        job->service_mono.tv_sec - job->arrival_mono.tv_sec;
-    pthread_mutex_unlock(&stats->lock);
+    // Only a job that was already waiting when the previous one completed
+    // shows the cost of dispatching it, otherwise the cpu was just idle.
+    bool count_gap = false;
+    long long gap_ns = 0;
+    if (last_completion != NULL
+        && (job->arrival_mono.tv_sec < last_completion->tv_sec
+            || (job->arrival_mono.tv_sec == last_completion->tv_sec
+                && job->arrival_mono.tv_nsec <= last_completion->tv_nsec)))
+    {
+        count_gap = true;
+        gap_ns = elapsed_ns(last_completion, &job->service_mono);
+    }
+
+    bool is_straggler = false;
+    job->actual_burst_ns = noisy_burst_ns(job, 0, &is_straggler);
+    bool is_cold = false;
+    job->overhead_ns = switch_cost_ns(job, params->id, last_source, &is_cold);
+    count_switch(params, is_cold);
+
+    bool was_deep = power_idle(power, &job->service_mono);
+    if (was_deep)
+    {
+        job->overhead_ns += (uint64_t)duration_ns(&DEEP_IDLE_WAKE_LATENCY);
+    }
+    unsigned level = choose_frequency(power);
+    job->frequency = CPU_FREQUENCIES[level];
+    job->stolen_ns = (uint64_t)noise_steal_ns(
+        noise, &job->service_mono, busy_time_ns(job, job->actual_burst_ns));
+
+    struct cpu_lookahead *lookahead = params->lookahead;
+    if (AFFINITY_DISPATCH && lookahead != NULL)
+    {
+        // Other cpus only know the estimate too.
+        lock_acquire(&lookahead->lock);
+        struct cpu_reservation *own = &lookahead->reservations[params->id - 1];
+        own->busy = true;
+        own->free_at = add_ns(&job->service_mono,
+                              busy_time_ns(job, job->cpu_burst_ns));
+        lock_release(&lookahead->lock);
+    }
+
+    bool is_first_burst = (job->next_burst == 0);
+    long long waiting_ns = elapsed_ns(&job->arrival_mono, &job->service_mono);
+    long long response_ns = elapsed_ns(&job->submit_mono, &job->service_mono);
+    job->waiting_ns += (uint64_t)waiting_ns;
+    lock_acquire(&stats->lock);
+    if (is_first_burst)
+    {
+        ++stats->num_tasks;
+        ++stats->num_tasks_by_priority[job->priority];
+        stats->total_response_ns += response_ns;
+        histogram_add(&stats->response_times, response_ns);
+    }
+    stats->total_estimated_ns += (long long)job->cpu_burst_ns;
+    stats->total_actual_ns += (long long)job->actual_burst_ns;
+    if (job->cpu_burst_ns != 0)
+    {
+        double error = ((double)job->actual_burst_ns - job->cpu_burst_ns)
+                       / job->cpu_burst_ns;
+        stats->total_relative_error += (error < 0) ? -error : error;
+    }
+    if (is_straggler)
+    {
+        ++stats->num_stragglers;
+    }
+    if (was_deep)
+    {
+        ++stats->num_deep_wakeups;
+    }
+    if (job->stolen_ns != 0)
+    {
+        ++stats->num_interrupted;
+        stats->total_interference_ns += (long long)job->stolen_ns;
+    }
+    stats->total_waiting_ns += waiting_ns;
+    if (is_first_burst
+        && elapsed_ns(&stats->latest_arrival_served, &job->arrival_mono) < 0)
+    {
+        ++stats->num_overtaken;
+    }
+    else if (is_first_burst)
+    {
+        stats->latest_arrival_served = job->arrival_mono;
+    }
+    if (count_gap)
+    {
+        stats->total_dispatch_gap_ns += gap_ns;
+        ++stats->num_dispatch_gaps;
+    }
+    lock_release(&stats->lock);
 
-    retval = log_service(log_file, cpu_id, job);
+    retval = log_service(params->log_file, params->id, job);
     if (retval == 0)
     {
-        run_job(job);
+        bool completed = run_job(job, params);
         clock_gettime(CLOCK_MONOTONIC, &job->completion_mono);
         clock_gettime(CLOCK_REALTIME, &job->completion_real);
+        job->last_cpu = params->id;
+        double energy_j = power_run(power, level, &job->service_mono,
+                                    &job->completion_mono);
+
+        lock_acquire(&stats->lock);
+        stats->total_busy_ns +=
+            elapsed_ns(&job->service_mono, &job->completion_mono);
+        stats->total_active_energy_j += energy_j;
+        lock_release(&stats->lock);
 
-        pthread_mutex_lock(&stats->lock);
-        stats->total_turnaround_time +=
-            job->completion_mono.tv_sec - job->arrival_mono.tv_sec;
-        pthread_mutex_unlock(&stats->lock);
+        if (AFFINITY_DISPATCH && lookahead != NULL)
+        {
+            lock_acquire(&lookahead->lock);
+            lookahead->reservations[params->id - 1].busy = false;
+            lock_release(&lookahead->lock);
+        }
+
+        if (completed)
+        {
+            retval = finish_burst(job, params);
+        }
+    }
+
+    return retval;
+}
+
+static int finish_burst(struct job_struct *job,
+                        const struct cpu_params *params)
+{
+    int retval = 0;
+    struct cpu_shared_stats *stats = params->stats;
+
+    if (job->next_burst < job->n_later_bursts)
+    {
+        retval = log_blocked(params->log_file, params->id, job);
+
+        struct timespec wake = add_ns(
+            &job->completion_mono,
+            (long long)job->later_bursts_ns[job->next_burst]);
+        job->cpu_burst_ns = job->later_bursts_ns[job->next_burst + 1];
+        job->next_burst += 2;
 
-        retval = log_completion(log_file, cpu_id, job);
+        lock_acquire(&stats->lock);
+        ++stats->num_io_bursts;
+        lock_release(&stats->lock);
+
+        // The job must reach the blocked set even if logging failed, or the
+        // queue would never be done.
+        int io_retval = io_block(params->io, job, &wake);
+        if (retval == 0)
+        {
+            retval = io_retval;
+        }
+    }
+    else
+    {
+        long long turnaround_ns =
+            elapsed_ns(&job->submit_mono, &job->completion_mono);
+        lock_acquire(&stats->lock);
+        stats->total_turnaround_ns += turnaround_ns;
+        histogram_add(&stats->turnaround_times, turnaround_ns);
+        // Recorded per job, like the average waiting time, rather than per
+        // burst.
+        long long waiting_ns = (long long)job->waiting_ns;
+        histogram_add(&stats->waiting_times, waiting_ns);
+        if (waiting_ns > stats->max_waiting_ns[job->priority])
+        {
+            stats->max_waiting_ns[job->priority] = waiting_ns;
+        }
+        lock_release(&stats->lock);
+
+        if (job->n_later_bursts != 0)
+        {
+            io_job_done(params->io);
+        }
+
+        retval = log_completion(params->log_file, params->id, job);
     }
 
     return retval;
 }
+
+static bool run_job(const struct job_struct *job,
+                    const struct cpu_params *params)
+{
+    struct timespec end = add_ns(&job->service_mono,
+                                 busy_time_ns(job, job->actual_burst_ns)
+                                 + (long long)job->stolen_ns);
+    speculation_start(params, job, &end);
+
+    bool running = true;
+    long long horizon_ns = duration_ns(&LOOKAHEAD_HORIZON);
+    if (params->lookahead != NULL && horizon_ns != 0)
+    {
+        // The cpu only knows the estimate, so a job which finishes early
+        // reserves its successor on completion instead.
+        struct timespec reserve_at = add_ns(
+            &job->service_mono,
+            busy_time_ns(job, job->cpu_burst_ns) - horizon_ns);
+        if (elapsed_ns(&reserve_at, &end) < 0)
+        {
+            reserve_at = end;
+        }
+        running = wait_until(params, &reserve_at);
+        if (running)
+        {
+            reserve_job(params);
+        }
+    }
+
+    if (running)
+    {
+        wait_until(params, &end);
+    }
+
+    return speculation_finish(params);
+}
+
+static int run_backups(const struct cpu_params *params,
+                       struct cpu_power *power, struct cpu_noise *noise)
+{
+    int retval = 0;
+    struct cpu_speculation *speculation = params->speculation;
+    size_t self = params->id - 1;
+
+    pthread_mutex_lock(&speculation->mutex);
+    while (retval == 0)
+    {
+        // Back up the job which became eligible first.
+        size_t chosen = speculation->n_cpus;
+        for (size_t i = 0; i < speculation->n_cpus; ++i)
+        {
+            struct cpu_running *running = &speculation->running[i];
+            if (running->running && !running->is_backup
+                && !running->has_backup && !running->cancelled
+                && (chosen == speculation->n_cpus
+                    || elapsed_ns(&running->threshold,
+                                  &speculation->running[chosen].threshold)
+                       > 0))
+            {
+                chosen = i;
+            }
+        }
+        if (chosen == speculation->n_cpus)
+        {
+            break;
+        }
+
+        struct cpu_running *primary = &speculation->running[chosen];
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsed_ns(&now, &primary->threshold) > 0)
+        {
+            // Woken early whenever a job starts or finishes, then look
+            // again.
+            ++speculation->n_seeking;
+            pthread_cond_timedwait(&speculation->changed, &speculation->mutex,
+                                   &primary->threshold);
+            --speculation->n_seeking;
+            continue;
+        }
+
+        struct job_struct job = primary->job;
+        job.service_mono = now;
+        clock_gettime(CLOCK_REALTIME, &job.service_real);
+        bool is_straggler;
+        job.actual_burst_ns = noisy_burst_ns(&job, 1, &is_straggler);
+        // The job is always cold here as its original is on another cpu.
+        bool is_cold;
+        job.overhead_ns = switch_cost_ns(&job, params->id, 0, &is_cold);
+        bool was_deep = power_idle(power, &now);
+        if (was_deep)
+        {
+            job.overhead_ns += (uint64_t)duration_ns(&DEEP_IDLE_WAKE_LATENCY);
+        }
+        unsigned level = choose_frequency(power);
+        job.frequency = CPU_FREQUENCIES[level];
+        long long busy_ns = busy_time_ns(&job, job.actual_burst_ns);
+        job.stolen_ns = (uint64_t)noise_steal_ns(noise, &now, busy_ns);
+        struct timespec end = add_ns(&now,
+                                     busy_ns + (long long)job.stolen_ns);
+
+        primary->has_backup = true;
+        primary->partner = self;
+        speculation->running[self] = (struct cpu_running){
+            .running = true,
+            .is_backup = true,
+            .partner = chosen,
+            .job = job,
+            .end = end
+        };
+        pthread_mutex_unlock(&speculation->mutex);
+
+        lock_acquire(&params->stats->lock);
+        ++params->stats->num_backups;
+        if (was_deep)
+        {
+            ++params->stats->num_deep_wakeups;
+        }
+        if (job.stolen_ns != 0)
+        {
+            ++params->stats->num_interrupted;
+            params->stats->total_interference_ns += (long long)job.stolen_ns;
+        }
+        lock_release(&params->stats->lock);
+        count_switch(params, is_cold);
+
+        retval = log_service(params->log_file, params->id, &job);
+        wait_until(params, &end);
+        bool completed = speculation_finish(params);
+        clock_gettime(CLOCK_MONOTONIC, &job.completion_mono);
+        clock_gettime(CLOCK_REALTIME, &job.completion_real);
+        job.last_cpu = params->id;
+        double energy_j = power_run(power, level, &job.service_mono,
+                                    &job.completion_mono);
+
+        lock_acquire(&params->stats->lock);
+        params->stats->total_busy_ns +=
+            elapsed_ns(&job.service_mono, &job.completion_mono);
+        params->stats->total_active_energy_j += energy_j;
+        lock_release(&params->stats->lock);
+
+        if (completed)
+        {
+            int finish_retval = finish_burst(&job, params);
+            if (retval == 0)
+            {
+                retval = finish_retval;
+            }
+        }
+
+        pthread_mutex_lock(&speculation->mutex);
+    }
+    pthread_mutex_unlock(&speculation->mutex);
+
+    return retval;
+}
+
+static void speculation_start(const struct cpu_params *params,
+                              const struct job_struct *job,
+                              const struct timespec *end)
+{
+    struct cpu_speculation *speculation = params->speculation;
+    if (speculation == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&speculation->mutex);
+    speculation->running[params->id - 1] = (struct cpu_running){
+        .running = true,
+        .job = *job,
+        .end = *end,
+        .threshold = add_ns(&job->service_mono,
+                            busy_time_ns(job,
+                                         (uint64_t)(SPECULATION_FACTOR
+                                                    * job->cpu_burst_ns)))
+    };
+    // The job may become eligible for a backup before the one a seeking
+    // cpu is waiting for.
+    if (speculation->n_seeking != 0)
+    {
+        pthread_cond_broadcast(&speculation->changed);
+    }
+    pthread_mutex_unlock(&speculation->mutex);
+}
+
+static bool speculation_finish(const struct cpu_params *params)
+{
+    struct cpu_speculation *speculation = params->speculation;
+    if (speculation == NULL)
+    {
+        return true;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&speculation->mutex);
+    struct cpu_running *own = &speculation->running[params->id - 1];
+    bool completed = !own->cancelled;
+    bool won_as_backup = completed && own->is_backup;
+    long long wasted_ns = 0;
+    // When the job would have completed had no backup been started.
+    struct timespec unspeculated = own->end;
+    if (completed && (own->is_backup || own->has_backup))
+    {
+        // Only a copy which is still running has used any time, one which
+        // has already stopped was not cancelled by this one.
+        struct cpu_running *other = &speculation->running[own->partner];
+        if (other->running && !other->cancelled)
+        {
+            other->cancelled = true;
+            pthread_cond_signal(&speculation->cancelled[own->partner]);
+            long long other_ns = elapsed_ns(&other->job.service_mono, &now);
+            wasted_ns = (other_ns > 0) ? other_ns : 0;
+        }
+        if (own->is_backup)
+        {
+            unspeculated = other->end;
+        }
+    }
+    own->running = false;
+    if (speculation->n_seeking != 0)
+    {
+        pthread_cond_broadcast(&speculation->changed);
+    }
+    pthread_mutex_unlock(&speculation->mutex);
+
+    if (completed)
+    {
+        struct cpu_shared_stats *stats = params->stats;
+        lock_acquire(&stats->lock);
+        stats->total_wasted_ns += wasted_ns;
+        if (won_as_backup)
+        {
+            ++stats->num_backups_won;
+        }
+        if (elapsed_ns(&stats->latest_completion, &now) > 0)
+        {
+            stats->latest_completion = now;
+        }
+        if (elapsed_ns(&stats->latest_completion_unspeculated, &unspeculated)
+            > 0)
+        {
+            stats->latest_completion_unspeculated = unspeculated;
+        }
+        lock_release(&stats->lock);
+    }
+
+    return completed;
+}
+
+static bool wait_until(const struct cpu_params *params,
+                       const struct timespec *time)
+{
+    struct cpu_speculation *speculation = params->speculation;
+    if (speculation == NULL)
+    {
+        sleep_until(time);
+        return true;
+    }
+
+    pthread_mutex_lock(&speculation->mutex);
+    struct cpu_running *own = &speculation->running[params->id - 1];
+    while (!own->cancelled
+           && pthread_cond_timedwait(
+                  &speculation->cancelled[params->id - 1],
+                  &speculation->mutex, time) != ETIMEDOUT)
+    {
+    }
+    bool running = !own->cancelled;
+    pthread_mutex_unlock(&speculation->mutex);
+
+    return running;
+}
+
+int cpu_speculation_init(struct cpu_speculation *speculation, size_t n_cpus)
+{
+    int retval = 0;
+
+    *speculation = (struct cpu_speculation){.n_cpus = n_cpus};
+    speculation->running = calloc(n_cpus, sizeof(*speculation->running));
+    speculation->cancelled = malloc(sizeof(*speculation->cancelled) * n_cpus);
+    if (speculation->running == NULL || speculation->cancelled == NULL)
+    {
+        retval = errno;
+    }
+
+    pthread_condattr_t attr;
+    bool attr_is_initialised = false;
+    if (retval == 0)
+    {
+        retval = pthread_condattr_init(&attr);
+    }
+
+    if (retval == 0)
+    {
+        attr_is_initialised = true;
+        retval = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    }
+
+    bool changed_is_initialised = false;
+    if (retval == 0)
+    {
+        retval = pthread_cond_init(&speculation->changed, &attr);
+    }
+
+    size_t n_cancelled = 0;
+    if (retval == 0)
+    {
+        changed_is_initialised = true;
+    }
+    while (retval == 0 && n_cancelled < n_cpus)
+    {
+        retval = pthread_cond_init(&speculation->cancelled[n_cancelled],
+                                   &attr);
+        if (retval == 0)
+        {
+            ++n_cancelled;
+        }
+    }
+
+    if (attr_is_initialised)
+    {
+        pthread_condattr_destroy(&attr);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_mutex_init(&speculation->mutex, NULL);
+    }
+
+    if (retval != 0)
+    {
+        for (size_t i = 0; i < n_cancelled; ++i)
+        {
+            pthread_cond_destroy(&speculation->cancelled[i]);
+        }
+        if (changed_is_initialised)
+        {
+            pthread_cond_destroy(&speculation->changed);
+        }
+        free(speculation->cancelled);
+        free(speculation->running);
+        speculation->cancelled = NULL;
+        speculation->running = NULL;
+    }
+
+    return retval;
+}
+
+void cpu_speculation_destroy(struct cpu_speculation *speculation)
+{
+    pthread_mutex_destroy(&speculation->mutex);
+    pthread_cond_destroy(&speculation->changed);
+    for (size_t i = 0; i < speculation->n_cpus; ++i)
+    {
+        pthread_cond_destroy(&speculation->cancelled[i]);
+    }
+    free(speculation->cancelled);
+    free(speculation->running);
+}
+
+static int take_job(const struct cpu_params *params, size_t *n_jobs,
+                    struct job_struct *job)
+{
+    if (params->lookahead == NULL)
+    {
+        return ready_queue_pop(params->queue, n_jobs, job);
+    }
+
+    int retval = 0;
+    bool left = false;
+    do
+    {
+        // Reserved jobs are only stolen once the queue is empty so that they
+        // keep their place behind the jobs still in the queue. A shared
+        // queue does not support ready_queue_try_pop() so jobs are never
+        // reserved from it.
+        bool stolen = false;
+        *n_jobs = 1;
+        retval = ready_queue_try_pop(params->queue, n_jobs, job);
+        if (retval == TSQUEUE_EMPTY || retval == ENOTSUP
+            || (retval == 0 && *n_jobs == 0))
+        {
+            bool will_wait = (retval != 0);
+            stolen = steal_job(params, job, will_wait);
+            if (stolen)
+            {
+                retval = 0;
+                *n_jobs = 1;
+            }
+            else if (will_wait)
+            {
+                *n_jobs = 1;
+                retval = ready_queue_pop(params->queue, n_jobs, job);
+                stop_waiting(params);
+            }
+        }
+
+        // A stolen job was already passed over by its last cpu.
+        left = (retval == 0 && *n_jobs == 1 && !stolen
+                && leave_for_last_cpu(params, job));
+    } while (left);
+
+    return retval;
+}
+
+static void reserve_job(const struct cpu_params *params)
+{
+    struct cpu_lookahead *lookahead = params->lookahead;
+    bool reserved = false;
+
+    // The lock is held while popping so that no job can be left for this
+    // cpu in the meantime.
+    lock_acquire(&lookahead->lock);
+    struct cpu_reservation *own = &lookahead->reservations[params->id - 1];
+    size_t n = 1;
+    if (!own->reserved && lookahead->n_waiting == 0
+        && ready_queue_try_pop(params->queue, &n, &own->job) == 0 && n == 1)
+    {
+        own->reserved = true;
+        reserved = true;
+    }
+    lock_release(&lookahead->lock);
+
+    if (reserved)
+    {
+        lock_acquire(&params->stats->lock);
+        ++params->stats->num_reserved;
+        lock_release(&params->stats->lock);
+    }
+}
+
+static bool leave_for_last_cpu(const struct cpu_params *params,
+                               const struct job_struct *job)
+{
+    if (!AFFINITY_DISPATCH || job->last_cpu == 0
+        || job->last_cpu == params->id)
+    {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct cpu_lookahead *lookahead = params->lookahead;
+    lock_acquire(&lookahead->lock);
+    struct cpu_reservation *last = &lookahead->reservations[job->last_cpu - 1];
+    bool left = lookahead->n_waiting == 0 && last->busy && !last->reserved
+                && elapsed_ns(&now, &last->free_at)
+                   < duration_ns(&CACHE_MIGRATION_PENALTY);
+    if (left)
+    {
+        last->job = *job;
+        last->reserved = true;
+    }
+    lock_release(&lookahead->lock);
+
+    if (left)
+    {
+        lock_acquire(&params->stats->lock);
+        ++params->stats->num_affinity_waits;
+        lock_release(&params->stats->lock);
+    }
+
+    return left;
+}
+
+static uint64_t switch_cost_ns(const struct job_struct *job, unsigned cpu_id,
+                               unsigned last_source, bool *is_cold)
+{
+    *is_cold = (job->last_cpu != 0) ? job->last_cpu != cpu_id
+                                    : job->source != last_source;
+    uint64_t cost_ns = (uint64_t)duration_ns(&CONTEXT_SWITCH_COST);
+    if (*is_cold)
+    {
+        cost_ns += (uint64_t)duration_ns(&CACHE_MIGRATION_PENALTY);
+    }
+    return cost_ns;
+}
+
+static void count_switch(const struct cpu_params *params, bool is_cold)
+{
+    struct cpu_shared_stats *stats = params->stats;
+    lock_acquire(&stats->lock);
+    ++stats->num_switches;
+    stats->total_switch_ns += duration_ns(&CONTEXT_SWITCH_COST);
+    if (is_cold)
+    {
+        ++stats->num_cold;
+        stats->total_cold_ns += duration_ns(&CACHE_MIGRATION_PENALTY);
+    }
+    lock_release(&stats->lock);
+}
+
+static bool claim_job(const struct cpu_params *params,
+                      struct job_struct *job)
+{
+    bool claimed = false;
+    struct cpu_lookahead *lookahead = params->lookahead;
+
+    if (lookahead != NULL)
+    {
+        lock_acquire(&lookahead->lock);
+        struct cpu_reservation *own = &lookahead->reservations[params->id - 1];
+        if (own->reserved)
+        {
+            *job = own->job;
+            own->reserved = false;
+            claimed = true;
+        }
+        lock_release(&lookahead->lock);
+    }
+
+    return claimed;
+}
+
+static bool steal_job(const struct cpu_params *params,
+                      struct job_struct *job, bool will_wait)
+{
+    struct cpu_lookahead *lookahead = params->lookahead;
+    struct cpu_reservation *oldest = NULL;
+
+    lock_acquire(&lookahead->lock);
+    for (size_t i = 0; i < lookahead->n_cpus; ++i)
+    {
+        struct cpu_reservation *res = &lookahead->reservations[i];
+        if (res->reserved
+            && (oldest == NULL
+                || res->job.arrival_mono.tv_sec
+                   < oldest->job.arrival_mono.tv_sec
+                || (res->job.arrival_mono.tv_sec
+                    == oldest->job.arrival_mono.tv_sec
+                    && res->job.arrival_mono.tv_nsec
+                       < oldest->job.arrival_mono.tv_nsec)))
+        {
+            oldest = res;
+        }
+    }
+    if (oldest != NULL)
+    {
+        *job = oldest->job;
+        oldest->reserved = false;
+    }
+    else if (will_wait)
+    {
+        // Counted under the same lock as the search so that no job can be
+        // reserved between finding nothing and waiting in the queue.
+        ++lookahead->n_waiting;
+    }
+    lock_release(&lookahead->lock);
+
+    if (oldest != NULL)
+    {
+        lock_acquire(&params->stats->lock);
+        ++params->stats->num_stolen;
+        lock_release(&params->stats->lock);
+    }
+
+    return oldest != NULL;
+}
+
+static void stop_waiting(const struct cpu_params *params)
+{
+    lock_acquire(&params->lookahead->lock);
+    --params->lookahead->n_waiting;
+    lock_release(&params->lookahead->lock);
+}
+
+static bool power_idle(struct cpu_power *power, const struct timespec *now)
+{
+    long long idle_ns = elapsed_ns(&power->idle_since, now);
+    long long deep_ns = idle_ns - duration_ns(&DEEP_IDLE_AFTER);
+    if (idle_ns < 0)
+    {
+        idle_ns = 0;
+    }
+    if (deep_ns < 0)
+    {
+        deep_ns = 0;
+    }
+
+    power->idle_ns += idle_ns;
+    power->deep_idle_ns += deep_ns;
+    power->energy_j += (CPU_IDLE_WATTS * (idle_ns - deep_ns)
+                        + CPU_DEEP_IDLE_WATTS * deep_ns) / 1e9;
+
+    return deep_ns > 0;
+}
+
+static double power_run(struct cpu_power *power, unsigned level,
+                        const struct timespec *start,
+                        const struct timespec *end)
+{
+    long long busy_ns = elapsed_ns(start, end);
+    long long window_ns = elapsed_ns(&power->idle_since, end);
+
+    // The work done is measured at the highest frequency so that the
+    // utilisation does not depend on the frequency chosen.
+    if (window_ns > 0)
+    {
+        double sample = busy_ns * CPU_FREQUENCIES[level] / window_ns;
+        power->utilisation = (power->utilisation + sample) / 2;
+    }
+
+    double energy_j = CPU_ACTIVE_WATTS[level] * busy_ns / 1e9;
+    power->active_ns[level] += busy_ns;
+    power->energy_j += energy_j;
+    power->idle_since = *end;
+
+    return energy_j;
+}
+
+static unsigned choose_frequency(const struct cpu_power *power)
+{
+    unsigned level = 0;
+    if (CPU_POWER_POLICY == POWER_FREQUENCY_SCALING)
+    {
+        double wanted = 1.25 * power->utilisation;
+        while (level + 1 < CPU_FREQUENCY_LEVELS
+               && CPU_FREQUENCIES[level + 1] >= wanted)
+        {
+            ++level;
+        }
+    }
+    return level;
+}
+
+static long long busy_time_ns(const struct job_struct *job, uint64_t burst_ns)
+{
+    return (long long)job->overhead_ns
+           + (long long)(burst_ns / job->frequency);
+}
+
+static void noise_init(struct cpu_noise *noise, unsigned cpu_id,
+                       const struct timespec *start)
+{
+    // The same for every run so that queue configurations see the same
+    // interference.
+    noise->rng = 0x6e6f697365u ^ ((uint64_t)cpu_id << 32);
+
+    long long tick_period_ns = duration_ns(&NOISE_TICK_PERIOD);
+    noise->next_tick = add_ns(start, tick_period_ns * (cpu_id - 1)
+                                         / (long long)CPU_COUNT);
+
+    if (NOISE_BURST_RATE > 0)
+    {
+        noise->next_burst = add_ns(
+            start, (long long)exponential(&noise->rng, 1e9 / NOISE_BURST_RATE));
+        noise->burst_ns = (long long)exponential(
+            &noise->rng, (double)duration_ns(&NOISE_BURST_MEAN));
+    }
+
+    noise->has_tenant = (cpu_id <= NOISE_TENANT_CPUS);
+    noise->tenant_period = *start;
+    long long slack_ns = (long long)(duration_ns(&NOISE_TENANT_PERIOD)
+                                     * (1 - NOISE_TENANT_SHARE));
+    noise->next_tenant = add_ns(
+        start, (long long)(slack_ns * ((splitmix64(&noise->rng) >> 11)
+                                       * 0x1p-53)));
+}
+
+static struct timespec *noise_next(struct cpu_noise *noise,
+                                   long long *length_ns)
+{
+    struct timespec *next = NULL;
+
+    if (duration_ns(&NOISE_TICK_PERIOD) != 0)
+    {
+        next = &noise->next_tick;
+        *length_ns = duration_ns(&NOISE_TICK_COST);
+    }
+
+    if (NOISE_BURST_RATE > 0
+        && (next == NULL || elapsed_ns(&noise->next_burst, next) > 0))
+    {
+        next = &noise->next_burst;
+        *length_ns = noise->burst_ns;
+    }
+
+    if (noise->has_tenant
+        && (next == NULL || elapsed_ns(&noise->next_tenant, next) > 0))
+    {
+        next = &noise->next_tenant;
+        *length_ns = (long long)(duration_ns(&NOISE_TENANT_PERIOD)
+                                 * NOISE_TENANT_SHARE);
+    }
+
+    return next;
+}
+
+static void noise_advance(struct cpu_noise *noise, struct timespec *next)
+{
+    if (next == &noise->next_tick)
+    {
+        noise->next_tick = add_ns(next, duration_ns(&NOISE_TICK_PERIOD));
+    }
+    else if (next == &noise->next_burst)
+    {
+        noise->next_burst = add_ns(
+            next, (long long)exponential(&noise->rng, 1e9 / NOISE_BURST_RATE));
+        noise->burst_ns = (long long)exponential(
+            &noise->rng, (double)duration_ns(&NOISE_BURST_MEAN));
+    }
+    else
+    {
+        long long period_ns = duration_ns(&NOISE_TENANT_PERIOD);
+        long long slack_ns = (long long)(period_ns * (1 - NOISE_TENANT_SHARE));
+        noise->tenant_period = add_ns(&noise->tenant_period, period_ns);
+        noise->next_tenant = add_ns(
+            &noise->tenant_period,
+            (long long)(slack_ns * ((splitmix64(&noise->rng) >> 11)
+                                    * 0x1p-53)));
+    }
+}
+
+static long long noise_steal_ns(struct cpu_noise *noise,
+                                const struct timespec *start,
+                                long long busy_ns)
+{
+    long long stolen_ns = 0;
+    struct timespec end = add_ns(start, busy_ns);
+
+    long long length_ns = 0;
+    struct timespec *next;
+    while ((next = noise_next(noise, &length_ns)) != NULL
+           && elapsed_ns(next, &end) > 0)
+    {
+        // An event which began while the cpu was idle only delays the burst
+        // by the part left when the burst starts.
+        long long early_ns = elapsed_ns(next, start);
+        long long delay_ns = (early_ns > 0) ? length_ns - early_ns : length_ns;
+        if (delay_ns > 0)
+        {
+            stolen_ns += delay_ns;
+            end = add_ns(&end, delay_ns);
+        }
+        noise_advance(noise, next);
+    }
+
+    return stolen_ns;
+}
+
+static double exponential(uint64_t *state, double mean)
+{
+    // Uniform in (0, 1].
+    double u = ((splitmix64(state) >> 11) + 1) * 0x1p-53;
+    return -mean * log(u);
+}
+
+static long long duration_ns(const struct timespec *duration)
+{
+    return (long long)duration->tv_sec * 1000000000 + duration->tv_nsec;
+}
+
+static long long elapsed_ns(const struct timespec *start,
+                            const struct timespec *end)
+{
+    return (long long)(end->tv_sec - start->tv_sec) * 1000000000
+           + (end->tv_nsec - start->tv_nsec);
+}
+
+static struct timespec add_ns(const struct timespec *time, long long ns)
+{
+    long long nsec = time->tv_nsec + ns % 1000000000;
+    struct timespec sum = {
+        .tv_sec = time->tv_sec + (time_t)(ns / 1000000000),
+    };
+    if (nsec < 0)
+    {
+        --sum.tv_sec;
+        nsec += 1000000000;
+    }
+    else if (nsec >= 1000000000)
+    {
+        ++sum.tv_sec;
+        nsec -= 1000000000;
+    }
+    sum.tv_nsec = (long)nsec;
+    return sum;
+}
+
+static uint64_t noisy_burst_ns(const struct job_struct *job, unsigned attempt,
+                               bool *is_straggler)
+{
+    *is_straggler = false;
+    if (RUNTIME_NOISE_SIGMA == 0 && STRAGGLER_PROBABILITY == 0)
+    {
+        return job->cpu_burst_ns;
+    }
+
+    uint64_t state = job->id ^ ((uint64_t)attempt << 56)
+                     ^ ((uint64_t)job->next_burst << 48);
+    // Uniform values in (0, 1].
+    double u1 = ((splitmix64(&state) >> 11) + 1) * 0x1p-53;
+    double u2 = ((splitmix64(&state) >> 11) + 1) * 0x1p-53;
+    double u3 = ((splitmix64(&state) >> 11) + 1) * 0x1p-53;
+
+    // Box-Muller transform to a standard normal value.
+    double normal = sqrt(-2 * log(u1)) * cos(6.283185307179586 * u2);
+    double factor = exp(RUNTIME_NOISE_SIGMA * normal);
+    if (u3 <= STRAGGLER_PROBABILITY)
+    {
+        *is_straggler = true;
+        factor *= STRAGGLER_FACTOR;
+    }
+
+    double actual = job->cpu_burst_ns * factor;
+    // Keep well clear of overflowing timespec arithmetic.
+    return (actual < 0x1p62) ? (uint64_t)actual : (uint64_t)1 << 62;
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static void sleep_until(const struct timespec *time)
+{
+    // I have chosen to use clock_nanosleep instead of sleep here because it
+    // allows us to use a monotonic clock explicitly.
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, time, NULL) != 0)
+    {
+    }
+}
@@ -9,11 +9,43 @@
 #ifndef CPU_H
 #define CPU_H
 
-#include "tsqueue.h"
+#include "ready_queue.h"
+#include "config.h"
+#include "lock.h"
+#include "job.h"
+#include "histogram.h"
+#include "io.h"
+#include "log_writer.h"
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <time.h>
 #include <pthread.h>
 
+/** The power states of a cpu() thread over the run, see
+ * CPU_POWER_POLICY. */
+struct cpu_power
+{
+    /** The time the cpu last became idle. */
+    struct timespec idle_since;
+
+    /** Recent utilisation of the cpu as a fraction of its capacity at the
+     * highest frequency, used by POWER_FREQUENCY_SCALING. */
+    double utilisation;
+
+    /** Time in nanoseconds spent busy at each of CPU_FREQUENCIES. */
+    long long active_ns[CPU_FREQUENCY_LEVELS];
+
+    /** Time in nanoseconds spent idle, including deep idle. */
+    long long idle_ns;
+
+    /** Time in nanoseconds spent in deep idle. */
+    long long deep_idle_ns;
+
+    /** Energy used in joules. */
+    double energy_j;
+};
+
 /** Parameters to pass to cpu(). */
 struct cpu_params
 {
@@ -21,13 +53,27 @@ struct cpu_params
     struct cpu_shared_stats *stats;
 
     /** The ready-queue, cpu() threads only act as consumers. */
-    tsqueue *queue;
+    struct ready_queue *queue;
 
     /** The id of the cpu to be used for logging. */
     unsigned id;
 
     /** The file to write log messages to. */
-    FILE *log_file;
+    struct log_writer *log_file;
+
+    /** Jobs reserved by or left for cpu() threads, NULL if look-ahead and
+     * affinity dispatch are disabled. */
+    struct cpu_lookahead *lookahead;
+
+    /** Jobs running on each cpu() thread, NULL if speculative backups are
+     * disabled. */
+    struct cpu_speculation *speculation;
+
+    /** The blocked set that jobs go to for their I/O bursts. */
+    struct io_wait *io;
+
+    /** The power states of the cpu over the run, set by cpu(). */
+    struct cpu_power power;
 
     /** The return value of the cpu() call. cpu() will set this before
      * exiting. Zero is successful, otherwise can be passed to
@@ -40,27 +86,265 @@ struct cpu_shared_stats
 {
     /** Lock for the data in this struct. All cpu() threads must hold this
      * lock when reading or writing any of the values in this struct. */
-    pthread_mutex_t lock;
+    struct lock lock;
 
-    /** Total amount of time spent waiting by jobs in the ready queue. */
-    time_t total_waiting_time;
+    /** Total time in nanoseconds spent waiting by jobs in the ready
+     * queue. */
+    long long total_waiting_ns;
 
-    /** Total amount of time spent by jobs waiting in the queue or
+    /** Total time in nanoseconds spent by jobs waiting in the queue or
      * running. */
-    time_t total_turnaround_time;
+    long long total_turnaround_ns;
 
     /** Number of jobs which have been inserted in to the queue. */
     unsigned long num_tasks;
+
+    /** Number of jobs of each priority which have been taken from the
+     * queue. */
+    unsigned long num_tasks_by_priority[PRIORITY_LEVELS];
+
+    /** Longest total time in nanoseconds spent waiting in the ready queue,
+     * over all of its bursts, by a job of each priority. */
+    long long max_waiting_ns[PRIORITY_LEVELS];
+
+    /** Total time in nanoseconds between a cpu completing a job and starting
+     * the next, counting only jobs which had already arrived when the
+     * previous job completed. */
+    long long total_dispatch_gap_ns;
+
+    /** Number of gaps counted in total_dispatch_gap_ns. */
+    unsigned long num_dispatch_gaps;
+
+    /** The latest arrival time of any job which has started its first
+     * burst. */
+    struct timespec latest_arrival_served;
+
+    /** Number of jobs which started their first burst after a job which
+     * arrived later than them, a measure of how fairly jobs are
+     * dispatched. */
+    unsigned long num_overtaken;
+
+    /** Total waiting time of each job over all of its bursts, for
+     * percentiles. */
+    struct histogram waiting_times;
+
+    /** Times from the arrival of each job to its first service, for
+     * percentiles. */
+    struct histogram response_times;
+
+    /** Total of the times from the arrival of each job to its first service
+     * in nanoseconds. */
+    long long total_response_ns;
+
+    /** Total time in nanoseconds that cpus spent running jobs, including
+     * copies which were cancelled. */
+    long long total_busy_ns;
+
+    /** Number of times a job left a cpu for an I/O burst. */
+    unsigned long num_io_bursts;
+
+    /** Wall clock time of the whole simulation in nanoseconds, set by
+     * main() once every thread has finished. */
+    long long run_ns;
+
+    /** Turnaround times of all jobs, for percentiles. */
+    struct histogram turnaround_times;
+
+    /** Total of the bursts given in the job file in nanoseconds. */
+    long long total_estimated_ns;
+
+    /** Total time jobs actually ran for in nanoseconds. */
+    long long total_actual_ns;
+
+    /** Total of |actual - estimate| / estimate over jobs with a non-zero
+     * estimate. */
+    double total_relative_error;
+
+    /** Number of jobs which were stragglers, see STRAGGLER_PROBABILITY. */
+    unsigned long num_stragglers;
+
+    /** Number of jobs reserved ahead of time, see LOOKAHEAD_HORIZON. */
+    unsigned long num_reserved;
+
+    /** Number of reserved jobs taken by a different, idle cpu. */
+    unsigned long num_stolen;
+
+    /** Number of jobs dispatched, each paying CONTEXT_SWITCH_COST. */
+    unsigned long num_switches;
+
+    /** Total time in nanoseconds spent on context switches. */
+    long long total_switch_ns;
+
+    /** Number of jobs dispatched to a cpu without their working set in its
+     * cache, see CACHE_MIGRATION_PENALTY. */
+    unsigned long num_cold;
+
+    /** Total time in nanoseconds spent on CACHE_MIGRATION_PENALTY. */
+    long long total_cold_ns;
+
+    /** Number of jobs left for the cpu they last ran on, see
+     * AFFINITY_DISPATCH. */
+    unsigned long num_affinity_waits;
+
+    /** Number of CPU bursts delayed by interference, see
+     * NOISE_TICK_PERIOD. */
+    unsigned long num_interrupted;
+
+    /** Total time in nanoseconds that CPU bursts were delayed by
+     * interference. */
+    long long total_interference_ns;
+
+    /** Energy used by all cpus in joules, busy or idle. */
+    double total_energy_j;
+
+    /** Energy used by cpus while running jobs in joules, including copies
+     * which were cancelled. */
+    double total_active_energy_j;
+
+    /** Number of times any cpu woke from deep idle. */
+    unsigned long num_deep_wakeups;
+
+    /** Number of backup copies started, see SPECULATION_FACTOR. */
+    unsigned long num_backups;
+
+    /** Number of backup copies which finished before the original. */
+    unsigned long num_backups_won;
+
+    /** Total time in nanoseconds spent running copies of jobs which were
+     * cancelled because the other copy finished first. */
+    long long total_wasted_ns;
+
+    /** The latest completion time of any job, only kept when speculative
+     * backups are enabled. */
+    struct timespec latest_completion;
+
+    /** The latest time any job would have completed without backups, only
+     * kept when speculative backups are enabled. */
+    struct timespec latest_completion_unspeculated;
+};
+
+/** A job reserved by a cpu() thread, or left for it by another, to run once
+ * its current job completes. */
+struct cpu_reservation
+{
+    /** The reserved job. */
+    struct job_struct job;
+
+    /** True if job holds a reserved job which has not been taken. */
+    bool reserved;
+
+    /** True while the cpu is running a job, only kept when AFFINITY_DISPATCH
+     * is true. */
+    bool busy;
+
+    /** When the cpu expects its current job to complete, valid if busy is
+     * true. */
+    struct timespec free_at;
+};
+
+/** Jobs reserved by cpu() threads, see LOOKAHEAD_HORIZON, or left for them,
+ * see AFFINITY_DISPATCH. Shared so that cpu() threads which find the
+ * ready-queue empty can steal them. */
+struct cpu_lookahead
+{
+    /** Lock for the reservations. */
+    struct lock lock;
+
+    /** One reservation for each cpu, indexed by the cpu id minus one. */
+    struct cpu_reservation *reservations;
+
+    /** The number of reservations. */
+    size_t n_cpus;
+
+    /** The number of cpus which found nothing to steal and are waiting in
+     * tsqueue_pop(). No jobs are reserved or left for a cpu while this is
+     * non-zero, as the waiting cpus would not see them. */
+    size_t n_waiting;
+};
+
+/** The job running on a cpu() thread, see SPECULATION_FACTOR. */
+struct cpu_running
+{
+    /** True while a job is running. */
+    bool running;
+
+    /** True if the job is a backup copy of a job running on another cpu. */
+    bool is_backup;
+
+    /** True once a backup copy of the job has been started. */
+    bool has_backup;
+
+    /** True once the other copy of the job has finished first. */
+    bool cancelled;
+
+    /** The index of the cpu running the other copy of the job, valid if
+     * is_backup or has_backup is true. */
+    size_t partner;
+
+    /** The job, service_mono and actual_burst_ns are set. */
+    struct job_struct job;
+
+    /** The time this copy will complete unless it is cancelled. */
+    struct timespec end;
+
+    /** The time after which a backup copy may be started. */
+    struct timespec threshold;
+};
+
+/** The jobs running on every cpu() thread. Shared so that cpu() threads
+ * with nothing left to do can start backup copies of slow jobs. */
+struct cpu_speculation
+{
+    /** Lock for the data in this struct. */
+    pthread_mutex_t mutex;
+
+    /** Broadcast when a job starts or completes while any cpu is looking
+     * for a job to back up. Uses CLOCK_MONOTONIC for timed waits. */
+    pthread_cond_t changed;
+
+    /** The number of cpus waiting on changed. */
+    size_t n_seeking;
+
+    /** Signalled when the job running on a cpu is cancelled, indexed by the
+     * cpu id minus one. Uses CLOCK_MONOTONIC for timed waits. */
+    pthread_cond_t *cancelled;
+
+    /** The job running on each cpu, indexed by the cpu id minus one. */
+    struct cpu_running *running;
+
+    /** The number of cpus. */
+    size_t n_cpus;
 };
 
 /**
  * @brief Runs jobs from the provided queue until the queue is empty or an
  *        error occurs.
  *
+ * If speculative backups are enabled a cpu() thread which finds the queue
+ * empty with no more jobs to come starts backup copies of slow jobs until
+ * every running job has one.
+ *
  * @param data See cpu_params for details.
  *
  * @return NULL, see cpu_params for return value.
  */
 void *cpu(void *data);
 
+/**
+ * @brief Initialise a cpu_speculation with no jobs running.
+ *
+ * @param[out] speculation The struct to initialise.
+ * @param n_cpus The number of cpu() threads.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int cpu_speculation_init(struct cpu_speculation *speculation, size_t n_cpus);
+
+/**
+ * @brief Destroy a cpu_speculation, no cpu() threads may be using it.
+ *
+ * @param[in] speculation The struct to destroy.
+ */
+void cpu_speculation_destroy(struct cpu_speculation *speculation);
+
 #endif /* CPU_H */
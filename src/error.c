@@ -29,6 +29,15 @@ char *errno_or_ae_to_str(int err)
             break;
         case AE_BAD_FILE:
             retval = "File could not be parsed.";
+            break;
+        case AE_LOST_RECORDS:
+            retval = "Records are missing from a log shard.";
+            break;
+        case AE_QUEUE_IN_USE:
+            retval = "The shared ready-queue is in use by another process.";
+            break;
+        case AE_BAD_CONFIG:
+            retval = "A value in config.h is out of range.";
         }
     }
 
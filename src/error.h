@@ -25,7 +25,16 @@ enum ae_codes {
     AE_WRONG_NUM_ARGS,
 
     /** The file could not be parsed. */
-    AE_BAD_FILE
+    AE_BAD_FILE,
+
+    /** Records were missing from a shard of the log. */
+    AE_LOST_RECORDS,
+
+    /** The shared ready-queue belongs to another running simulation. */
+    AE_QUEUE_IN_USE,
+
+    /** A value in config.h is out of range. */
+    AE_BAD_CONFIG
 };
 
 /**
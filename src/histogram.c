@@ -0,0 +1,87 @@
+/**
+ * @file   histogram.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Implementation of histogram.h.
+ */
+
+#include "histogram.h"
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * @brief Returns the bucket that holds @p value.
+ */
+static unsigned bucket_of(uint64_t value);
+
+/**
+ * @brief Returns the smallest value held by @p bucket.
+ */
+static uint64_t bucket_start(unsigned bucket);
+
+void histogram_add(struct histogram *histogram, long long value)
+{
+    ++histogram->counts[bucket_of((value < 0) ? 0 : (uint64_t)value)];
+    ++histogram->total;
+}
+
+long long histogram_percentile(const struct histogram *histogram,
+                               double percentile)
+{
+    if (histogram->total == 0)
+    {
+        return 0;
+    }
+
+    // The nearest rank of the value wanted, counting from one. A little is
+    // taken off before rounding up so that an exact rank, such as the 95th
+    // percentile of 100 values, is not pushed up by rounding error.
+    double exact = percentile * histogram->total / 100;
+    unsigned long rank = (unsigned long)ceil(exact - exact * 1e-12);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    unsigned long seen = 0;
+    unsigned bucket = 0;
+    while (bucket + 1 < HISTOGRAM_BUCKETS
+           && seen + histogram->counts[bucket] < rank)
+    {
+        seen += histogram->counts[bucket++];
+    }
+
+    uint64_t start = bucket_start(bucket);
+    uint64_t end = (bucket + 1 < HISTOGRAM_BUCKETS)
+                   ? bucket_start(bucket + 1)
+                   : UINT64_MAX;
+    return (long long)(start + (end - start) / 2);
+}
+
+static unsigned bucket_of(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (unsigned)value;
+    }
+
+    // The first HISTOGRAM_SUB_BUCKETS buckets hold one value each, after
+    // that each power of two is split in to HISTOGRAM_SUB_BUCKETS buckets.
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+    unsigned shift = exponent - 4;
+    return HISTOGRAM_SUB_BUCKETS * (shift + 1)
+           + (unsigned)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_start(unsigned bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    unsigned shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file   histogram.h
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Fixed size histograms of durations for estimating percentiles.
+ *
+ * Values are counted in buckets whose width grows with the value, sixteen
+ * buckets for each power of two, so a percentile is accurate to within about
+ * 6% of its value. Adding a value is a few instructions and the memory used
+ * does not depend on the number of values.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/** The number of buckets for each power of two. */
+#define HISTOGRAM_SUB_BUCKETS 16
+
+/** The number of buckets in a histogram, enough for any uint64_t. */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * 61)
+
+/** A histogram of durations in nanoseconds. Zero initialise before use. */
+struct histogram
+{
+    /** The number of values in each bucket. */
+    unsigned long counts[HISTOGRAM_BUCKETS];
+
+    /** The number of values added. */
+    unsigned long total;
+};
+
+/**
+ * @brief Add a value to a histogram.
+ *
+ * @param[in,out] histogram The histogram.
+ * @param value The value to add, negative values are counted as zero.
+ */
+void histogram_add(struct histogram *histogram, long long value);
+
+/**
+ * @brief Estimate a percentile of the values added to a histogram.
+ *
+ * @param[in] histogram The histogram.
+ * @param percentile The percentile, from 0 to 100. The value of nearest
+ *                   rank is used, the smallest value which at least this
+ *                   percent of the values are less than or equal to.
+ *
+ * @return The middle of the bucket holding the percentile, zero if the
+ *         histogram is empty.
+ */
+long long histogram_percentile(const struct histogram *histogram,
+                               double percentile);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,266 @@
+/**
+ * @file   io.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Implementation of io.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "io.h"
+#include "job.h"
+#include "lock.h"
+#include "ready_queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief Returns true if @p a is before @p b.
+ */
+static bool time_before(const struct timespec *a, const struct timespec *b);
+
+/**
+ * @brief Marks the ready-queue done if nothing more can be placed in it. The
+ *        mutex of @p wait must be held.
+ *
+ * @param[in] wait The blocked set.
+ */
+static void check_done(struct io_wait *wait);
+
+int io_wait_init(struct io_wait *wait, struct ready_queue *queue,
+                 struct lock *producer_lock)
+{
+    int retval = 0;
+
+    *wait = (struct io_wait){
+        .queue = queue,
+        .producer_lock = producer_lock
+    };
+
+    pthread_condattr_t attr;
+    retval = pthread_condattr_init(&attr);
+    if (retval == 0)
+    {
+        retval = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        if (retval == 0)
+        {
+            retval = pthread_cond_init(&wait->changed, &attr);
+        }
+        pthread_condattr_destroy(&attr);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_mutex_init(&wait->mutex, NULL);
+        if (retval != 0)
+        {
+            pthread_cond_destroy(&wait->changed);
+        }
+    }
+
+    return retval;
+}
+
+void io_wait_destroy(struct io_wait *wait)
+{
+    pthread_mutex_destroy(&wait->mutex);
+    pthread_cond_destroy(&wait->changed);
+    free(wait->heap);
+}
+
+void io_wait_add_jobs(struct io_wait *wait, unsigned long n_jobs)
+{
+    pthread_mutex_lock(&wait->mutex);
+    wait->n_cycling += n_jobs;
+    pthread_mutex_unlock(&wait->mutex);
+}
+
+int io_block(struct io_wait *wait, const struct job_struct *job,
+             const struct timespec *wake)
+{
+    int retval = 0;
+
+    pthread_mutex_lock(&wait->mutex);
+
+    if (wait->n_blocked == wait->heap_capacity)
+    {
+        size_t capacity = (wait->heap_capacity == 0) ? 16
+                                                     : 2 * wait->heap_capacity;
+        struct io_entry *heap =
+            realloc(wait->heap, sizeof(*heap) * capacity);
+        if (heap == NULL)
+        {
+            retval = errno;
+        }
+        else
+        {
+            wait->heap = heap;
+            wait->heap_capacity = capacity;
+        }
+    }
+
+    if (retval == 0)
+    {
+        // Sift the new entry up from the end of the heap.
+        size_t i = wait->n_blocked++;
+        while (i != 0 && time_before(wake, &wait->heap[(i - 1) / 2].wake))
+        {
+            wait->heap[i] = wait->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        wait->heap[i] = (struct io_entry){.wake = *wake, .job = *job};
+
+        if (i == 0)
+        {
+            pthread_cond_broadcast(&wait->changed);
+        }
+    }
+
+    pthread_mutex_unlock(&wait->mutex);
+
+    return retval;
+}
+
+void io_job_done(struct io_wait *wait)
+{
+    pthread_mutex_lock(&wait->mutex);
+    --wait->n_cycling;
+    check_done(wait);
+    pthread_mutex_unlock(&wait->mutex);
+}
+
+void io_producers_done(struct io_wait *wait)
+{
+    pthread_mutex_lock(&wait->mutex);
+    wait->producers_done = true;
+    check_done(wait);
+    pthread_mutex_unlock(&wait->mutex);
+}
+
+void io_wait_close(struct io_wait *wait)
+{
+    pthread_mutex_lock(&wait->mutex);
+    wait->die = true;
+    pthread_cond_broadcast(&wait->changed);
+    pthread_mutex_unlock(&wait->mutex);
+}
+
+void *io(void *ptr)
+{
+    int retval = 0;
+
+    // Input arguments
+    struct io_params *params = ptr;
+    struct io_wait *wait = params->wait;
+
+    pthread_mutex_lock(&wait->mutex);
+    while (retval == 0 && !wait->die
+           && !(wait->producers_done && wait->n_cycling == 0))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (wait->n_blocked == 0)
+        {
+            pthread_cond_wait(&wait->changed, &wait->mutex);
+        }
+        else if (time_before(&now, &wait->heap[0].wake))
+        {
+            pthread_cond_timedwait(&wait->changed, &wait->mutex,
+                                   &wait->heap[0].wake);
+        }
+        else
+        {
+            struct job_struct job = wait->heap[0].job;
+
+            // Sift the last entry down from the top of the heap.
+            struct io_entry last = wait->heap[--wait->n_blocked];
+            size_t i = 0;
+            size_t child;
+            while ((child = 2 * i + 1) < wait->n_blocked)
+            {
+                if (child + 1 < wait->n_blocked
+                    && time_before(&wait->heap[child + 1].wake,
+                                   &wait->heap[child].wake))
+                {
+                    ++child;
+                }
+                if (!time_before(&wait->heap[child].wake, &last.wake))
+                {
+                    break;
+                }
+                wait->heap[i] = wait->heap[child];
+                i = child;
+            }
+            if (wait->n_blocked != 0)
+            {
+                wait->heap[i] = last;
+            }
+            pthread_mutex_unlock(&wait->mutex);
+
+            // The job arrives in the ready-queue again for its next CPU
+            // burst. As in task(), the producer lock is not held while
+            // waiting for space.
+            int queue_retval = 0;
+            lock_acquire(wait->producer_lock);
+            while (queue_retval == 0 && !ready_queue_has_space(wait->queue, 1))
+            {
+                lock_release(wait->producer_lock);
+                queue_retval = ready_queue_wait_for_space(wait->queue, 1);
+                lock_acquire(wait->producer_lock);
+            }
+            if (queue_retval == 0)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &job.arrival_mono);
+                clock_gettime(CLOCK_REALTIME, &job.arrival_real);
+                queue_retval = ready_queue_put(wait->queue, 1, &job);
+            }
+            lock_release(wait->producer_lock);
+
+            pthread_mutex_lock(&wait->mutex);
+            if (queue_retval == TSQUEUE_CLOSED)
+            {
+                // Closed because of an error elsewhere.
+                wait->die = true;
+            }
+            else if (queue_retval != 0)
+            {
+                retval = queue_retval;
+            }
+        }
+    }
+    if (retval != 0)
+    {
+        wait->die = true;
+        pthread_cond_broadcast(&wait->changed);
+    }
+    pthread_mutex_unlock(&wait->mutex);
+
+    // A job was lost but is still counted in n_cycling, so the queue would
+    // never be done and the cpu() threads would wait for it forever.
+    if (retval != 0)
+    {
+        ready_queue_close(wait->queue);
+    }
+
+    params->retval = retval;
+    return NULL;
+}
+
+static bool time_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec
+           || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void check_done(struct io_wait *wait)
+{
+    if (wait->producers_done && wait->n_cycling == 0)
+    {
+        ready_queue_set_done(wait->queue, true);
+        pthread_cond_broadcast(&wait->changed);
+    }
+}
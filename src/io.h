@@ -0,0 +1,157 @@
+/**
+ * @file   io.h
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  The blocked set of jobs waiting for I/O and the io() function
+ *         which returns them to the ready-queue.
+ *
+ * A job with I/O bursts leaves its cpu() thread after each CPU burst and
+ * waits in the blocked set until its I/O burst is over. The io() thread then
+ * places it back in the ready-queue to wait for its next CPU burst. Because
+ * jobs can come back, the ready-queue is only marked done once every task()
+ * thread has finished and every job with I/O bursts has run its last CPU
+ * burst.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include "ready_queue.h"
+#include "lock.h"
+#include "job.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/** A job in the blocked set. */
+struct io_entry
+{
+    /** The time the I/O burst completes from CLOCK_MONOTONIC. */
+    struct timespec wake;
+
+    /** The job. */
+    struct job_struct job;
+};
+
+/** The blocked set, shared by the cpu(), task() and io() threads. */
+struct io_wait
+{
+    /** Lock for the data in this struct. */
+    pthread_mutex_t mutex;
+
+    /** Broadcast when the earliest wake time or the done state changes. Uses
+     * CLOCK_MONOTONIC for timed waits. */
+    pthread_cond_t changed;
+
+    /** Binary min-heap of blocked jobs ordered by wake time. */
+    struct io_entry *heap;
+
+    /** The number of jobs in heap. */
+    size_t n_blocked;
+
+    /** The number of entries heap can hold before it must grow. */
+    size_t heap_capacity;
+
+    /** The number of jobs with I/O bursts which have been placed in the
+     * ready-queue but have not finished their last CPU burst. */
+    unsigned long n_cycling;
+
+    /** True once every task() thread has finished. */
+    bool producers_done;
+
+    /** True once io_wait_close() has been called. */
+    bool die;
+
+    /** The ready-queue. */
+    struct ready_queue *queue;
+
+    /** The lock shared by the producers of queue, see task_params. */
+    struct lock *producer_lock;
+};
+
+/** Parameters to pass to io(). */
+struct io_params
+{
+    /** The blocked set. */
+    struct io_wait *wait;
+
+    /** The return value of the io() call. io() will set this before exiting.
+     * Zero if successful, otherwise can be passed to errno_or_ae_to_str(). */
+    int retval;
+};
+
+/**
+ * @brief Initialise an empty blocked set.
+ *
+ * @param[out] wait The blocked set.
+ * @param[in] queue The ready-queue jobs are returned to.
+ * @param[in] producer_lock The lock shared by the producers of @p queue.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int io_wait_init(struct io_wait *wait, struct ready_queue *queue,
+                 struct lock *producer_lock);
+
+/**
+ * @brief Destroy a blocked set, the io() thread must have exited.
+ *
+ * @param[in] wait The blocked set.
+ */
+void io_wait_destroy(struct io_wait *wait);
+
+/**
+ * @brief Count jobs with I/O bursts which are about to be placed in the
+ *        ready-queue by a task() thread.
+ *
+ * @param[in] wait The blocked set.
+ * @param n_jobs The number of jobs.
+ */
+void io_wait_add_jobs(struct io_wait *wait, unsigned long n_jobs);
+
+/**
+ * @brief Place a job in the blocked set until @p wake.
+ *
+ * @param[in] wait The blocked set.
+ * @param[in] job The job, set up for its next CPU burst.
+ * @param[in] wake The time its I/O burst completes.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int io_block(struct io_wait *wait, const struct job_struct *job,
+             const struct timespec *wake);
+
+/**
+ * @brief Record that a job with I/O bursts has finished its last CPU burst.
+ *
+ * @param[in] wait The blocked set.
+ */
+void io_job_done(struct io_wait *wait);
+
+/**
+ * @brief Record that every task() thread has finished.
+ *
+ * @param[in] wait The blocked set.
+ */
+void io_producers_done(struct io_wait *wait);
+
+/**
+ * @brief Make io() exit without returning the jobs still blocked. Used once
+ *        no cpu() threads remain to run them.
+ *
+ * @param[in] wait The blocked set.
+ */
+void io_wait_close(struct io_wait *wait);
+
+/**
+ * @brief Returns blocked jobs to the ready-queue as their I/O completes
+ *        until every job is done or io_wait_close() is called.
+ *
+ * @param data See io_params for details.
+ *
+ * @return NULL, see io_params for return value.
+ */
+void *io(void *data);
+
+#endif /* IO_H */
@@ -9,22 +9,72 @@
 #ifndef JOB_H
 #define JOB_H
 
+#include <stdint.h>
 #include <time.h>
 
+/** The maximum number of I/O bursts in a job. */
+#define JOB_MAX_IO_BURSTS 4
+
 /** Information about a job. All values are set by task(). */
 struct job_struct {
     /** ID of the job. */
-    unsigned id;
+    uint64_t id;
+
+    /** Time required for the current CPU burst of the job in nanoseconds,
+     * as estimated in the job file. */
+    uint64_t cpu_burst_ns;
+
+    /** The bursts which follow the first CPU burst, alternately I/O and
+     * CPU, in nanoseconds. */
+    uint64_t later_bursts_ns[2 * JOB_MAX_IO_BURSTS];
+
+    /** The number of values in later_bursts_ns. */
+    unsigned n_later_bursts;
+
+    /** The index in later_bursts_ns of the I/O burst which follows the
+     * current CPU burst. Zero during the first CPU burst. */
+    unsigned next_burst;
+
+    /** The id of the cpu which last ran the job, zero if it has not run. */
+    unsigned last_cpu;
+
+    /** Time the cpu spent switching to the job before its current burst in
+     * nanoseconds, set by cpu(). See CONTEXT_SWITCH_COST. */
+    uint64_t overhead_ns;
 
-    /** Time required for the job in seconds. */
-    time_t cpu_burst;
+    /** Time the current burst is delayed by interference on its cpu in
+     * nanoseconds, set by cpu(). See NOISE_TICK_PERIOD. */
+    uint64_t stolen_ns;
+
+    /** Time the job has waited in the ready-queue over all of its bursts so
+     * far in nanoseconds, set by cpu(). */
+    uint64_t waiting_ns;
+
+    /** The frequency the current burst runs at as a fraction of the highest,
+     * set by cpu(). See CPU_FREQUENCIES. */
+    double frequency;
+
+    /** Time the job actually runs for in nanoseconds, set by cpu(). See
+     * RUNTIME_NOISE_SIGMA. */
+    uint64_t actual_burst_ns;
+
+    /** Priority of the job, zero is the highest priority. */
+    unsigned priority;
+
+    /** Position of the job file the job was read from among those given on
+     * the command line, starting from one. */
+    unsigned source;
 
     /** Arrival time of the job from CLOCK_MONOTONIC. Used for statistics,
      * CLOCK_REALTIME is not appropriate for this as it can change
      * dramatically for various reasons (such as switching to daylight savings
-     * time). */
+     * time). Reset each time the job returns from I/O. */
     struct timespec arrival_mono;
 
+    /** The first arrival time of the job from CLOCK_MONOTONIC, which is not
+     * reset by I/O. */
+    struct timespec submit_mono;
+
     /** Arrival time of the job from CLOCK_REALTIME. Used in logs. */
     struct timespec arrival_real;
 
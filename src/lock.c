@@ -0,0 +1,359 @@
+/**
+ * @file   lock.c
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  Implementation of lock.h.
+ */
+
+// Needed for PTHREAD_MUTEX_ADAPTIVE_NP.
+#define _GNU_SOURCE
+
+#include "lock.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <strings.h>
+
+/** The number of times to spin on a lock before yielding the processor. */
+static const unsigned SPINS_BEFORE_YIELD = 128;
+
+struct mcs_node
+{
+    /** The node of the next thread waiting for the lock. */
+    _Alignas(64) _Atomic(struct mcs_node *) next;
+
+    /** True until the previous holder passes the lock to this node. */
+    atomic_bool locked;
+};
+
+/** The MCS nodes of the calling thread. A node is only in use while the
+ * thread is waiting for or holding a lock. */
+static _Thread_local struct mcs_node mcs_nodes[LOCK_MAX_MCS_HELD];
+
+/** Bit i is set if mcs_nodes[i] is in use. */
+static _Thread_local unsigned mcs_nodes_used = 0;
+
+/**
+ * @brief Spin until @p done returns true for @p arg, yielding the processor
+ *        after a while.
+ *
+ * @param done Returns true when spinning should stop.
+ * @param arg Passed to @p done.
+ */
+static void spin_until(bool (*done)(void *arg), void *arg);
+
+/**
+ * @brief Returns true if the ticket lock @p arg is being served @p ticket,
+ *        used with spin_until().
+ */
+static bool ticket_is_served(void *arg);
+
+/**
+ * @brief Returns true if the MCS node @p arg has been passed the lock, used
+ *        with spin_until().
+ */
+static bool mcs_is_passed(void *arg);
+
+/**
+ * @brief Returns true if the MCS node @p arg has a successor, used with
+ *        spin_until().
+ */
+static bool mcs_has_next(void *arg);
+
+/**
+ * @brief Take a free MCS node of the calling thread.
+ *
+ * @return The node.
+ */
+static struct mcs_node *mcs_node_take(void);
+
+/**
+ * @brief Return an MCS node taken with mcs_node_take().
+ *
+ * @param node The node.
+ */
+static void mcs_node_give(struct mcs_node *node);
+
+/** The arguments of ticket_is_served(). */
+struct ticket_wait
+{
+    /** The lock. */
+    struct lock *lock;
+
+    /** The ticket waited for. */
+    unsigned ticket;
+};
+
+int lock_init(struct lock *lock, enum lock_kind kind)
+{
+    int retval = 0;
+
+    lock->kind = kind;
+    atomic_init(&lock->next_ticket, 0);
+    atomic_init(&lock->now_serving, 0);
+    atomic_init(&lock->tail, NULL);
+    lock->holder = NULL;
+
+    pthread_mutexattr_t attr;
+    retval = pthread_mutexattr_init(&attr);
+    if (retval == 0)
+    {
+#ifdef __GLIBC__
+        if (kind == LOCK_ADAPTIVE)
+        {
+            retval = pthread_mutexattr_settype(&attr,
+                                               PTHREAD_MUTEX_ADAPTIVE_NP);
+        }
+#endif
+        if (retval == 0)
+        {
+            retval = pthread_mutex_init(&lock->mutex, &attr);
+        }
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    return retval;
+}
+
+void lock_destroy(struct lock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+void lock_acquire(struct lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_lock(&lock->mutex);
+        break;
+    case LOCK_TICKET:
+    {
+        struct ticket_wait wait = {
+            .lock = lock,
+            .ticket = atomic_fetch_add(&lock->next_ticket, 1)
+        };
+        spin_until(&ticket_is_served, &wait);
+        break;
+    }
+    case LOCK_MCS:
+    {
+        struct mcs_node *node = mcs_node_take();
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+        struct mcs_node *prev = atomic_exchange(&lock->tail, node);
+        if (prev != NULL)
+        {
+            atomic_store(&prev->next, node);
+            spin_until(&mcs_is_passed, node);
+        }
+        lock->holder = node;
+        break;
+    }
+    }
+}
+
+bool lock_try_acquire(struct lock *lock)
+{
+    bool acquired = false;
+
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        acquired = (pthread_mutex_trylock(&lock->mutex) == 0);
+        break;
+    case LOCK_TICKET:
+    {
+        unsigned ticket = atomic_load(&lock->now_serving);
+        acquired = atomic_compare_exchange_strong(&lock->next_ticket, &ticket,
+                                                  ticket + 1);
+        break;
+    }
+    case LOCK_MCS:
+    {
+        struct mcs_node *node = mcs_node_take();
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        struct mcs_node *expected = NULL;
+        acquired = atomic_compare_exchange_strong(&lock->tail, &expected,
+                                                  node);
+        if (acquired)
+        {
+            lock->holder = node;
+        }
+        else
+        {
+            mcs_node_give(node);
+        }
+        break;
+    }
+    }
+
+    return acquired;
+}
+
+void lock_release(struct lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_unlock(&lock->mutex);
+        break;
+    case LOCK_TICKET:
+        atomic_fetch_add(&lock->now_serving, 1);
+        break;
+    case LOCK_MCS:
+    {
+        struct mcs_node *node = lock->holder;
+        struct mcs_node *expected = node;
+        if (atomic_load(&node->next) == NULL
+            && !atomic_compare_exchange_strong(&lock->tail, &expected, NULL))
+        {
+            // A thread has joined the queue but has not linked itself to
+            // this node yet.
+            spin_until(&mcs_has_next, node);
+        }
+
+        struct mcs_node *next = atomic_load(&node->next);
+        if (next != NULL)
+        {
+            atomic_store(&next->locked, false);
+        }
+        mcs_node_give(node);
+        break;
+    }
+    }
+}
+
+int lock_cond_init(struct lock_cond *cond, enum lock_kind kind)
+{
+    int retval = 0;
+
+    cond->kind = kind;
+    cond->seq = 0;
+
+    retval = pthread_cond_init(&cond->cond, NULL);
+    if (retval == 0)
+    {
+        retval = pthread_mutex_init(&cond->mutex, NULL);
+        if (retval != 0)
+        {
+            pthread_cond_destroy(&cond->cond);
+        }
+    }
+
+    return retval;
+}
+
+void lock_cond_destroy(struct lock_cond *cond)
+{
+    pthread_cond_destroy(&cond->cond);
+    pthread_mutex_destroy(&cond->mutex);
+}
+
+void lock_cond_wait(struct lock_cond *cond, struct lock *lock)
+{
+    if (cond->kind == LOCK_MUTEX || cond->kind == LOCK_ADAPTIVE)
+    {
+        pthread_cond_wait(&cond->cond, &lock->mutex);
+        return;
+    }
+
+    // The sequence number is read before releasing the lock, so a signal
+    // sent by a thread that changes the state after that always ends the
+    // wait.
+    pthread_mutex_lock(&cond->mutex);
+    unsigned long seq = cond->seq;
+    lock_release(lock);
+    while (cond->seq == seq)
+    {
+        pthread_cond_wait(&cond->cond, &cond->mutex);
+    }
+    pthread_mutex_unlock(&cond->mutex);
+    lock_acquire(lock);
+}
+
+void lock_cond_signal(struct lock_cond *cond)
+{
+    if (cond->kind == LOCK_MUTEX || cond->kind == LOCK_ADAPTIVE)
+    {
+        pthread_cond_signal(&cond->cond);
+        return;
+    }
+
+    pthread_mutex_lock(&cond->mutex);
+    ++cond->seq;
+    pthread_cond_signal(&cond->cond);
+    pthread_mutex_unlock(&cond->mutex);
+}
+
+void lock_cond_broadcast(struct lock_cond *cond)
+{
+    if (cond->kind == LOCK_MUTEX || cond->kind == LOCK_ADAPTIVE)
+    {
+        pthread_cond_broadcast(&cond->cond);
+        return;
+    }
+
+    pthread_mutex_lock(&cond->mutex);
+    ++cond->seq;
+    pthread_cond_broadcast(&cond->cond);
+    pthread_mutex_unlock(&cond->mutex);
+}
+
+static void spin_until(bool (*done)(void *arg), void *arg)
+{
+    unsigned spins = 0;
+    while (!done(arg))
+    {
+        if (++spins == SPINS_BEFORE_YIELD)
+        {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+static bool ticket_is_served(void *arg)
+{
+    struct ticket_wait *wait = arg;
+    return atomic_load_explicit(&wait->lock->now_serving,
+                                memory_order_acquire) == wait->ticket;
+}
+
+static bool mcs_is_passed(void *arg)
+{
+    struct mcs_node *node = arg;
+    return !atomic_load_explicit(&node->locked, memory_order_acquire);
+}
+
+static bool mcs_has_next(void *arg)
+{
+    struct mcs_node *node = arg;
+    return atomic_load_explicit(&node->next, memory_order_acquire) != NULL;
+}
+
+static struct mcs_node *mcs_node_take(void)
+{
+    // Holding more locks than this is a programming error.
+    if (mcs_nodes_used == (1u << LOCK_MAX_MCS_HELD) - 1)
+    {
+        abort();
+    }
+
+    int i = ffs((int)~mcs_nodes_used) - 1;
+    mcs_nodes_used |= 1u << i;
+    return &mcs_nodes[i];
+}
+
+static void mcs_node_give(struct mcs_node *node)
+{
+    mcs_nodes_used &= ~(1u << (node - mcs_nodes));
+}
@@ -0,0 +1,175 @@
+/**
+ * @file   lock.h
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  Mutual exclusion locks with interchangeable implementations.
+ *
+ * Every kind of lock has the same interface so the kind can be chosen when
+ * the lock is initialised. Condition variables are provided which work with
+ * every kind of lock. For the pthread based kinds these are plain pthread
+ * condition variables, for the spinning kinds waiting threads sleep on a
+ * sequence number which is advanced by every signal.
+ *
+ * The spinning kinds call sched_yield() after spinning for a while so that a
+ * preempted holder can run when there are more threads than cores.
+ */
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/** The maximum number of LOCK_MCS locks that a thread can hold at once. */
+#define LOCK_MAX_MCS_HELD 8
+
+/** The kinds of lock that can be used. */
+enum lock_kind
+{
+    /** A default pthread mutex. */
+    LOCK_MUTEX,
+
+    /** A pthread mutex which spins for a while before sleeping, see
+     * PTHREAD_MUTEX_ADAPTIVE_NP. The same as LOCK_MUTEX where that is not
+     * available. */
+    LOCK_ADAPTIVE,
+
+    /** A ticket spinlock. Threads take the lock in the order they arrive
+     * but all of them spin on the same cache line. */
+    LOCK_TICKET,
+
+    /** An MCS queue lock. Threads take the lock in the order they arrive and
+     * each spins on its own queue node, so passing the lock on only touches
+     * the cache lines of the two threads involved. */
+    LOCK_MCS
+};
+
+/** A waiting thread's entry in the queue of a LOCK_MCS lock. */
+struct mcs_node;
+
+/** A lock of any kind. */
+struct lock
+{
+    /** The kind of lock. */
+    enum lock_kind kind;
+
+    /** The mutex used by LOCK_MUTEX and LOCK_ADAPTIVE. */
+    pthread_mutex_t mutex;
+
+    /** The next ticket to hand out, used by LOCK_TICKET. */
+    _Alignas(64) atomic_uint next_ticket;
+
+    /** The ticket of the thread holding the lock, used by LOCK_TICKET. Kept
+     * on a separate cache line from next_ticket so that arriving threads do
+     * not disturb the ones spinning on this. */
+    _Alignas(64) atomic_uint now_serving;
+
+    /** The last node in the queue, NULL if the lock is free. Used by
+     * LOCK_MCS. */
+    _Atomic(struct mcs_node *) tail;
+
+    /** The node of the thread holding the lock, used by LOCK_MCS. Only
+     * accessed by the holder. */
+    struct mcs_node *holder;
+};
+
+/** A condition variable which can be used with any kind of lock. */
+struct lock_cond
+{
+    /** The kind of lock this is used with. */
+    enum lock_kind kind;
+
+    /** The condition variable waited on. */
+    pthread_cond_t cond;
+
+    /** Protects seq, only used with the spinning kinds. */
+    pthread_mutex_t mutex;
+
+    /** Advanced by every signal, only used with the spinning kinds. */
+    unsigned long seq;
+};
+
+/**
+ * @brief Initialise a lock.
+ *
+ * @param[out] lock The lock.
+ * @param kind The kind of lock.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int lock_init(struct lock *lock, enum lock_kind kind);
+
+/**
+ * @brief Destroy a lock, it must not be held.
+ *
+ * @param[in] lock The lock.
+ */
+void lock_destroy(struct lock *lock);
+
+/**
+ * @brief Acquire a lock, blocking until it is available.
+ *
+ * @param[in] lock The lock.
+ */
+void lock_acquire(struct lock *lock);
+
+/**
+ * @brief Acquire a lock if it is available without blocking.
+ *
+ * @param[in] lock The lock.
+ *
+ * @return True if the lock was acquired.
+ */
+bool lock_try_acquire(struct lock *lock);
+
+/**
+ * @brief Release a lock held by the calling thread.
+ *
+ * @param[in] lock The lock.
+ */
+void lock_release(struct lock *lock);
+
+/**
+ * @brief Initialise a condition variable.
+ *
+ * @param[out] cond The condition variable.
+ * @param kind The kind of lock that will be used with @p cond.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int lock_cond_init(struct lock_cond *cond, enum lock_kind kind);
+
+/**
+ * @brief Destroy a condition variable, no threads may be waiting on it.
+ *
+ * @param[in] cond The condition variable.
+ */
+void lock_cond_destroy(struct lock_cond *cond);
+
+/**
+ * @brief Release @p lock, wait for @p cond to be signalled and acquire
+ *        @p lock again, see pthread_cond_wait(). Spurious wakeups are
+ *        possible.
+ *
+ * @param[in] cond The condition variable.
+ * @param[in] lock The lock, must be held by the calling thread.
+ */
+void lock_cond_wait(struct lock_cond *cond, struct lock *lock);
+
+/**
+ * @brief Wake at least one thread waiting on @p cond.
+ *
+ * @param[in] cond The condition variable.
+ */
+void lock_cond_signal(struct lock_cond *cond);
+
+/**
+ * @brief Wake all threads waiting on @p cond.
+ *
+ * @param[in] cond The condition variable.
+ */
+void lock_cond_broadcast(struct lock_cond *cond);
+
+#endif /* LOCK_H */
@@ -13,10 +13,57 @@
 #include "job.h"
 #include "config.h"
 #include "cpu.h"
+#include "histogram.h"
+#include "log_writer.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <time.h>
 #include <errno.h>
 #include <stdint.h>
+#include <inttypes.h>
+
+/**
+ * @brief Check whether the events of a job are logged at LOG_LEVEL. Called
+ *        before anything is formatted so that an event which is not logged
+ *        costs almost nothing.
+ *
+ * @param id The id of the job.
+ *
+ * @return True if the events of the job are logged.
+ */
+static bool job_logged(uint64_t id)
+{
+    // The id is mixed as by splitmix64 so that jobs with strided ids are
+    // still sampled evenly.
+    uint64_t z = id + 0x9e3779b97f4a7c15u;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    z ^= z >> 31;
+
+    return LOG_LEVEL == LOG_LEVEL_FULL
+           || (LOG_LEVEL == LOG_LEVEL_SAMPLED && z % LOG_SAMPLE_PERIOD == 0);
+}
+
+/**
+ * @brief Write @p ns as a number of seconds to @p buffer, leaving out
+ *        trailing zeros in the fractional part, such as "2" or "0.25".
+ *
+ * @param[out] buffer The buffer, must be at least 32 characters.
+ * @param ns The number of nanoseconds.
+ */
+static void format_seconds(char *buffer, uint64_t ns)
+{
+    int len = sprintf(buffer, "%" PRIu64, ns / 1000000000);
+    uint64_t fraction = ns % 1000000000;
+    if (fraction != 0)
+    {
+        len += sprintf(buffer + len, ".%09" PRIu64, fraction);
+        while (buffer[len - 1] == '0')
+        {
+            buffer[--len] = '\0';
+        }
+    }
+}
 
 /**
  * @brief Log the job @p j and the event @p event at @p time to @p log_file.
@@ -37,50 +84,55 @@
  * @return Zero if the function succeeds, else an error code that can be
  *         passed to errno_or_app_errnum_to_str().
  */
-static int log_cpu_event(FILE *log_file, unsigned cpu_id,
+static int log_cpu_event(struct log_writer *log_file, unsigned cpu_id,
                          const struct job_struct *job, struct timespec time,
                          const char *event)
 {
     int retval = 0;
 
-    struct tm arrival_tm;
-    struct tm event_tm;
-    if (localtime_r(&job->arrival_real.tv_sec, &arrival_tm) == NULL
-        || localtime_r(&time.tv_sec, &event_tm) == NULL)
-    {
-        retval = errno;
-    }
-    else
+    if (job_logged(job->id))
     {
-        int res = fprintf(log_file,
-                          "Statistics for CPU %u:\n"
-                          "Job #%u\n"
-                          "Arrival time: %02d:%02d:%02d\n"
-                          "%s time: %02d:%02d:%02d\n\n",
-                          cpu_id, job->id, arrival_tm.tm_hour,
-                          arrival_tm.tm_min, arrival_tm.tm_sec, event,
-                          event_tm.tm_hour, event_tm.tm_min, event_tm.tm_sec);
-        if (res < 0)
+        struct tm arrival_tm;
+        struct tm event_tm;
+        if (localtime_r(&job->arrival_real.tv_sec, &arrival_tm) == NULL
+            || localtime_r(&time.tv_sec, &event_tm) == NULL)
         {
             retval = errno;
         }
+        else
+        {
+            // Bursts can be as short as a nanosecond, so times are given
+            // to the nanosecond.
+            retval = log_writer_printf(log_file,
+                                       "Statistics for CPU %u:\n"
+                                       "Job #%" PRIu64 "\n"
+                                       "Arrival time: %02d:%02d:%02d.%09ld\n"
+                                       "%s time: %02d:%02d:%02d.%09ld\n\n",
+                                       cpu_id, job->id, arrival_tm.tm_hour,
+                                       arrival_tm.tm_min, arrival_tm.tm_sec,
+                                       job->arrival_real.tv_nsec, event,
+                                       event_tm.tm_hour, event_tm.tm_min,
+                                       event_tm.tm_sec, time.tv_nsec);
+        }
     }
 
     return retval;
 }
 
-int log_service(FILE *log_file, unsigned cpu_id, const struct job_struct *job)
+int log_service(struct log_writer *log_file, unsigned cpu_id,
+                const struct job_struct *job)
 {
     return log_cpu_event(log_file, cpu_id, job, job->service_real, "Service");
 }
 
-int log_completion(FILE *log_file, unsigned cpu_id, const struct job_struct *job)
+int log_completion(struct log_writer *log_file, unsigned cpu_id,
+                   const struct job_struct *job)
 {
     // This is used to make the gantt charts in my report.
 #ifdef CONFIG_STDOUT_PGFGANTT
     printf("%jd.%09lu "
            "\\ganttset{bar/.append style={fill=white}} "
-           "\\ganttbar{%u}{%jd}{%jd} "
+           "\\ganttbar{%" PRIu64 "}{%jd}{%jd} "
            "\\ganttbar[inline]{}{%jd}{%jd} "
            "\\ganttset{bar/.append style={fill=lightgray}} "
            "\\ganttbar[inline]{CPU-%u}{%jd}{%jd}\\\\\n",
@@ -97,85 +149,307 @@ int log_completion(FILE *log_file, unsigned cpu_id, const struct job_struct *job
                          "Completion");
 }
 
-int log_cpu_done(FILE *log_file, unsigned cpu_id, unsigned long n_jobs)
+int log_blocked(struct log_writer *log_file, unsigned cpu_id,
+                const struct job_struct *job)
+{
+    return log_cpu_event(log_file, cpu_id, job, job->completion_real,
+                         "Blocked");
+}
+
+int log_cpu_done(struct log_writer *log_file, unsigned cpu_id,
+                 unsigned long n_jobs, unsigned long n_wakeups,
+                 const struct cpu_power *power)
 {
     int retval = 0;
 
-    int res = fprintf(log_file,
-                      "CPU-%u terminates after servicing %lu tasks\n\n",
-                      cpu_id, n_jobs);
-    if (res < 0)
+    if (LOG_LEVEL >= LOG_LEVEL_TOTALS)
     {
-        retval = res;
+        long long busy_ns = 0;
+        for (unsigned i = 0; i < CPU_FREQUENCY_LEVELS; ++i)
+        {
+            busy_ns += power->active_ns[i];
+        }
+        retval = log_writer_printf(log_file,
+                                   "CPU-%u terminates after servicing %lu "
+                                   "tasks\n"
+                                   "CPU-%u was woken %lu times\n"
+                                   "CPU-%u used %.3f J, busy %.6f s, "
+                                   "idle %.6f s, deep idle %.6f s\n\n",
+                                   cpu_id, n_jobs, cpu_id, n_wakeups, cpu_id,
+                                   power->energy_j, busy_ns / 1e9,
+                                   power->idle_ns / 1e9,
+                                   power->deep_idle_ns / 1e9);
     }
 
     return retval;
 }
 
-int log_task_done(FILE *log_file, struct timespec time, unsigned long n_jobs)
+int log_task_done(struct log_writer *log_file, struct timespec time,
+                  unsigned long n_jobs)
 {
     int retval = 0;
 
-    struct tm tm;
-    if (localtime_r(&time.tv_sec, &tm) == NULL)
-    {
-        retval = errno;
-    }
-    else
+    if (LOG_LEVEL >= LOG_LEVEL_TOTALS)
     {
-        int res = fprintf(log_file,
-                          "Number of tasks put into Ready-Queue: %lu\n"
-                          "Terminates at time: %02d:%02d:%02d\n\n",
-                          n_jobs, tm.tm_hour, tm.tm_min,
-                          tm.tm_sec);
-        if (res < 0)
+        struct tm tm;
+        if (localtime_r(&time.tv_sec, &tm) == NULL)
+        {
+            retval = errno;
+        }
+        else
         {
-            retval = res;
+            retval = log_writer_printf(log_file,
+                                       "Number of tasks put into Ready-Queue: "
+                                       "%lu\n"
+                                       "Terminates at time: %02d:%02d:%02d\n\n",
+                                       n_jobs, tm.tm_hour, tm.tm_min,
+                                       tm.tm_sec);
         }
     }
 
     return retval;
 }
 
-int log_arrival(FILE *log_file, const struct job_struct *job)
+int log_source_done(struct log_writer *log_file, unsigned source,
+                    const char *path, unsigned long n_jobs,
+                    struct timespec elapsed)
 {
     int retval = 0;
 
-    struct tm tm;
-    if (localtime_r(&job->arrival_real.tv_sec, &tm) == NULL)
+    if (LOG_LEVEL >= LOG_LEVEL_TOTALS)
     {
-        retval = errno;
+        // Formatted first so that the line is written as one record.
+        char rate[64] = "";
+        double seconds = (double)elapsed.tv_sec + elapsed.tv_nsec / 1e9;
+        if (seconds > 0)
+        {
+            snprintf(rate, sizeof(rate), ", %.2f tasks per second",
+                     n_jobs / seconds);
+        }
+
+        retval = log_writer_printf(log_file, "Source %u (%s): %lu tasks%s\n",
+                                   source, path, n_jobs, rate);
     }
-    else
+
+    return retval;
+}
+
+int log_arrival(struct log_writer *log_file, const struct job_struct *job)
+{
+    int retval = 0;
+
+    if (job_logged(job->id))
     {
-        int res = fprintf(log_file,
-                          "%u: %jd\n"
-                          "Arrival time: %02d:%02d:%02d\n\n",
-                          job->id, (intmax_t)job->cpu_burst, tm.tm_hour,
-                          tm.tm_min, tm.tm_sec);
-        if (res < 0)
+        struct tm tm;
+        if (localtime_r(&job->arrival_real.tv_sec, &tm) == NULL)
         {
             retval = errno;
         }
+        else
+        {
+            char burst[32];
+            format_seconds(burst, job->cpu_burst_ns);
+            retval = log_writer_printf(log_file,
+                                       "%" PRIu64 ": %s\n"
+                                       "Arrival time: %02d:%02d:%02d.%09ld\n\n",
+                                       job->id, burst, tm.tm_hour, tm.tm_min,
+                                       tm.tm_sec, job->arrival_real.tv_nsec);
+        }
     }
 
     return retval;
 }
 
-int log_main_done(FILE *log_file, struct cpu_shared_stats *stats)
+int log_main_done(struct log_writer *log_file, struct cpu_shared_stats *stats)
 {
-    uintmax_t avg_wait = 0;
-    uintmax_t avg_turn = 0;
+    double avg_wait = 0;
+    double avg_turn = 0;
     if (stats->num_tasks != 0)
     {
-        avg_wait = (uintmax_t)stats->total_waiting_time / stats->num_tasks;
-        avg_turn = (uintmax_t)stats->total_turnaround_time / stats->num_tasks;
+        avg_wait = (double)stats->total_waiting_ns / stats->num_tasks / 1e9;
+        avg_turn = (double)stats->total_turnaround_ns / stats->num_tasks / 1e9;
+    }
+    int retval = log_writer_printf(log_file,
+                                   "Number of tasks: %lu\n"
+                                   "Average waiting time: %.6f seconds\n"
+                                   "Average turn around time: %.6f seconds\n",
+                                   stats->num_tasks, avg_wait, avg_turn);
+
+    if (retval == 0 && LOG_LEVEL == LOG_LEVEL_SAMPLED)
+    {
+        retval = log_writer_printf(log_file,
+                                   "Jobs logged: 1 in %" PRIu64 "\n",
+                                   LOG_SAMPLE_PERIOD);
+    }
+
+    for (unsigned i = 0; i < PRIORITY_LEVELS && retval == 0; ++i)
+    {
+        if (stats->num_tasks_by_priority[i] != 0)
+        {
+            retval = log_writer_printf(log_file,
+                                       "Priority %u: %lu tasks, "
+                                       "maximum waiting time: %.6f seconds\n",
+                                       i, stats->num_tasks_by_priority[i],
+                                       stats->max_waiting_ns[i] / 1e9);
+        }
+    }
+
+    if (retval == 0 && stats->num_tasks != 0)
+    {
+        retval = log_writer_printf(
+            log_file,
+            "Average response time: %.6f seconds, p99 %.6f seconds\n",
+            (double)stats->total_response_ns / stats->num_tasks / 1e9,
+            histogram_percentile(&stats->response_times, 99) / 1e9);
+    }
+
+    if (retval == 0 && stats->run_ns > 0)
+    {
+        retval = log_writer_printf(
+            log_file, "CPU utilisation: %.1f%%\n",
+            100.0 * stats->total_busy_ns / ((double)stats->run_ns * CPU_COUNT));
+    }
+
+    if (retval == 0)
+    {
+        retval = log_writer_printf(
+            log_file, "Energy: %.3f J, %.3f J while busy, %.3f J per task\n",
+            stats->total_energy_j, stats->total_active_energy_j,
+            (stats->num_tasks != 0) ? stats->total_energy_j / stats->num_tasks
+                                    : 0.0);
+    }
+
+    if (retval == 0 && stats->run_ns > 0)
+    {
+        retval = log_writer_printf(
+            log_file, "Average power: %.3f W\n",
+            stats->total_energy_j / (stats->run_ns / 1e9));
+    }
+
+    if (retval == 0 && stats->num_deep_wakeups != 0)
+    {
+        retval = log_writer_printf(log_file, "Wakeups from deep idle: %lu\n",
+                                   stats->num_deep_wakeups);
+    }
+
+    if (retval == 0 && stats->num_io_bursts != 0)
+    {
+        retval = log_writer_printf(log_file, "I/O bursts: %lu\n",
+                                   stats->num_io_bursts);
+    }
+
+    if (retval == 0 && stats->num_tasks != 0)
+    {
+        const struct histogram *wait = &stats->waiting_times;
+        const struct histogram *turn = &stats->turnaround_times;
+        retval = log_writer_printf(
+            log_file,
+            "Waiting time percentiles: p50 %.6f, p95 %.6f, p99 %.6f, "
+            "p99.9 %.6f seconds\n"
+            "Turn around time percentiles: p50 %.6f, p95 %.6f, p99 %.6f, "
+            "p99.9 %.6f seconds\n",
+            histogram_percentile(wait, 50) / 1e9,
+            histogram_percentile(wait, 95) / 1e9,
+            histogram_percentile(wait, 99) / 1e9,
+            histogram_percentile(wait, 99.9) / 1e9,
+            histogram_percentile(turn, 50) / 1e9,
+            histogram_percentile(turn, 95) / 1e9,
+            histogram_percentile(turn, 99) / 1e9,
+            histogram_percentile(turn, 99.9) / 1e9);
+    }
+
+    if (retval == 0 && stats->num_interrupted != 0)
+    {
+        retval = log_writer_printf(
+            log_file,
+            "Interference: %lu of %lu bursts delayed, %.6f seconds in "
+            "total\n",
+            stats->num_interrupted, stats->num_switches,
+            stats->total_interference_ns / 1e9);
     }
-    int retval =
-        fprintf(log_file,
-                "Number of tasks: %lu\n"
-                "Average waiting time: %ju seconds\n"
-                "Average turn around time: %ju seconds\n\n",
-                stats->num_tasks, avg_wait, avg_turn);
-    return (retval < 0) ? errno : 0;
+
+    if (retval == 0 && stats->num_tasks != 0
+        && (RUNTIME_NOISE_SIGMA != 0 || STRAGGLER_PROBABILITY != 0))
+    {
+        retval = log_writer_printf(
+            log_file,
+            "Estimated run time: %.6f seconds, actual: %.6f seconds\n"
+            "Mean estimate error: %.1f%%, stragglers: %lu\n",
+            stats->total_estimated_ns / 1e9, stats->total_actual_ns / 1e9,
+            100 * stats->total_relative_error / stats->num_tasks,
+            stats->num_stragglers);
+    }
+
+    if (retval == 0 && stats->num_backups != 0)
+    {
+        long long saved_ns =
+            (long long)(stats->latest_completion_unspeculated.tv_sec
+                        - stats->latest_completion.tv_sec) * 1000000000
+            + (stats->latest_completion_unspeculated.tv_nsec
+               - stats->latest_completion.tv_nsec);
+        retval = log_writer_printf(
+            log_file,
+            "Backups started: %lu, finished first: %lu, "
+            "wasted cpu time: %.6f seconds\n"
+            "Makespan reduced by backups: %.6f seconds\n",
+            stats->num_backups, stats->num_backups_won,
+            stats->total_wasted_ns / 1e9,
+            (saved_ns > 0) ? saved_ns / 1e9 : 0.0);
+    }
+
+    if (retval == 0 && stats->total_switch_ns + stats->total_cold_ns != 0)
+    {
+        long long overhead_ns = stats->total_switch_ns + stats->total_cold_ns;
+        retval = log_writer_printf(
+            log_file,
+            "Context switches: %lu, %.6f seconds\n"
+            "Cache-cold dispatches: %lu, %.6f seconds\n"
+            "Total overhead: %.6f seconds, %.1f%% of busy cpu time\n",
+            stats->num_switches, stats->total_switch_ns / 1e9,
+            stats->num_cold, stats->total_cold_ns / 1e9, overhead_ns / 1e9,
+            (stats->total_busy_ns != 0)
+                ? 100.0 * overhead_ns / stats->total_busy_ns
+                : 0.0);
+    }
+
+    if (retval == 0 && AFFINITY_DISPATCH)
+    {
+        retval = log_writer_printf(log_file,
+                                   "Jobs left for their last cpu: %lu\n",
+                                   stats->num_affinity_waits);
+    }
+
+    if (retval == 0 && stats->num_dispatch_gaps != 0)
+    {
+        retval = log_writer_printf(log_file,
+                                   "Average dispatch gap: %.1f microseconds\n",
+                                   (double)stats->total_dispatch_gap_ns
+                                   / stats->num_dispatch_gaps / 1000);
+    }
+
+    if (retval == 0
+        && (LOOKAHEAD_HORIZON.tv_sec != 0 || LOOKAHEAD_HORIZON.tv_nsec != 0
+            || AFFINITY_DISPATCH))
+    {
+        retval = log_writer_printf(
+            log_file, "Jobs overtaken by later arrivals: %lu (%.2f%%)\n",
+            stats->num_overtaken,
+            (stats->num_tasks != 0)
+                ? 100.0 * stats->num_overtaken / stats->num_tasks
+                : 0.0);
+    }
+
+    if (retval == 0 && stats->num_reserved != 0)
+    {
+        retval = log_writer_printf(
+            log_file,
+            "Jobs reserved ahead: %lu, taken back by idle cpus: %lu\n",
+            stats->num_reserved, stats->num_stolen);
+    }
+
+    if (retval == 0)
+    {
+        retval = log_writer_printf(log_file, "\n");
+    }
+    return retval;
 }
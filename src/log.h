@@ -4,6 +4,11 @@
  * @date   2019-04-28
  *
  * @brief  Logging functions used throughout the program.
+ *
+ * What is written depends on LOG_LEVEL in config.h. The functions for the
+ * events of a job write nothing for jobs which are not logged at that level,
+ * and the totals of each thread are only written from LOG_LEVEL_TOTALS up.
+ * Either way the check is made before anything is formatted.
  */
 
 
@@ -12,6 +17,7 @@
 
 #include "job.h"
 #include "cpu.h"
+#include "log_writer.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -31,7 +37,8 @@
  *
  * @return Zero if the function succeeds, else a POSIX error number.
  */
-int log_service(FILE *log_file, unsigned cpu_id, const struct job_struct *job);
+int log_service(struct log_writer *log_file, unsigned cpu_id,
+                const struct job_struct *job);
 
 /**
  * @brief Log the completion of @p j at @p time to the file @p log_file.
@@ -49,29 +56,56 @@ int log_service(FILE *log_file, unsigned cpu_id, const struct job_struct *job);
  *
  * @return Zero if the function succeeds, else a POSIX error number.
  */
-int log_completion(FILE *log_file, unsigned cpu_id, const struct job_struct *job);
+int log_completion(struct log_writer *log_file, unsigned cpu_id,
+                   const struct job_struct *job);
+
+/**
+ * @brief Log a job leaving a cpu for an I/O burst.
+ *
+ * Uses the format:
+ *
+ *     Statistics for CPU-<cpu_id>:
+ *     Job #<j.id>
+ *     Arrival time: <j.arrival>
+ *     Blocked time: <j.completion>
+ *
+ * @param[in,out] log_file The file to write to.
+ * @param cpu_id The id of the cpu.
+ * @param[in] job The job to be logged.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_blocked(struct log_writer *log_file, unsigned cpu_id,
+                const struct job_struct *job);
 
 /**
- * @brief Log the total number of jobs executed by a cpu thread.
+ * @brief Log the total number of jobs executed by a cpu thread, the number
+ *        of times it was woken to take a job and the energy it used.
  *
  * Uses the format:
  *
  *     CPU-<cpu_id> terminates after servicing <n_jobs> tasks
+ *     CPU-<cpu_id> was woken <n_wakeups> times
+ *     CPU-<cpu_id> used <energy> J, busy <busy> s, idle <idle> s, deep idle <deep> s
  *
  * @param[in,out] log_file The file to write to.
  * @param cpu_id The id of the cpu.
  * @param n_jobs The number of jobs.
+ * @param n_wakeups The number of wakeups.
+ * @param[in] power The power states of the cpu.
  *
  * @return Zero if the function succeeds, else a POSIX error number.
  */
-int log_cpu_done(FILE *log_file, unsigned cpu_id, unsigned long n_jobs);
+int log_cpu_done(struct log_writer *log_file, unsigned cpu_id,
+                 unsigned long n_jobs, unsigned long n_wakeups,
+                 const struct cpu_power *power);
 
 /**
  * @brief Log the arrival of a job.
  *
  * Uses the format:
  *
- *     <j.id>: <j.cpu_burst>
+ *     <j.id>: <j.cpu_burst_ns in seconds>
  *     Arrival time: <j.arrival>
  *
  * @param[in,out] log_file The file to write to.
@@ -79,7 +113,7 @@ int log_cpu_done(FILE *log_file, unsigned cpu_id, unsigned long n_jobs);
  *
  * @return Zero if the function succeeds, else a POSIX error number.
  */
-int log_arrival(FILE *log_file, const struct job_struct *job);
+int log_arrival(struct log_writer *log_file, const struct job_struct *job);
 
 /**
  * @brief Log the total number of jobs put in to the queue by task().
@@ -96,7 +130,31 @@ int log_arrival(FILE *log_file, const struct job_struct *job);
  * @return Zero if the function succeeds, else an error code that can be
  *         passed to errno_or_ae_to_str().
  */
-int log_task_done(FILE *log_file, struct timespec time, unsigned long n_jobs);
+int log_task_done(struct log_writer *log_file, struct timespec time,
+                  unsigned long n_jobs);
+
+/**
+ * @brief Log the number of jobs that arrived from one job file and the rate
+ *        they arrived at.
+ *
+ * Uses the format:
+ *
+ *     Source <source> (<path>): <n_jobs> tasks, <rate> tasks per second
+ *
+ * The rate is left out if @p elapsed is zero.
+ *
+ * @param[in,out] log_file The file to write to.
+ * @param source The position of the job file on the command line.
+ * @param[in] path The path of the job file.
+ * @param n_jobs The number of jobs that arrived from the file.
+ * @param elapsed The time from the start of the task() thread reading the file
+ *                to the last arrival.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_source_done(struct log_writer *log_file, unsigned source,
+                    const char *path, unsigned long n_jobs,
+                    struct timespec elapsed);
 
 /**
  * @brief Log statistics after all tasks are finished.
@@ -106,14 +164,18 @@ int log_task_done(FILE *log_file, struct timespec time, unsigned long n_jobs);
  * Number of tasks: #
  * Average waiting time: # seconds
  * Average turn around time: # seconds
+ * Priority #: # tasks, maximum waiting time: # seconds
  * @endverbatim
  *
+ * The last line is repeated for each priority that has had at least one
+ * task.
+ *
  * @param log_file The file to write to.
  * @param stats The stats to get data from.
  *
  * @return Zero if the function succeeds, else an error code that can be
  *         passed to errno_or_ae_to_str().
  */
-int log_main_done(FILE *log_file, struct cpu_shared_stats *stats);
+int log_main_done(struct log_writer *log_file, struct cpu_shared_stats *stats);
 
 #endif /* LOG_H */
@@ -0,0 +1,1182 @@
+/**
+ * @file   log_async.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Implementation of log_async.h.
+ *
+ * io_uring is used through its system calls directly so that liburing is not
+ * needed.
+ */
+
+// Needed for syscall().
+#define _GNU_SOURCE
+
+#include "log_async.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/** The size of the buffer each thread formats its records in before they
+ * are copied in to the ring. Longer records are formatted in memory from
+ * malloc(). */
+#define LOG_ASYNC_RECORD_BYTES 4096
+
+/** An io_uring instance mapped in to this process. */
+struct uring
+{
+    /** The descriptor of the instance. */
+    int fd;
+
+    /** The mapping holding the submission queue ring. */
+    void *sq_ring;
+
+    /** The size of sq_ring. */
+    size_t sq_ring_size;
+
+    /** The mapping holding the completion queue ring, may be sq_ring. */
+    void *cq_ring;
+
+    /** The size of cq_ring. */
+    size_t cq_ring_size;
+
+    /** The submission queue entries. */
+    void *sqes;
+
+    /** The size of sqes. */
+    size_t sqes_size;
+
+    /** The head of the submission queue, advanced by the kernel. */
+    _Atomic unsigned *sq_head;
+
+    /** The tail of the submission queue, advanced by this process. */
+    _Atomic unsigned *sq_tail;
+
+    /** The mask applied to sq_head and sq_tail. */
+    unsigned sq_mask;
+
+    /** The indices in sqes of the submitted entries. */
+    unsigned *sq_array;
+
+    /** The head of the completion queue, advanced by this process. */
+    _Atomic unsigned *cq_head;
+
+    /** The tail of the completion queue, advanced by the kernel. */
+    _Atomic unsigned *cq_tail;
+
+    /** The mask applied to cq_head and cq_tail. */
+    unsigned cq_mask;
+
+    /** The completion queue entries. */
+    void *cqes;
+
+    /** True if the buffers of the ring are registered with the instance. */
+    bool fixed;
+};
+
+struct log_async
+{
+    /** Lock for the data in this struct which is not only used by the
+     * writer thread. */
+    pthread_mutex_t mutex;
+
+    /** Signalled when a buffer is queued for the writer thread or done is
+     * set. */
+    pthread_cond_t writer_wakeup;
+
+    /** Broadcast when a buffer has been written or spilling is cleared. */
+    pthread_cond_t buffer_free;
+
+    /** The descriptor written to. */
+    int fd;
+
+    /** LOG_ASYNC_BUFFERS buffers of LOG_ASYNC_BUFFER_BYTES each. */
+    char *data;
+
+    /** The index of the buffer being filled. */
+    size_t filling;
+
+    /** The number of bytes of the buffer being filled that are used. */
+    size_t used;
+
+    /** The offset in the file at which the buffer being filled starts. */
+    off_t offset;
+
+    /** The number of buffers queued for the writer thread and not yet
+     * written. They are the buffers before filling in the ring. */
+    size_t n_queued;
+
+    /** The number of the queued buffers, from the oldest, which the writer
+     * thread has started to write. */
+    size_t n_started;
+
+    /** The length of each queued buffer. */
+    size_t lengths[LOG_ASYNC_BUFFERS];
+
+    /** The offset in the file of each queued buffer. */
+    off_t offsets[LOG_ASYNC_BUFFERS];
+
+    /** The number of bytes of each queued buffer which have been written,
+     * only used by the writer thread. */
+    size_t written[LOG_ASYNC_BUFFERS];
+
+    /** True for each queued buffer which has been written, or has failed to
+     * be, but is not the oldest so is not free yet. */
+    bool finished[LOG_ASYNC_BUFFERS];
+
+    /** True while a record longer than a buffer is copied in to several
+     * buffers, so that no other record is placed between its parts. */
+    bool spilling;
+
+    /** True once no more buffers will be queued. */
+    bool done;
+
+    /** See log_async_set_segments(), NULL if the log is not split. */
+    int (*start_segment)(void *context);
+
+    /** See log_async_set_segments(), may be NULL. */
+    int (*segment_header)(void *context, char *buffer, size_t size);
+
+    /** Passed to start_segment and segment_header. */
+    void *context;
+
+    /** The size at which a new segment is started, zero for no limit. */
+    uint64_t segment_bytes;
+
+    /** The time after which a new segment is started in nanoseconds, zero
+     * for no limit. */
+    uint64_t period_ns;
+
+    /** The time from CLOCK_MONOTONIC in nanoseconds that the current
+     * segment was started. */
+    uint64_t segment_start_ns;
+
+    /** True if the buffer being filled is to be the last of its segment. */
+    bool segment_ending;
+
+    /** True for each buffer which starts a new segment, including the
+     * buffer being filled. */
+    bool starts_segment[LOG_ASYNC_BUFFERS];
+
+    /** Zero, or a POSIX error number if the last segment could not be
+     * started, in which case no more writes are made. */
+    int segment_error;
+
+    /** Zero, or a POSIX error number for the first write that failed. */
+    int error;
+
+    /** True if ring is used, false to use pwrite(). */
+    bool use_ring;
+
+    /** The io_uring instance, only used by the writer thread. */
+    struct uring ring;
+
+    /** The number of writes submitted to ring which have not completed,
+     * only used by the writer thread. */
+    size_t n_in_flight;
+
+    /** True while the writer thread waits for a completion from ring. */
+    bool writer_waiting;
+
+    /** True if a no-op has been submitted to ring to end the writer
+     * thread's wait and its completion has not been taken. */
+    bool woken;
+
+    /** The writer thread. */
+    pthread_t writer;
+};
+
+/**
+ * @brief Set up an io_uring instance and register the buffers of @p async
+ *        with it if possible.
+ *
+ * @param[out] ring The instance.
+ * @param[in] async The writer whose buffers are written.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int uring_init(struct uring *ring, const struct log_async *async);
+
+/**
+ * @brief Tear down an instance set up by uring_init().
+ *
+ * @param[in] ring The instance.
+ */
+static void uring_destroy(struct uring *ring);
+
+/**
+ * @brief Submit a write to @p ring.
+ *
+ * @param[in] ring The instance.
+ * @param[in] async The writer.
+ * @param index The index of the buffer written from, used as the user data
+ *              of the completion.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int uring_submit(struct uring *ring, const struct log_async *async,
+                        size_t index);
+
+/**
+ * @brief Submit a no-op to @p ring, so that a thread waiting in
+ *        uring_complete() returns with a completion whose index is
+ *        LOG_ASYNC_BUFFERS.
+ *
+ * @param[in] ring The instance.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int uring_wake(struct uring *ring);
+
+/**
+ * @brief Take a completion from @p ring, waiting for one if there are none.
+ *
+ * @param[in] ring The instance.
+ * @param[out] index The index of the buffer the write was from.
+ * @param[out] result The result of the write, as returned by write() or a
+ *                    negative POSIX error number.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int uring_complete(struct uring *ring, size_t *index, int *result);
+
+/**
+ * @brief Queue the buffer being filled for the writer thread and start
+ *        filling the next, waiting for it to be written if needed. The
+ *        caller must hold the mutex, which is released while waiting, so
+ *        another thread may have queued the buffer instead.
+ *
+ * @param[in] async The writer.
+ */
+static void hand_off(struct log_async *async);
+
+/**
+ * @brief Get the time from CLOCK_MONOTONIC.
+ *
+ * @return The time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void);
+
+/**
+ * @brief Start a new segment with the next record if the current one is full
+ *        or old enough, beginning it with its header if there is one. The
+ *        caller must hold the mutex.
+ *
+ * @param[in] async The writer.
+ */
+static void check_segment(struct log_async *async);
+
+/**
+ * @brief Copy a record in to the ring of buffers. The caller must hold the
+ *        mutex and spilling must be false.
+ *
+ * @param[in] async The writer.
+ * @param[in] record The record.
+ * @param length The length of @p record.
+ */
+static void append(struct log_async *async, const char *record,
+                   size_t length);
+
+/**
+ * @brief Record that a queued buffer has been written, or has failed to be,
+ *        and free the buffers which are no longer needed. The caller must
+ *        hold the mutex.
+ *
+ * @param[in] async The writer.
+ * @param index The index of the buffer.
+ * @param error Zero, or the POSIX error number the write failed with.
+ */
+static void finish(struct log_async *async, size_t index, int error);
+
+/**
+ * @brief Write the rest of a queued buffer with pwrite(). The caller must
+ *        hold the mutex, which is released while writing.
+ *
+ * @param[in] async The writer.
+ * @param index The index of the buffer.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int write_rest(struct log_async *async, size_t index);
+
+/**
+ * @brief Start writing a queued buffer, writing it with pwrite() before
+ *        returning if io_uring is not used. The caller must hold the mutex.
+ *
+ * @param[in] async The writer.
+ * @param index The index of the buffer.
+ */
+static void start_write(struct log_async *async, size_t index);
+
+/**
+ * @brief Handle one completion from the io_uring instance. The caller must
+ *        hold the mutex.
+ *
+ * @param[in] async The writer.
+ * @param index The index of the buffer the write was from.
+ * @param result The result of the write.
+ */
+static void handle_completion(struct log_async *async, size_t index,
+                              int result);
+
+/**
+ * @brief Write the buffers queued by the other threads until done is set and
+ *        every buffer has been written.
+ *
+ * @param data The log_async.
+ *
+ * @return NULL.
+ */
+static void *writer_thread(void *data);
+
+int log_async_open(struct log_async **async, int fd, bool use_uring)
+{
+    int retval = 0;
+    int steps_done = 0;
+
+    *async = malloc(sizeof(**async));
+    if (*async == NULL)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        **async = (struct log_async){.fd = fd};
+        (*async)->offset = lseek(fd, 0, SEEK_END);
+        (*async)->data = malloc((size_t)LOG_ASYNC_BUFFERS
+                                * LOG_ASYNC_BUFFER_BYTES);
+        if ((*async)->offset == -1 || (*async)->data == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 1;
+        retval = pthread_mutex_init(&(*async)->mutex, NULL);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 2;
+        retval = pthread_cond_init(&(*async)->writer_wakeup, NULL);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 3;
+        retval = pthread_cond_init(&(*async)->buffer_free, NULL);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 4;
+        // Without io_uring the buffers are written with pwrite() instead.
+        (*async)->use_ring = use_uring
+                             && uring_init(&(*async)->ring, *async) == 0;
+        retval = pthread_create(&(*async)->writer, NULL, &writer_thread,
+                                *async);
+    }
+
+    if (retval != 0 && *async != NULL)
+    {
+        if ((*async)->use_ring)
+        {
+            uring_destroy(&(*async)->ring);
+        }
+
+        switch (steps_done)
+        {
+        case 4:
+            pthread_cond_destroy(&(*async)->buffer_free);
+            /* FALL THROUGH */
+        case 3:
+            pthread_cond_destroy(&(*async)->writer_wakeup);
+            /* FALL THROUGH */
+        case 2:
+            pthread_mutex_destroy(&(*async)->mutex);
+            /* FALL THROUGH */
+        default:
+            break;
+        }
+
+        free((*async)->data);
+        free(*async);
+        *async = NULL;
+    }
+
+    return retval;
+}
+
+int log_async_close(struct log_async *async)
+{
+    pthread_mutex_lock(&async->mutex);
+    if (async->used != 0)
+    {
+        hand_off(async);
+    }
+    async->done = true;
+    pthread_cond_signal(&async->writer_wakeup);
+    pthread_mutex_unlock(&async->mutex);
+
+    pthread_join(async->writer, NULL);
+    int retval = async->error;
+
+    if (async->use_ring)
+    {
+        uring_destroy(&async->ring);
+    }
+    pthread_cond_destroy(&async->buffer_free);
+    pthread_cond_destroy(&async->writer_wakeup);
+    pthread_mutex_destroy(&async->mutex);
+    free(async->data);
+    free(async);
+
+    return retval;
+}
+
+int log_async_vprintf(struct log_async *async, const char *format,
+                      va_list args)
+{
+    int retval = 0;
+    static _Thread_local char scratch[LOG_ASYNC_RECORD_BYTES];
+
+    // Format outside the mutex so that threads only wait for each other to
+    // copy their records.
+    char *record = scratch;
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(scratch, sizeof(scratch), format, copy);
+    va_end(copy);
+    if (length < 0)
+    {
+        retval = errno;
+    }
+    else if ((size_t)length >= sizeof(scratch))
+    {
+        record = malloc((size_t)length + 1);
+        if (record == NULL)
+        {
+            retval = errno;
+        }
+        else
+        {
+            va_copy(copy, args);
+            vsnprintf(record, (size_t)length + 1, format, copy);
+            va_end(copy);
+        }
+    }
+
+    pthread_mutex_lock(&async->mutex);
+    while (async->spilling)
+    {
+        pthread_cond_wait(&async->buffer_free, &async->mutex);
+    }
+    if (retval == 0 && async->start_segment != NULL)
+    {
+        check_segment(async);
+    }
+    if (retval == 0)
+    {
+        append(async, record, (size_t)length);
+    }
+    if (retval == 0)
+    {
+        retval = async->error;
+    }
+    pthread_mutex_unlock(&async->mutex);
+
+    if (record != scratch)
+    {
+        free(record);
+    }
+
+    return retval;
+}
+
+int log_async_flush(struct log_async *async)
+{
+    pthread_mutex_lock(&async->mutex);
+    if (async->used != 0)
+    {
+        hand_off(async);
+    }
+    int retval = async->error;
+    pthread_mutex_unlock(&async->mutex);
+
+    return retval;
+}
+
+void log_async_set_segments(struct log_async *async, uint64_t segment_bytes,
+                            struct timespec period,
+                            int (*start_segment)(void *context),
+                            int (*segment_header)(void *context, char *buffer,
+                                                  size_t size),
+                            void *context)
+{
+    pthread_mutex_lock(&async->mutex);
+    async->start_segment = start_segment;
+    async->segment_header = segment_header;
+    async->context = context;
+    async->segment_bytes = segment_bytes;
+    async->period_ns = (uint64_t)period.tv_sec * 1000000000
+                       + (uint64_t)period.tv_nsec;
+    async->segment_start_ns = monotonic_ns();
+    pthread_mutex_unlock(&async->mutex);
+}
+
+bool log_async_uses_uring(const struct log_async *async)
+{
+    return async->use_ring;
+}
+
+#ifdef __linux__
+
+static int uring_init(struct uring *ring, const struct log_async *async)
+{
+    int retval = 0;
+
+    struct io_uring_params params = {0};
+    *ring = (struct uring){
+        .fd = (int)syscall(SYS_io_uring_setup, LOG_ASYNC_BUFFERS, &params),
+        .sq_ring = MAP_FAILED,
+        .cq_ring = MAP_FAILED,
+        .sqes = MAP_FAILED
+    };
+    if (ring->fd == -1)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        ring->sq_ring_size = params.sq_off.array
+                             + params.sq_entries * sizeof(unsigned);
+        ring->cq_ring_size = params.cq_off.cqes
+                             + params.cq_entries
+                               * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (ring->cq_ring_size > ring->sq_ring_size)
+            {
+                ring->sq_ring_size = ring->cq_ring_size;
+            }
+            ring->cq_ring_size = ring->sq_ring_size;
+        }
+
+        ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_SQ_RING);
+        if (ring->sq_ring == MAP_FAILED)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            ring->cq_ring = ring->sq_ring;
+        }
+        else
+        {
+            ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd,
+                                 IORING_OFF_CQ_RING);
+            if (ring->cq_ring == MAP_FAILED)
+            {
+                retval = errno;
+            }
+        }
+    }
+
+    if (retval == 0)
+    {
+        ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_SQES);
+        if (ring->sqes == MAP_FAILED)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        char *sq = ring->sq_ring;
+        char *cq = ring->cq_ring;
+        ring->sq_head = (_Atomic unsigned *)(sq + params.sq_off.head);
+        ring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+        ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+        ring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+        ring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+        ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        ring->cqes = cq + params.cq_off.cqes;
+
+        // Registered buffers save the kernel mapping the pages for every
+        // write. Registration can fail if too much memory would be locked,
+        // in which case the buffers are passed with each write instead.
+        struct iovec buffers[LOG_ASYNC_BUFFERS];
+        for (size_t i = 0; i < LOG_ASYNC_BUFFERS; ++i)
+        {
+            buffers[i] = (struct iovec){
+                .iov_base = async->data + i * LOG_ASYNC_BUFFER_BYTES,
+                .iov_len = LOG_ASYNC_BUFFER_BYTES
+            };
+        }
+        ring->fixed = syscall(SYS_io_uring_register, ring->fd,
+                              IORING_REGISTER_BUFFERS, buffers,
+                              LOG_ASYNC_BUFFERS) == 0;
+    }
+
+    // Kernels which have io_uring need not have every operation, and an
+    // unsupported one only fails in its completion, so check for them here
+    // to fall back to pwrite() instead.
+    struct io_uring_probe *probe = NULL;
+    if (retval == 0)
+    {
+        probe = calloc(1, sizeof(*probe)
+                              + IORING_OP_LAST
+                                    * sizeof(struct io_uring_probe_op));
+        if (probe == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0
+        && syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+                   probe, IORING_OP_LAST)
+               == -1)
+    {
+        retval = (errno == EINVAL) ? EOPNOTSUPP : errno;
+    }
+
+    if (retval == 0)
+    {
+        /* IORING_OP_NOP is opcode 0, always within last_op. */
+        bool nop = probe->ops[IORING_OP_NOP].flags & IO_URING_OP_SUPPORTED;
+        bool write = probe->last_op >= IORING_OP_WRITE
+                     && (probe->ops[IORING_OP_WRITE].flags
+                         & IO_URING_OP_SUPPORTED);
+        bool write_fixed = probe->last_op >= IORING_OP_WRITE_FIXED
+                           && (probe->ops[IORING_OP_WRITE_FIXED].flags
+                               & IO_URING_OP_SUPPORTED);
+        ring->fixed = ring->fixed && write_fixed;
+        if (!nop || (!write && !ring->fixed))
+        {
+            retval = EOPNOTSUPP;
+        }
+    }
+    free(probe);
+
+    if (retval != 0 && ring->fd != -1)
+    {
+        uring_destroy(ring);
+    }
+
+    return retval;
+}
+
+static void uring_destroy(struct uring *ring)
+{
+    if (ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
+
+/**
+ * @brief Submit one entry to @p ring.
+ *
+ * @param[in] ring The instance.
+ * @param[in] entry The entry.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int uring_push(struct uring *ring, const struct io_uring_sqe *entry)
+{
+    int retval = 0;
+
+    // Submissions are made with the mutex of the log_async held, so the
+    // tail can be read relaxed. At most LOG_ASYNC_BUFFERS - 1 writes and
+    // one no-op are in flight so there is always a free entry.
+    unsigned tail = atomic_load_explicit(ring->sq_tail,
+                                         memory_order_relaxed);
+    unsigned slot = tail & ring->sq_mask;
+    ((struct io_uring_sqe *)ring->sqes)[slot] = *entry;
+    ring->sq_array[slot] = slot;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+
+    int submitted;
+    do
+    {
+        submitted = (int)syscall(SYS_io_uring_enter, ring->fd, 1, 0, 0,
+                                 NULL, 0);
+    } while (submitted == -1 && errno == EINTR);
+    if (submitted == -1)
+    {
+        retval = errno;
+        // Take the entry back so that a later submission does not pick it
+        // up.
+        atomic_store_explicit(ring->sq_tail, tail, memory_order_release);
+    }
+
+    return retval;
+}
+
+static int uring_submit(struct uring *ring, const struct log_async *async,
+                        size_t index)
+{
+    struct io_uring_sqe sqe = {
+        .opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+        .fd = async->fd,
+        .addr = (uintptr_t)(async->data + index * LOG_ASYNC_BUFFER_BYTES
+                            + async->written[index]),
+        .len = (unsigned)(async->lengths[index] - async->written[index]),
+        .off = (uint64_t)(async->offsets[index] + async->written[index]),
+        .buf_index = ring->fixed ? (uint16_t)index : 0,
+        .user_data = index
+    };
+
+    return uring_push(ring, &sqe);
+}
+
+static int uring_wake(struct uring *ring)
+{
+    struct io_uring_sqe sqe = {
+        .opcode = IORING_OP_NOP,
+        .user_data = LOG_ASYNC_BUFFERS
+    };
+
+    return uring_push(ring, &sqe);
+}
+
+static int uring_complete(struct uring *ring, size_t *index, int *result)
+{
+    int retval = 0;
+
+    unsigned head = atomic_load_explicit(ring->cq_head,
+                                         memory_order_relaxed);
+    while (retval == 0
+           && atomic_load_explicit(ring->cq_tail, memory_order_acquire)
+                  == head)
+    {
+        if (syscall(SYS_io_uring_enter, ring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0)
+                == -1
+            && errno != EINTR)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        const struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring->cqes
+                                         + (head & ring->cq_mask);
+        *index = (size_t)cqe->user_data;
+        *result = cqe->res;
+        atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+    }
+
+    return retval;
+}
+
+#else
+
+static int uring_init(struct uring *ring, const struct log_async *async)
+{
+    (void)ring;
+    (void)async;
+    return ENOSYS;
+}
+
+static void uring_destroy(struct uring *ring)
+{
+    (void)ring;
+}
+
+static int uring_submit(struct uring *ring, const struct log_async *async,
+                        size_t index)
+{
+    (void)ring;
+    (void)async;
+    (void)index;
+    return ENOSYS;
+}
+
+static int uring_wake(struct uring *ring)
+{
+    (void)ring;
+    return ENOSYS;
+}
+
+static int uring_complete(struct uring *ring, size_t *index, int *result)
+{
+    (void)ring;
+    (void)index;
+    (void)result;
+    return ENOSYS;
+}
+
+#endif /* __linux__ */
+
+static void hand_off(struct log_async *async)
+{
+    while (async->n_queued == LOG_ASYNC_BUFFERS - 1)
+    {
+        pthread_cond_wait(&async->buffer_free, &async->mutex);
+    }
+    if (async->used == 0)
+    {
+        return;
+    }
+
+    size_t index = async->filling;
+    async->lengths[index] = async->used;
+    async->offsets[index] = async->offset;
+    ++async->n_queued;
+    async->filling = (index + 1) % LOG_ASYNC_BUFFERS;
+    async->used = 0;
+    if (async->segment_ending)
+    {
+        async->segment_ending = false;
+        async->starts_segment[async->filling] = true;
+        async->offset = 0;
+    }
+    else
+    {
+        async->starts_segment[async->filling] = false;
+        async->offset += (off_t)async->lengths[index];
+    }
+    pthread_cond_signal(&async->writer_wakeup);
+
+    // The writer thread could be waiting for a write to complete rather
+    // than on writer_wakeup, so end its wait to have it start this buffer.
+    if (async->writer_waiting && !async->woken)
+    {
+        async->woken = (uring_wake(&async->ring) == 0);
+    }
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void check_segment(struct log_async *async)
+{
+    uint64_t size = (uint64_t)async->offset + async->used;
+    uint64_t now_ns = monotonic_ns();
+    bool due = (async->segment_bytes != 0 && size >= async->segment_bytes)
+               || (async->period_ns != 0
+                   && now_ns - async->segment_start_ns >= async->period_ns);
+
+    // An empty segment is kept, and one already ending is left to finish.
+    bool started = false;
+    if (due && !async->segment_ending)
+    {
+        async->segment_start_ns = now_ns;
+        if (async->used != 0)
+        {
+            async->segment_ending = true;
+            hand_off(async);
+            started = true;
+        }
+        else if (size != 0)
+        {
+            async->starts_segment[async->filling] = true;
+            async->offset = 0;
+            started = true;
+        }
+    }
+
+    char header[64];
+    int length = 0;
+    if (started && async->segment_header != NULL)
+    {
+        length = async->segment_header(async->context, header,
+                                       sizeof(header));
+    }
+    if (length > 0 && (size_t)length < sizeof(header))
+    {
+        append(async, header, (size_t)length);
+    }
+}
+
+static void append(struct log_async *async, const char *record,
+                   size_t length)
+{
+    bool spill = (length > LOG_ASYNC_BUFFER_BYTES);
+    async->spilling = spill;
+
+    while (length != 0)
+    {
+        // Keep the record in one buffer if it fits in one. hand_off() can
+        // let other threads fill the buffer, so check again after it.
+        size_t space = LOG_ASYNC_BUFFER_BYTES - async->used;
+        if (space == 0
+            || (length > space && length <= LOG_ASYNC_BUFFER_BYTES
+                && async->used != 0))
+        {
+            hand_off(async);
+            while (async->spilling && !spill)
+            {
+                pthread_cond_wait(&async->buffer_free, &async->mutex);
+            }
+            continue;
+        }
+
+        size_t n_bytes = (length < space) ? length : space;
+        memcpy(async->data + async->filling * LOG_ASYNC_BUFFER_BYTES
+                   + async->used,
+               record, n_bytes);
+        async->used += n_bytes;
+        record += n_bytes;
+        length -= n_bytes;
+    }
+
+    if (spill)
+    {
+        async->spilling = false;
+        pthread_cond_broadcast(&async->buffer_free);
+    }
+}
+
+static void finish(struct log_async *async, size_t index, int error)
+{
+    if (async->error == 0)
+    {
+        async->error = error;
+    }
+    async->finished[index] = true;
+
+    // Buffers are reused in order, so only free a buffer once every older
+    // one has been written.
+    size_t oldest = (async->filling + LOG_ASYNC_BUFFERS - async->n_queued)
+                    % LOG_ASYNC_BUFFERS;
+    bool freed = false;
+    while (async->n_queued != 0 && async->finished[oldest])
+    {
+        async->finished[oldest] = false;
+        --async->n_queued;
+        --async->n_started;
+        oldest = (oldest + 1) % LOG_ASYNC_BUFFERS;
+        freed = true;
+    }
+    if (freed)
+    {
+        pthread_cond_broadcast(&async->buffer_free);
+    }
+}
+
+static void start_write(struct log_async *async, size_t index)
+{
+    async->written[index] = 0;
+
+    // The file is still the old segment, so writing would overwrite it.
+    if (async->segment_error != 0)
+    {
+        finish(async, index, async->segment_error);
+        return;
+    }
+
+    if (async->use_ring)
+    {
+        int retval = uring_submit(&async->ring, async, index);
+        if (retval == 0)
+        {
+            ++async->n_in_flight;
+        }
+        else
+        {
+            finish(async, index, retval);
+        }
+        return;
+    }
+
+    finish(async, index, write_rest(async, index));
+}
+
+static int write_rest(struct log_async *async, size_t index)
+{
+    // Nothing else touches the buffer or the file while it is written, so
+    // the mutex is released to let other threads queue buffers.
+    pthread_mutex_unlock(&async->mutex);
+    int retval = 0;
+    const char *data = async->data + index * LOG_ASYNC_BUFFER_BYTES;
+    while (retval == 0 && async->written[index] < async->lengths[index])
+    {
+        ssize_t written = pwrite(async->fd, data + async->written[index],
+                                 async->lengths[index]
+                                     - async->written[index],
+                                 async->offsets[index]
+                                     + (off_t)async->written[index]);
+        if (written == -1)
+        {
+            if (errno != EINTR)
+            {
+                retval = errno;
+            }
+        }
+        else
+        {
+            async->written[index] += (size_t)written;
+        }
+    }
+    pthread_mutex_lock(&async->mutex);
+
+    return retval;
+}
+
+static void handle_completion(struct log_async *async, size_t index,
+                              int result)
+{
+    if (index == LOG_ASYNC_BUFFERS)
+    {
+        // The no-op from hand_off().
+        async->woken = false;
+        return;
+    }
+
+    --async->n_in_flight;
+
+    if (result == -EINVAL || result == -EOPNOTSUPP)
+    {
+        // The kernel or the file does not support the write after all, so
+        // try the rest of the buffer with pwrite(), which reports the error
+        // if it is the write itself that is invalid.
+        finish(async, index, write_rest(async, index));
+        return;
+    }
+
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        result = 0;
+    }
+    else if (result == 0)
+    {
+        result = -EIO;
+    }
+
+    if (result < 0)
+    {
+        finish(async, index, -result);
+        return;
+    }
+
+    async->written[index] += (size_t)result;
+    if (async->written[index] == async->lengths[index])
+    {
+        finish(async, index, 0);
+        return;
+    }
+
+    // A short write, so submit the rest.
+    int retval = uring_submit(&async->ring, async, index);
+    if (retval == 0)
+    {
+        ++async->n_in_flight;
+    }
+    else
+    {
+        finish(async, index, retval);
+    }
+}
+
+static void *writer_thread(void *data)
+{
+    struct log_async *async = data;
+
+    pthread_mutex_lock(&async->mutex);
+    while (!async->done || async->n_queued != 0)
+    {
+        size_t next = (async->filling + LOG_ASYNC_BUFFERS - async->n_queued
+                       + async->n_started)
+                      % LOG_ASYNC_BUFFERS;
+        // A new segment waits for the writes to the old one to complete.
+        if (async->n_started < async->n_queued
+            && (!async->starts_segment[next] || async->n_in_flight == 0))
+        {
+            ++async->n_started;
+            if (async->starts_segment[next])
+            {
+                pthread_mutex_unlock(&async->mutex);
+                int retval = async->start_segment(async->context);
+                pthread_mutex_lock(&async->mutex);
+                async->segment_error = retval;
+            }
+            start_write(async, next);
+        }
+        else if (async->n_in_flight != 0)
+        {
+            size_t index;
+            int result;
+            async->writer_waiting = true;
+            pthread_mutex_unlock(&async->mutex);
+            int retval = uring_complete(&async->ring, &index, &result);
+            pthread_mutex_lock(&async->mutex);
+            async->writer_waiting = false;
+            if (retval != 0)
+            {
+                // The ring can no longer be used, so give up on the writes
+                // in flight rather than wait for them forever.
+                while (async->n_started != 0)
+                {
+                    size_t oldest = (async->filling + LOG_ASYNC_BUFFERS
+                                     - async->n_queued)
+                                    % LOG_ASYNC_BUFFERS;
+                    finish(async, oldest, retval);
+                }
+                async->n_in_flight = 0;
+                async->woken = false;
+            }
+            else
+            {
+                handle_completion(async, index, result);
+            }
+        }
+        else
+        {
+            pthread_cond_wait(&async->writer_wakeup, &async->mutex);
+        }
+    }
+    pthread_mutex_unlock(&async->mutex);
+
+    return NULL;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file   log_async.h
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Asynchronous output for the log, used by the LOG_BACKEND_PWRITE
+ *         and LOG_BACKEND_URING backends of log_writer.h.
+ *
+ * Records are formatted straight in to one of a ring of large buffers. When
+ * the buffer being filled is full it is handed to a writer thread and the
+ * next buffer is filled, so the threads formatting records only wait when
+ * every other buffer is still being written. The writer thread either
+ * submits each buffer to io_uring, keeping up to LOG_ASYNC_BUFFERS - 1
+ * writes in flight from buffers registered with the kernel, or writes them
+ * one at a time with pwrite() when io_uring is not wanted or not available.
+ *
+ * A log split in to segments starts a new segment at the start of a buffer.
+ * The writer thread waits for the writes to the old segment to complete and
+ * then asks the owner of the log to replace the file, so writes never go to
+ * the wrong file.
+ */
+
+#ifndef LOG_ASYNC_H
+#define LOG_ASYNC_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/** The number of buffers in the ring. One is being filled while the others
+ * are waiting to be written or being written. */
+#define LOG_ASYNC_BUFFERS 4
+
+/** The size of each buffer. */
+#define LOG_ASYNC_BUFFER_BYTES (256 * 1024)
+
+/** An asynchronous writer, see log_async_open(). */
+struct log_async;
+
+/**
+ * @brief Start writing to the end of a file asynchronously.
+ *
+ * @param[out] async The writer.
+ * @param fd A descriptor for the file opened for writing without O_APPEND.
+ *           It must stay open until log_async_close() returns.
+ * @param use_uring True to write with io_uring if it is available and
+ *                  supports writes, false to always write with pwrite().
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_async_open(struct log_async **async, int fd, bool use_uring);
+
+/**
+ * @brief Write every record, stop the writer thread and free @p async. No
+ *        other thread may use @p async once this is called.
+ *
+ * @param[in] async The writer.
+ *
+ * @return Zero if every record was written, else a POSIX error number for
+ *         the first write that failed.
+ */
+int log_async_close(struct log_async *async);
+
+/**
+ * @brief Append one record formatted as by vprintf(). The record is never
+ *        split between writes of different records.
+ *
+ * @param[in] async The writer.
+ * @param[in] format The format of the record.
+ * @param args The arguments for @p format.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number, which may
+ *         be for an earlier write that failed.
+ */
+int log_async_vprintf(struct log_async *async, const char *format,
+                      va_list args);
+
+/**
+ * @brief Hand the buffer being filled to the writer thread, without waiting
+ *        for it to be written.
+ *
+ * @param[in] async The writer.
+ *
+ * @return Zero if no write has failed, else a POSIX error number for the
+ *         first write that failed.
+ */
+int log_async_flush(struct log_async *async);
+
+/**
+ * @brief Split the log in to segments. Must be called before any records are
+ *        appended.
+ *
+ * @param[in] async The writer.
+ * @param segment_bytes The size at which a new segment is started, zero for
+ *                      no limit. The file already written to counts towards
+ *                      the first segment.
+ * @param period The time after which a new segment is started, zero for no
+ *               limit.
+ * @param[in] start_segment Called by the writer thread to replace the file
+ *                          of the descriptor with an empty one, returning
+ *                          zero if it succeeds, else a POSIX error number.
+ *                          The writes after a failure are dropped.
+ * @param[in] segment_header NULL, or called by the thread whose record
+ *                           starts a new segment to format a header for the
+ *                           segment as by snprintf(), which is written
+ *                           before the record. Only one thread may write if
+ *                           this is used.
+ * @param[in] context Passed to @p start_segment and @p segment_header.
+ */
+void log_async_set_segments(struct log_async *async, uint64_t segment_bytes,
+                            struct timespec period,
+                            int (*start_segment)(void *context),
+                            int (*segment_header)(void *context, char *buffer,
+                                                  size_t size),
+                            void *context);
+
+/**
+ * @brief Check whether the writer is using io_uring.
+ *
+ * @param[in] async The writer.
+ *
+ * @return True if the buffers are written with io_uring, false if they are
+ *         written with pwrite().
+ */
+bool log_async_uses_uring(const struct log_async *async);
+
+#endif /* LOG_ASYNC_H */
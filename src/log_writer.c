@@ -0,0 +1,1052 @@
+/**
+ * @file   log_writer.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Implementation of log_writer.h.
+ */
+
+// Needed for fallocate().
+#define _GNU_SOURCE
+
+#include "log_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The size of the buffer each thread formats a stamped record in before the
+ * stamp is written. Longer records are formatted in memory from malloc(). */
+#define LOG_STAMP_RECORD_BYTES 4096
+
+/** The records a thread has gathered for LOG_BACKEND_WRITEV. */
+struct log_batch
+{
+    /** The writer the records are for, NULL if there are none. */
+    struct log_writer *writer;
+
+    /** One entry for each record, pointing in to data. */
+    struct iovec records[LOG_BATCH_RECORDS];
+
+    /** The number of records. */
+    int n_records;
+
+    /** The formatted records. */
+    char data[LOG_BATCH_BYTES];
+
+    /** The number of bytes of data used. */
+    size_t used;
+};
+
+/** The records gathered by the calling thread. */
+static _Thread_local struct log_batch batch;
+
+/**
+ * @brief Append a record formatted as by vprintf() to the batch of the
+ *        calling thread, writing the batch first if it is full or holds
+ *        records for a different writer.
+ *
+ * @param[in] writer The writer.
+ * @param[in] format The format of the record.
+ * @param args The arguments for @p format.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int batch_vprintf(struct log_writer *writer, const char *format,
+                         va_list args);
+
+/**
+ * @brief Append a record formatted as by vprintf() with the backend of
+ *        @p writer.
+ *
+ * @param[in] writer The writer.
+ * @param[in] format The format of the record.
+ * @param args The arguments for @p format.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int backend_vprintf(struct log_writer *writer, const char *format,
+                           va_list args);
+
+/**
+ * @brief Append a record formatted as by printf() with the backend of
+ *        @p writer.
+ *
+ * @param[in] writer The writer.
+ * @param[in] format The format of the record.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int backend_printf(struct log_writer *writer, const char *format,
+                          ...);
+
+/**
+ * @brief Format a record as by vprintf() and append it to a shard as a single
+ *        record preceded by its stamp.
+ *
+ * @param[in] writer The writer for the shard.
+ * @param[in] format The format of the record.
+ * @param args The arguments for @p format.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int stamped_vprintf(struct log_writer *writer, const char *format,
+                           va_list args);
+
+/**
+ * @brief Write the batch of the calling thread and empty it.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int batch_write(void);
+
+/**
+ * @brief Get the time from CLOCK_MONOTONIC.
+ *
+ * @return The time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void);
+
+/**
+ * @brief Get the descriptor that @p writer writes to.
+ *
+ * @param[in] writer The writer.
+ *
+ * @return The descriptor.
+ */
+static int writer_fd(const struct log_writer *writer);
+
+/**
+ * @brief Check whether the segments of a writer are preallocated. They are
+ *        not if several threads may write with LOG_BACKEND_WRITEV, as
+ *        nothing stops one of them appending while the space is given back.
+ *
+ * @param[in] writer The writer.
+ *
+ * @return True if the segments are preallocated.
+ */
+static bool preallocates(const struct log_writer *writer);
+
+/**
+ * @brief Reserve space for a whole segment in a file without changing its
+ *        size. Does nothing if the file system cannot do this.
+ *
+ * @param[in] writer The writer whose rotation gives the size.
+ * @param fd The descriptor of the file.
+ */
+static void preallocate(const struct log_writer *writer, int fd);
+
+/**
+ * @brief Give back the space reserved by preallocate() beyond the end of a
+ *        file. No other thread may be writing to the file.
+ *
+ * @param[in] writer The writer whose rotation gives the size.
+ * @param fd The descriptor of the file.
+ */
+static void release_preallocation(const struct log_writer *writer, int fd);
+
+/**
+ * @brief Count the old segments of a log, stopping at the first one missing.
+ *
+ * @param[in] path The path of the log.
+ * @param[out] n_segments The number of old segments.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int count_segments(const char *path, unsigned *n_segments);
+
+/**
+ * @brief Delete the old segments of a log, stopping at the first one missing.
+ *
+ * @param[in] path The path of the log.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int remove_segments(const char *path);
+
+/**
+ * @brief Move each old segment of a log up by one, deleting the oldest if
+ *        only some are kept, and rename the current segment to be the first
+ *        old one.
+ *
+ * @param[in] writer The writer.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int shift_segments(struct log_writer *writer);
+
+/**
+ * @brief Write the header of a segment of a shard to the start of a file.
+ *
+ * @param fd The descriptor of the empty file.
+ * @param sequence The sequence number of the first record of the segment.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int write_header(int fd, uint64_t sequence);
+
+/**
+ * @brief Format the header of a new segment of a shard written by
+ *        LOG_BACKEND_PWRITE or LOG_BACKEND_URING, whose first record is the
+ *        next to be stamped.
+ *
+ * @param context The log_writer.
+ * @param[out] buffer The buffer for the header.
+ * @param size The size of @p buffer.
+ *
+ * @return The length of the header, as returned by snprintf().
+ */
+static int segment_header(void *context, char *buffer, size_t size);
+
+/**
+ * @brief Rename the current segment and replace it with an empty file under
+ *        the same descriptor.
+ *
+ * @param context The log_writer.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int start_segment(void *context);
+
+/**
+ * @brief Check whether the current segment of LOG_BACKEND_STDIO or
+ *        LOG_BACKEND_WRITEV is full or old enough to start a new one.
+ *
+ * @param[in] writer The writer.
+ * @param now_ns The time from CLOCK_MONOTONIC in nanoseconds.
+ *
+ * @return True if a new segment is due.
+ */
+static bool segment_due(struct log_writer *writer, uint64_t now_ns);
+
+/**
+ * @brief Count bytes written by LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV
+ *        towards the current segment, starting a new segment if it is full
+ *        or old enough.
+ *
+ * @param[in] writer The writer.
+ * @param n_bytes The number of bytes written.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int count_written(struct log_writer *writer, size_t n_bytes);
+
+/**
+ * @brief writev() all of @p records to @p fd, continuing after a short
+ *        write.
+ *
+ * @param fd The descriptor.
+ * @param[in,out] records The records, changed if a write is short.
+ * @param n_records The number of records.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int write_records(int fd, struct iovec *records, int n_records);
+
+int log_writer_open(struct log_writer *writer, const char *path,
+                    enum log_backend backend)
+{
+    int retval = 0;
+
+    *writer = (struct log_writer){.backend = backend, .fd = -1};
+    writer->path = strdup(path);
+    if (writer->path == NULL)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        switch (backend)
+        {
+        case LOG_BACKEND_STDIO:
+            writer->file = fopen(path, "a");
+            if (writer->file == NULL)
+            {
+                retval = errno;
+            }
+            break;
+        case LOG_BACKEND_WRITEV:
+            writer->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                              0666);
+            if (writer->fd == -1)
+            {
+                retval = errno;
+            }
+            break;
+        case LOG_BACKEND_PWRITE:
+        case LOG_BACKEND_URING:
+            // Writes are made at offsets, which O_APPEND would ignore.
+            writer->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+            if (writer->fd == -1)
+            {
+                retval = errno;
+            }
+            else
+            {
+                retval = log_async_open(&writer->async, writer->fd,
+                                        backend == LOG_BACKEND_URING);
+                if (retval != 0)
+                {
+                    close(writer->fd);
+                }
+            }
+            break;
+        }
+    }
+
+    if (retval != 0)
+    {
+        free(writer->path);
+    }
+
+    return retval;
+}
+
+int log_writer_open_shard(struct log_writer *writer, const char *path,
+                          const char *shard, enum log_backend backend)
+{
+    int retval = 0;
+
+    size_t length = strlen(path) + 1 + strlen(shard);
+    char *shard_path = malloc(length + 1);
+    if (shard_path == NULL)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        snprintf(shard_path, length + 1, "%s.%s", path, shard);
+        retval = remove_segments(shard_path);
+    }
+
+    // Sequence numbers start from zero again, so records left by an earlier
+    // run would look like a restart in the middle of this one.
+    int fd = -1;
+    if (retval == 0)
+    {
+        fd = open(shard_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd == -1)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        retval = write_header(fd, 0);
+    }
+
+    if (fd != -1 && close(fd) != 0 && retval == 0)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0)
+    {
+        retval = log_writer_open(writer, shard_path, backend);
+        writer->stamped = true;
+    }
+
+    free(shard_path);
+
+    return retval;
+}
+
+int log_writer_set_rotation(struct log_writer *writer,
+                            const struct log_rotation *rotation)
+{
+    int retval = 0;
+
+    writer->rotation = *rotation;
+    writer->rotates = rotation->segment_bytes != 0
+                      || rotation->period.tv_sec != 0
+                      || rotation->period.tv_nsec != 0;
+
+    struct stat st;
+    if (writer->rotates && fstat(writer_fd(writer), &st) != 0)
+    {
+        retval = errno;
+    }
+
+    // Only counted once, so that keeping every segment does not look for
+    // the highest on each rotation.
+    if (retval == 0 && writer->rotates && rotation->n_kept == 0)
+    {
+        retval = count_segments(writer->path, &writer->n_old_segments);
+    }
+
+    if (retval == 0 && writer->rotates)
+    {
+        preallocate(writer, writer_fd(writer));
+        switch (writer->backend)
+        {
+        case LOG_BACKEND_STDIO:
+        case LOG_BACKEND_WRITEV:
+            retval = pthread_mutex_init(&writer->rotate_mutex, NULL);
+            atomic_init(&writer->segment_used, (uint64_t)st.st_size);
+            atomic_init(&writer->segment_start_ns, monotonic_ns());
+            atomic_init(&writer->rotate_failed, false);
+            break;
+        case LOG_BACKEND_PWRITE:
+        case LOG_BACKEND_URING:
+            log_async_set_segments(writer->async, rotation->segment_bytes,
+                                   rotation->period, &start_segment,
+                                   writer->stamped ? &segment_header : NULL,
+                                   writer);
+            break;
+        }
+        writer->rotates = (retval == 0);
+    }
+
+    return retval;
+}
+
+int log_writer_close(struct log_writer *writer)
+{
+    int retval = log_writer_flush(writer);
+    int close_retval = 0;
+
+    switch (writer->backend)
+    {
+    case LOG_BACKEND_STDIO:
+        if (writer->rotates)
+        {
+            release_preallocation(writer, writer_fd(writer));
+        }
+        if (fclose(writer->file) != 0)
+        {
+            close_retval = errno;
+        }
+        break;
+    case LOG_BACKEND_WRITEV:
+        if (writer->rotates)
+        {
+            release_preallocation(writer, writer->fd);
+        }
+        if (close(writer->fd) != 0)
+        {
+            close_retval = errno;
+        }
+        break;
+    case LOG_BACKEND_PWRITE:
+    case LOG_BACKEND_URING:
+        close_retval = log_async_close(writer->async);
+        if (writer->rotates)
+        {
+            release_preallocation(writer, writer->fd);
+        }
+        if (close(writer->fd) != 0 && close_retval == 0)
+        {
+            close_retval = errno;
+        }
+        break;
+    }
+
+    if (retval == 0)
+    {
+        retval = close_retval;
+    }
+
+    if (writer->rotates && (writer->backend == LOG_BACKEND_STDIO
+                            || writer->backend == LOG_BACKEND_WRITEV))
+    {
+        pthread_mutex_destroy(&writer->rotate_mutex);
+    }
+    free(writer->path);
+
+    return retval;
+}
+
+int log_writer_printf(struct log_writer *writer, const char *format, ...)
+{
+    int retval = 0;
+
+    va_list args;
+    va_start(args, format);
+    if (writer->stamped)
+    {
+        retval = stamped_vprintf(writer, format, args);
+    }
+    else
+    {
+        retval = backend_vprintf(writer, format, args);
+    }
+    va_end(args);
+
+    return retval;
+}
+
+int log_writer_flush(struct log_writer *writer)
+{
+    int retval = 0;
+
+    switch (writer->backend)
+    {
+    case LOG_BACKEND_STDIO:
+        if (fflush(writer->file) != 0)
+        {
+            retval = errno;
+        }
+        break;
+    case LOG_BACKEND_WRITEV:
+        if (batch.writer == writer)
+        {
+            retval = batch_write();
+        }
+        break;
+    case LOG_BACKEND_PWRITE:
+    case LOG_BACKEND_URING:
+        retval = log_async_flush(writer->async);
+        break;
+    }
+
+    return retval;
+}
+
+static int backend_vprintf(struct log_writer *writer, const char *format,
+                           va_list args)
+{
+    int retval = 0;
+    int length;
+
+    switch (writer->backend)
+    {
+    case LOG_BACKEND_STDIO:
+        length = vfprintf(writer->file, format, args);
+        if (length < 0)
+        {
+            retval = errno;
+        }
+        else
+        {
+            if (writer->stamped)
+            {
+                ++writer->n_stamped_written;
+            }
+            retval = count_written(writer, (size_t)length);
+        }
+        break;
+    case LOG_BACKEND_WRITEV:
+        retval = batch_vprintf(writer, format, args);
+        break;
+    case LOG_BACKEND_PWRITE:
+    case LOG_BACKEND_URING:
+        retval = log_async_vprintf(writer->async, format, args);
+        break;
+    }
+
+    return retval;
+}
+
+static int backend_printf(struct log_writer *writer, const char *format,
+                          ...)
+{
+    va_list args;
+    va_start(args, format);
+    int retval = backend_vprintf(writer, format, args);
+    va_end(args);
+
+    return retval;
+}
+
+static int stamped_vprintf(struct log_writer *writer, const char *format,
+                           va_list args)
+{
+    int retval = 0;
+    static _Thread_local char scratch[LOG_STAMP_RECORD_BYTES];
+
+    // The stamp needs the length of the record, so format it first.
+    char *record = scratch;
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(scratch, sizeof(scratch), format, copy);
+    va_end(copy);
+    if (length < 0)
+    {
+        retval = errno;
+    }
+    else if ((size_t)length >= sizeof(scratch))
+    {
+        record = malloc((size_t)length + 1);
+        if (record == NULL)
+        {
+            retval = errno;
+        }
+        else
+        {
+            va_copy(copy, args);
+            vsnprintf(record, (size_t)length + 1, format, copy);
+            va_end(copy);
+        }
+    }
+
+    if (retval == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000
+                          + (uint64_t)now.tv_nsec;
+        retval = backend_printf(writer, LOG_STAMP_FORMAT "%s", now_ns,
+                                writer->sequence, (size_t)length, record);
+        ++writer->sequence;
+    }
+
+    if (record != scratch)
+    {
+        free(record);
+    }
+
+    return retval;
+}
+
+static int batch_vprintf(struct log_writer *writer, const char *format,
+                         va_list args)
+{
+    int retval = 0;
+
+    if (batch.writer != writer || batch.n_records == LOG_BATCH_RECORDS)
+    {
+        retval = batch_write();
+        batch.writer = writer;
+    }
+
+    size_t space = LOG_BATCH_BYTES - batch.used;
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(batch.data + batch.used, space, format, copy);
+    va_end(copy);
+    if (length < 0)
+    {
+        retval = errno;
+    }
+    else if ((size_t)length >= space && batch.n_records != 0)
+    {
+        // Start a new batch so that the record is not split.
+        retval = batch_write();
+        batch.writer = writer;
+        space = LOG_BATCH_BYTES;
+        va_copy(copy, args);
+        length = vsnprintf(batch.data, space, format, copy);
+        va_end(copy);
+    }
+
+    if (retval == 0 && (size_t)length >= space)
+    {
+        // Too long for any batch, so write it on its own.
+        char *record = malloc((size_t)length + 1);
+        if (record == NULL)
+        {
+            retval = errno;
+        }
+        else
+        {
+            va_copy(copy, args);
+            vsnprintf(record, (size_t)length + 1, format, copy);
+            va_end(copy);
+            struct iovec single = {.iov_base = record,
+                                   .iov_len = (size_t)length};
+            retval = write_records(writer->fd, &single, 1);
+            free(record);
+            if (retval == 0 && writer->stamped)
+            {
+                ++writer->n_stamped_written;
+            }
+            if (retval == 0)
+            {
+                retval = count_written(writer, (size_t)length);
+            }
+        }
+    }
+    else if (retval == 0)
+    {
+        batch.records[batch.n_records++] = (struct iovec){
+            .iov_base = batch.data + batch.used,
+            .iov_len = (size_t)length
+        };
+        batch.used += (size_t)length;
+    }
+
+    return retval;
+}
+
+static int batch_write(void)
+{
+    int retval = 0;
+
+    struct log_writer *writer = batch.writer;
+    size_t n_bytes = batch.used;
+    if (batch.n_records != 0)
+    {
+        retval = write_records(writer->fd, batch.records, batch.n_records);
+    }
+    if (retval == 0 && batch.n_records != 0 && writer->stamped)
+    {
+        writer->n_stamped_written += (uint64_t)batch.n_records;
+    }
+    batch.writer = NULL;
+    batch.n_records = 0;
+    batch.used = 0;
+
+    if (retval == 0 && n_bytes != 0)
+    {
+        retval = count_written(writer, n_bytes);
+    }
+
+    return retval;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static int writer_fd(const struct log_writer *writer)
+{
+    return (writer->backend == LOG_BACKEND_STDIO) ? fileno(writer->file)
+                                                  : writer->fd;
+}
+
+static bool preallocates(const struct log_writer *writer)
+{
+    return writer->rotation.segment_bytes != 0
+           && (writer->backend != LOG_BACKEND_WRITEV || writer->stamped);
+}
+
+static void preallocate(const struct log_writer *writer, int fd)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+    // Keeping the size means appends still start at the end of the data.
+    if (preallocates(writer))
+    {
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0,
+                  (off_t)writer->rotation.segment_bytes);
+    }
+#else
+    (void)writer;
+    (void)fd;
+#endif
+}
+
+static void release_preallocation(const struct log_writer *writer, int fd)
+{
+    // Truncating to the same size frees the blocks past the end, which
+    // punching a hole there does not on every file system.
+    struct stat st;
+    if (preallocates(writer) && fstat(fd, &st) == 0)
+    {
+        ftruncate(fd, st.st_size);
+    }
+}
+
+static int count_segments(const char *path, unsigned *n_segments)
+{
+    int retval = 0;
+
+    size_t length = strlen(path) + 16;
+    char *segment = malloc(length);
+    if (segment == NULL)
+    {
+        retval = errno;
+    }
+
+    *n_segments = 0;
+    bool found = true;
+    while (retval == 0 && found)
+    {
+        struct stat st;
+        snprintf(segment, length, "%s.%u", path, *n_segments + 1);
+        found = (stat(segment, &st) == 0);
+        if (found)
+        {
+            ++*n_segments;
+        }
+        else if (errno != ENOENT)
+        {
+            retval = errno;
+        }
+    }
+
+    free(segment);
+
+    return retval;
+}
+
+static int remove_segments(const char *path)
+{
+    int retval = 0;
+
+    size_t length = strlen(path) + 16;
+    char *segment = malloc(length);
+    if (segment == NULL)
+    {
+        retval = errno;
+    }
+
+    bool removed = true;
+    for (unsigned i = 1; retval == 0 && removed; ++i)
+    {
+        snprintf(segment, length, "%s.%u", path, i);
+        removed = (unlink(segment) == 0);
+        if (!removed && errno != ENOENT)
+        {
+            retval = errno;
+        }
+    }
+
+    free(segment);
+
+    return retval;
+}
+
+static int shift_segments(struct log_writer *writer)
+{
+    int retval = 0;
+
+    size_t length = strlen(writer->path) + 16;
+    char *from = malloc(length);
+    char *to = malloc(length);
+    if (from == NULL || to == NULL)
+    {
+        retval = errno;
+    }
+
+    // The segment which will be moved to the first gap, or deleted.
+    unsigned last = writer->rotation.n_kept;
+    if (last == 0)
+    {
+        last = writer->n_old_segments + 1;
+    }
+    else if (retval == 0)
+    {
+        snprintf(to, length, "%s.%u", writer->path, last);
+        if (unlink(to) != 0 && errno != ENOENT)
+        {
+            retval = errno;
+        }
+    }
+
+    for (unsigned i = last - 1; retval == 0 && i != 0; --i)
+    {
+        snprintf(from, length, "%s.%u", writer->path, i);
+        snprintf(to, length, "%s.%u", writer->path, i + 1);
+        if (rename(from, to) != 0 && errno != ENOENT)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        snprintf(to, length, "%s.1", writer->path);
+        if (rename(writer->path, to) != 0)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0 && writer->n_old_segments < last)
+    {
+        ++writer->n_old_segments;
+    }
+
+    free(to);
+    free(from);
+
+    return retval;
+}
+
+static int start_segment(void *context)
+{
+    struct log_writer *writer = context;
+
+    // Every write to the old segment has been made by now.
+    release_preallocation(writer, writer_fd(writer));
+    int retval = shift_segments(writer);
+
+    // Writes to the stdio and writev backends are appends, the others are
+    // made at offsets from the start of the segment.
+    int fd = -1;
+    if (retval == 0)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        if (writer->backend == LOG_BACKEND_STDIO
+            || writer->backend == LOG_BACKEND_WRITEV)
+        {
+            flags |= O_APPEND;
+        }
+        fd = open(writer->path, flags, 0666);
+        if (fd == -1)
+        {
+            retval = errno;
+        }
+    }
+
+    // The other backends have the header written through log_async, as the
+    // records in their buffers already have offsets in the new segment.
+    if (retval == 0 && writer->stamped
+        && (writer->backend == LOG_BACKEND_STDIO
+            || writer->backend == LOG_BACKEND_WRITEV))
+    {
+        retval = write_header(fd, writer->n_stamped_written);
+    }
+
+    // dup2() swaps the file atomically, so a write in progress finishes in
+    // the old segment and the next one goes to the new.
+    if (retval == 0)
+    {
+        preallocate(writer, fd);
+        if (dup2(fd, writer_fd(writer)) == -1
+            || fcntl(writer_fd(writer), F_SETFD, FD_CLOEXEC) == -1)
+        {
+            retval = errno;
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return retval;
+}
+
+static int write_header(int fd, uint64_t sequence)
+{
+    int retval = 0;
+
+    char header[64];
+    int length = snprintf(header, sizeof(header), LOG_SEGMENT_HEADER_FORMAT,
+                          sequence);
+    ssize_t written = write(fd, header, (size_t)length);
+    if (written == -1)
+    {
+        retval = errno;
+    }
+    else if (written != length)
+    {
+        retval = EIO;
+    }
+
+    return retval;
+}
+
+static int segment_header(void *context, char *buffer, size_t size)
+{
+    const struct log_writer *writer = context;
+    return snprintf(buffer, size, LOG_SEGMENT_HEADER_FORMAT,
+                    writer->sequence);
+}
+
+static bool segment_due(struct log_writer *writer, uint64_t now_ns)
+{
+    uint64_t limit = writer->rotation.segment_bytes;
+    uint64_t period_ns = (uint64_t)writer->rotation.period.tv_sec * 1000000000
+                         + (uint64_t)writer->rotation.period.tv_nsec;
+
+    return (limit != 0 && atomic_load(&writer->segment_used) >= limit)
+           || (period_ns != 0
+               && now_ns - atomic_load(&writer->segment_start_ns)
+                      >= period_ns);
+}
+
+static int count_written(struct log_writer *writer, size_t n_bytes)
+{
+    int retval = 0;
+
+    bool due = false;
+    uint64_t now_ns = 0;
+    if (writer->rotates && !atomic_load(&writer->rotate_failed))
+    {
+        atomic_fetch_add(&writer->segment_used, n_bytes);
+        now_ns = monotonic_ns();
+        due = segment_due(writer, now_ns);
+    }
+
+    // Only one thread starts the segment. Another may have started it since
+    // the check, so check again once the mutex is held.
+    if (due && pthread_mutex_trylock(&writer->rotate_mutex) == 0)
+    {
+        if (segment_due(writer, now_ns)
+            && !atomic_load(&writer->rotate_failed))
+        {
+            // Records buffered by stdio belong to the old segment.
+            if (writer->backend == LOG_BACKEND_STDIO)
+            {
+                flockfile(writer->file);
+                if (fflush(writer->file) != 0)
+                {
+                    retval = errno;
+                }
+            }
+            if (retval == 0)
+            {
+                retval = start_segment(writer);
+            }
+            if (writer->backend == LOG_BACKEND_STDIO)
+            {
+                funlockfile(writer->file);
+            }
+
+            // Trying again on every write would fail every write, so report
+            // the error once and keep writing to the current segment.
+            if (retval == 0)
+            {
+                atomic_store(&writer->segment_used, 0);
+                atomic_store(&writer->segment_start_ns, now_ns);
+            }
+            else
+            {
+                atomic_store(&writer->rotate_failed, true);
+            }
+        }
+        pthread_mutex_unlock(&writer->rotate_mutex);
+    }
+
+    return retval;
+}
+
+static int write_records(int fd, struct iovec *records, int n_records)
+{
+    int retval = 0;
+
+    while (retval == 0 && n_records != 0)
+    {
+        ssize_t written = writev(fd, records, n_records);
+        if (written == -1)
+        {
+            if (errno != EINTR)
+            {
+                retval = errno;
+            }
+            continue;
+        }
+
+        while (n_records != 0 && (size_t)written >= records->iov_len)
+        {
+            written -= (ssize_t)records->iov_len;
+            ++records;
+            --n_records;
+        }
+        if (n_records != 0)
+        {
+            records->iov_base = (char *)records->iov_base + written;
+            records->iov_len -= (size_t)written;
+        }
+    }
+
+    return retval;
+}
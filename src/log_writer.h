@@ -0,0 +1,239 @@
+/**
+ * @file   log_writer.h
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Output for the simulation log with interchangeable backends.
+ *
+ * Every record is passed to the writer whole, so a backend can keep records
+ * from different threads from interleaving. The stdio backend relies on the
+ * lock inside the FILE. The writev backend formats each record in to a buffer
+ * belonging to the calling thread and appends a batch of records with a
+ * single writev() on an O_APPEND descriptor, which the kernel applies as one
+ * append, so no lock is taken in user space. The pwrite and io_uring backends
+ * copy each record in to a shared buffer which a writer thread writes while
+ * the next is filled, see log_async.h.
+ *
+ * A log can also be split in to shards, each written by a single thread so
+ * that threads never contend to log. Every record in a shard is preceded by a
+ * stamp giving the time it was written, and scheduler-logmerge merges the
+ * shards back in to a single log in the order the records were written.
+ *
+ * A log, or a shard, can be split in to segments of limited size or age so
+ * that it does not grow forever. When a segment is full the file is renamed
+ * with ".1" after its path, older segments move up by one and the oldest
+ * beyond the number kept is deleted. An empty file is then put in its place,
+ * preallocated to the size of a segment where possible so that appending to
+ * it does not allocate extents. The space beyond the data is given back when
+ * the segment ends. The new file replaces the old one under the same
+ * descriptor, so no thread has to stop writing while this happens. Each
+ * segment of a shard starts with a header giving the sequence number of its
+ * first record.
+ */
+
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include "log_async.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/** The most records that the writev backend gathers from a thread before
+ * writing them. */
+#define LOG_BATCH_RECORDS 64
+
+/** The size of the buffer in which the writev backend gathers the records of
+ * each thread. */
+#define LOG_BATCH_BYTES 8192
+
+/** The stamp written before each record in a shard. It gives the time the
+ * record was written in nanoseconds from CLOCK_MONOTONIC, the sequence number
+ * of the record, counting from zero at the start of the run, and the length
+ * of the record in bytes. */
+#define LOG_STAMP_FORMAT "@%" PRIu64 " %" PRIu64 " %zu\n"
+
+/** The scanf() format for reading a stamp written with LOG_STAMP_FORMAT. */
+#define LOG_STAMP_SCAN_FORMAT "@%" SCNu64 " %" SCNu64 " %zu"
+
+/** The header at the start of a shard and of each of its segments, giving
+ * the sequence number of the first record after it, so that records lost
+ * from the start of a segment can be told from a segment started part way
+ * through a run. */
+#define LOG_SEGMENT_HEADER_FORMAT "#%" PRIu64 "\n"
+
+/** The scanf() format for reading a header written with
+ * LOG_SEGMENT_HEADER_FORMAT. */
+#define LOG_SEGMENT_HEADER_SCAN_FORMAT "#%" SCNu64
+
+/** The ways that records can be written. */
+enum log_backend
+{
+    /** Records are written with stdio to a FILE opened in append mode. */
+    LOG_BACKEND_STDIO,
+
+    /** Records are gathered by each thread and written in batches with
+     * writev() to a descriptor opened with O_APPEND. A batch is written when
+     * it is full, when the thread writes to a different log_writer and when
+     * the thread calls log_writer_flush(). */
+    LOG_BACKEND_WRITEV,
+
+    /** Records are written by a writer thread with pwrite(), see
+     * log_async.h. */
+    LOG_BACKEND_PWRITE,
+
+    /** Records are written by a writer thread with io_uring, or with pwrite()
+     * if io_uring is not available, see log_async.h. */
+    LOG_BACKEND_URING
+};
+
+/** How a log is split in to segments. A new segment is started when either
+ * limit is reached. */
+struct log_rotation
+{
+    /** The size at which a new segment is started, zero for no limit. */
+    uint64_t segment_bytes;
+
+    /** The time after which a new segment is started, zero for no limit. */
+    struct timespec period;
+
+    /** The number of old segments to keep, zero to keep all of them. */
+    unsigned n_kept;
+};
+
+/** A log file open for appending. */
+struct log_writer
+{
+    /** The backend used. */
+    enum log_backend backend;
+
+    /** The file used by LOG_BACKEND_STDIO. */
+    FILE *file;
+
+    /** The descriptor used by every backend except LOG_BACKEND_STDIO. */
+    int fd;
+
+    /** The writer used by LOG_BACKEND_PWRITE and LOG_BACKEND_URING. */
+    struct log_async *async;
+
+    /** True if the writer is for a shard, so each record is stamped. */
+    bool stamped;
+
+    /** The sequence number of the next record if stamped is true. */
+    uint64_t sequence;
+
+    /** The number of stamped records LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV
+     * have passed to the file, which is the sequence number of the first
+     * record of a new segment. Only used if stamped is true. */
+    uint64_t n_stamped_written;
+
+    /** The path of the file. */
+    char *path;
+
+    /** How the log is split in to segments. */
+    struct log_rotation rotation;
+
+    /** True if rotation has a limit. */
+    bool rotates;
+
+    /** The number of old segments on disk, the highest being path followed
+     * by this number. */
+    unsigned n_old_segments;
+
+    /** Set if LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV failed to start a
+     * segment, after which the current one is written to without limit. */
+    atomic_bool rotate_failed;
+
+    /** Held while LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV start a new
+     * segment. */
+    pthread_mutex_t rotate_mutex;
+
+    /** The bytes written to the current segment by LOG_BACKEND_STDIO or
+     * LOG_BACKEND_WRITEV. */
+    atomic_uint_least64_t segment_used;
+
+    /** The time from CLOCK_MONOTONIC in nanoseconds that the current segment
+     * was started by LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV. */
+    atomic_uint_least64_t segment_start_ns;
+};
+
+/**
+ * @brief Open a file for appending records to, creating it if needed.
+ *
+ * @param[out] writer The writer.
+ * @param[in] path The path of the file.
+ * @param backend The backend to use.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_open(struct log_writer *writer, const char *path,
+                    enum log_backend backend);
+
+/**
+ * @brief Open a shard of a log for appending stamped records to. A shard
+ *        holds the records of a single run, so any shard of the same name,
+ *        and any old segments of it, are removed first. Only one thread may
+ *        write to the shard.
+ *
+ * @param[out] writer The writer.
+ * @param[in] path The path of the log. The shard is @p path followed by a dot
+ *                 and @p shard.
+ * @param[in] shard The name of the shard.
+ * @param backend The backend to use.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_open_shard(struct log_writer *writer, const char *path,
+                          const char *shard, enum log_backend backend);
+
+/**
+ * @brief Split a log in to segments. Must be called before any records are
+ *        appended. The file already written counts towards the size of the
+ *        first segment. If a new segment cannot be started by
+ *        LOG_BACKEND_STDIO or LOG_BACKEND_WRITEV, the error is returned by
+ *        the write which found it and the current segment grows from then
+ *        on. The other backends drop the writes after such an error.
+ *
+ * @param[in] writer The writer.
+ * @param[in] rotation How to split the log.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_set_rotation(struct log_writer *writer,
+                            const struct log_rotation *rotation);
+
+/**
+ * @brief Write the records of the calling thread and close the file. Every
+ *        other thread must have called log_writer_flush() first.
+ *
+ * @param[in] writer The writer.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_close(struct log_writer *writer);
+
+/**
+ * @brief Append one record, formatted as by printf().
+ *
+ * @param[in] writer The writer.
+ * @param[in] format The format of the record.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_printf(struct log_writer *writer, const char *format, ...);
+
+/**
+ * @brief Write any records the calling thread has gathered for @p writer.
+ *        Each thread must call this before it exits.
+ *
+ * @param[in] writer The writer.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int log_writer_flush(struct log_writer *writer);
+
+#endif /* LOG_WRITER_H */
@@ -0,0 +1,302 @@
+/**
+ * @file   logmerge.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Merges the shards of a simulation log written with LOG_SHARDS in to
+ *         a single log.
+ *
+ * The records in each shard are in the order they were written, so the
+ * shards are merged with a binary min-heap holding the next record of each
+ * shard, ordered by the time in its stamp. Records written at the same time
+ * are taken in the order the shards were given. The records are written to
+ * standard output without their stamps, in the same format as a log written
+ * without LOG_SHARDS.
+ *
+ * A shard holds a single run, so any gap in its sequence numbers, including
+ * a restart from zero, means records were lost and the merge fails. Each
+ * shard, or segment of one, starts with a header giving the sequence number
+ * of its first record, so records lost from the start are caught too.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "error.h"
+#include "log_writer.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** The size of the buffer records are copied through. */
+#define LOGMERGE_COPY_BYTES 65536
+
+/** A shard being merged. */
+struct shard
+{
+    /** The file of the shard. */
+    FILE *file;
+
+    /** The position of the shard in the arguments, used to order records
+     * written at the same time. */
+    size_t index;
+
+    /** The time the next record was written. */
+    uint64_t time_ns;
+
+    /** The sequence number expected of the next record. */
+    uint64_t sequence;
+
+    /** The length of the next record. */
+    size_t length;
+};
+
+/**
+ * @brief Read the header at the start of a shard.
+ *
+ * @param[in,out] shard The shard.
+ * @param[out] more False if the shard is empty.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int read_header(struct shard *shard, bool *more);
+
+/**
+ * @brief Read the stamp of the next record in a shard.
+ *
+ * @param[in,out] shard The shard.
+ * @param[out] more False if the shard has no more records.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int read_stamp(struct shard *shard, bool *more);
+
+/**
+ * @brief Copy the next record in a shard, whose stamp has been read, to
+ *        @p out.
+ *
+ * @param[in] shard The shard.
+ * @param[in] out The file to copy to.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int copy_record(struct shard *shard, FILE *out);
+
+/**
+ * @brief Check whether the next record of one shard goes before the next
+ *        record of another.
+ *
+ * @param[in] a The first shard.
+ * @param[in] b The second shard.
+ *
+ * @return True if the record of @p a goes first.
+ */
+static bool shard_before(const struct shard *a, const struct shard *b);
+
+/**
+ * @brief Restore the heap property below @p i in a min-heap of shards.
+ *
+ * @param[in,out] heap The heap.
+ * @param n_shards The number of shards in the heap.
+ * @param i The index of the shard which may be out of place.
+ */
+static void sift_down(struct shard **heap, size_t n_shards, size_t i);
+
+int main(int argc, char **argv)
+{
+    int retval = 0;
+    size_t n_shards = (argc > 1) ? (size_t)argc - 1 : 0;
+    struct shard *shards = NULL;
+    struct shard **heap = NULL;
+    size_t n_heap = 0;
+
+    if (argc < 2)
+    {
+        retval = AE_WRONG_NUM_ARGS;
+    }
+
+    if (retval == 0)
+    {
+        shards = calloc(n_shards, sizeof(*shards));
+        heap = malloc(sizeof(*heap) * n_shards);
+        if (shards == NULL || heap == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    for (size_t i = 0; retval == 0 && i < n_shards; ++i)
+    {
+        shards[i].index = i;
+        shards[i].file = fopen(argv[i + 1], "r");
+        if (shards[i].file == NULL)
+        {
+            retval = errno;
+        }
+
+        bool more = false;
+        if (retval == 0)
+        {
+            retval = read_header(&shards[i], &more);
+        }
+        if (retval == 0 && more)
+        {
+            retval = read_stamp(&shards[i], &more);
+        }
+        if (retval == 0 && more)
+        {
+            heap[n_heap++] = &shards[i];
+        }
+    }
+
+    for (size_t i = n_heap / 2; retval == 0 && i-- != 0;)
+    {
+        sift_down(heap, n_heap, i);
+    }
+
+    while (retval == 0 && n_heap != 0)
+    {
+        retval = copy_record(heap[0], stdout);
+
+        bool more = false;
+        if (retval == 0)
+        {
+            retval = read_stamp(heap[0], &more);
+        }
+        if (retval == 0)
+        {
+            if (!more)
+            {
+                heap[0] = heap[--n_heap];
+            }
+            sift_down(heap, n_heap, 0);
+        }
+    }
+
+    if (retval == 0 && fflush(stdout) != 0)
+    {
+        retval = errno;
+    }
+
+    if (retval != 0)
+    {
+        fprintf(stderr, "%s\nUsage: %s [shard]...\n",
+                errno_or_ae_to_str(retval), argv[0]);
+    }
+
+    for (size_t i = 0; shards != NULL && i < n_shards; ++i)
+    {
+        if (shards[i].file != NULL)
+        {
+            fclose(shards[i].file);
+        }
+    }
+    free(heap);
+    free(shards);
+
+    return retval;
+}
+
+static int read_header(struct shard *shard, bool *more)
+{
+    int retval = 0;
+
+    int n_read = fscanf(shard->file, LOG_SEGMENT_HEADER_SCAN_FORMAT,
+                        &shard->sequence);
+    *more = (n_read != EOF);
+    if (n_read == EOF && ferror(shard->file))
+    {
+        retval = errno;
+    }
+    else if (*more && (n_read != 1 || fgetc(shard->file) != '\n'))
+    {
+        retval = AE_BAD_FILE;
+    }
+
+    return retval;
+}
+
+static int read_stamp(struct shard *shard, bool *more)
+{
+    int retval = 0;
+
+    uint64_t sequence;
+    int n_read = fscanf(shard->file, LOG_STAMP_SCAN_FORMAT, &shard->time_ns,
+                        &sequence, &shard->length);
+    *more = (n_read != EOF);
+    if (n_read == EOF && ferror(shard->file))
+    {
+        retval = errno;
+    }
+    else if (*more && (n_read != 3 || fgetc(shard->file) != '\n'))
+    {
+        retval = AE_BAD_FILE;
+    }
+    else if (*more && sequence != shard->sequence)
+    {
+        retval = AE_LOST_RECORDS;
+    }
+
+    if (retval == 0 && *more)
+    {
+        shard->sequence = sequence + 1;
+    }
+
+    return retval;
+}
+
+static int copy_record(struct shard *shard, FILE *out)
+{
+    int retval = 0;
+    char buffer[LOGMERGE_COPY_BYTES];
+
+    size_t remaining = shard->length;
+    while (retval == 0 && remaining != 0)
+    {
+        size_t n_bytes = (remaining < sizeof(buffer)) ? remaining
+                                                      : sizeof(buffer);
+        if (fread(buffer, 1, n_bytes, shard->file) != n_bytes)
+        {
+            retval = ferror(shard->file) ? errno : AE_BAD_FILE;
+        }
+        else if (fwrite(buffer, 1, n_bytes, out) != n_bytes)
+        {
+            retval = errno;
+        }
+        remaining -= n_bytes;
+    }
+
+    return retval;
+}
+
+static bool shard_before(const struct shard *a, const struct shard *b)
+{
+    return a->time_ns < b->time_ns
+           || (a->time_ns == b->time_ns && a->index < b->index);
+}
+
+static void sift_down(struct shard **heap, size_t n_shards, size_t i)
+{
+    while (2 * i + 1 < n_shards)
+    {
+        size_t child = 2 * i + 1;
+        if (child + 1 < n_shards && shard_before(heap[child + 1], heap[child]))
+        {
+            ++child;
+        }
+        if (!shard_before(heap[child], heap[i]))
+        {
+            break;
+        }
+
+        struct shard *tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
@@ -11,9 +11,11 @@
 #include "cpu.h"
 #include "task.h"
 #include "error.h"
-#include "tsqueue.h"
+#include "ready_queue.h"
 #include "job.h"
 #include "log.h"
+#include "lock.h"
+#include "io.h"
 #include <errno.h>
 #include <stdint.h>
 #include <pthread.h>
@@ -21,6 +23,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <time.h>
 
 /**
  * @brief Returns errno if @p ptr is NULL, else returns 0. Used to make main()
@@ -32,6 +35,23 @@
  */
 static int errno_if_null(void *ptr);
 
+/**
+ * @brief Returns the priority of a job, used by the ready-queue.
+ *
+ * @param[in] job The job_struct to get the priority of.
+ *
+ * @return The priority of @p job.
+ */
+static unsigned job_priority(const void *job);
+
+/**
+ * @brief Check the values in config.h which can not be checked when
+ *        compiling.
+ *
+ * @return Zero if they are valid, else AE_BAD_CONFIG.
+ */
+static int check_config(void);
+
 int main(int argc, char **argv)
 {
     // This function is very long but most of it is just braces and
@@ -39,23 +59,48 @@ int main(int argc, char **argv)
 
     int retval = 0;
 
-    FILE *log_file = NULL;
-    FILE *input_file = NULL;
+    struct log_writer log_file;
+    bool log_file_is_open = false;
+    struct log_writer *shard_files = NULL;
+    size_t n_shards_open = 0;
+    const struct log_rotation log_rotation = {
+        .segment_bytes = LOG_SEGMENT_BYTES,
+        .period = LOG_SEGMENT_PERIOD,
+        .n_kept = LOG_SEGMENTS_KEPT
+    };
+    FILE **input_files = NULL;
     pthread_t *cpu_threads = NULL;
-    pthread_t task_thread;
+    pthread_t *task_threads = NULL;
     struct cpu_params *cpu_params = NULL;
     struct cpu_shared_stats stats = {0};
-    struct task_params task_params = {0};
+    struct cpu_lookahead lookahead = {0};
+    bool lookahead_is_initialised = false;
+    struct cpu_speculation speculation;
+    bool speculation_is_initialised = false;
+    struct io_wait io_wait;
+    bool io_wait_is_initialised = false;
+    pthread_t io_thread;
+    struct io_params io_params = {0};
+    struct task_params *task_params = NULL;
+    struct lock producer_lock;
+    bool producer_lock_is_initialised = false;
     struct job_struct *queue_data = NULL;
-    tsqueue *queue = NULL;
+    struct ready_queue queue = {0};
     bool shared_is_initialised = false;
     size_t queue_length = 0;
+    // Every argument but the first and last is a job file.
+    size_t n_sources = (argc > 2) ? (size_t)argc - 2 : 0;
 
-    if (argc != 3)
+    if (argc < 3)
     {
         retval = AE_WRONG_NUM_ARGS;
     }
 
+    if (retval == 0)
+    {
+        retval = check_config();
+    }
+
     /*****************************************************/
     /* BEGINNING OF PARSING AND RESOURCE ALLOCATION CODE */
     /*****************************************************/
@@ -64,7 +109,7 @@ int main(int argc, char **argv)
     {
         char *end;
         errno = 0;
-        uintmax_t tmp = strtoumax(argv[2], &end, 10);
+        uintmax_t tmp = strtoumax(argv[argc - 1], &end, 10);
         if (errno)
         {
             retval = errno;
@@ -81,21 +126,89 @@ int main(int argc, char **argv)
 
     if (retval == 0)
     {
-        retval = pthread_mutex_init(&stats.lock, NULL);
+        retval = lock_init(&stats.lock, STATS_LOCK);
         if (retval == 0)
         {
             shared_is_initialised = true;
         }
     }
 
+    if (retval == 0
+        && (LOOKAHEAD_HORIZON.tv_sec != 0 || LOOKAHEAD_HORIZON.tv_nsec != 0
+            || AFFINITY_DISPATCH))
+    {
+        lookahead.n_cpus = CPU_COUNT;
+        retval = errno_if_null(lookahead.reservations =
+                                   calloc(CPU_COUNT,
+                                          sizeof(*lookahead.reservations)));
+        if (retval == 0)
+        {
+            retval = lock_init(&lookahead.lock, LOOKAHEAD_LOCK);
+        }
+        if (retval == 0)
+        {
+            lookahead_is_initialised = true;
+        }
+    }
+
+    if (retval == 0 && SPECULATION_FACTOR != 0)
+    {
+        retval = cpu_speculation_init(&speculation, CPU_COUNT);
+        if (retval == 0)
+        {
+            speculation_is_initialised = true;
+        }
+    }
+
     if (retval == 0)
     {
-        retval = errno_if_null(log_file = fopen(LOG_FILE_PATH, "a"));
+        if (LOG_SHARDS)
+        {
+            retval = log_writer_open_shard(&log_file, LOG_FILE_PATH, "main",
+                                           LOG_BACKEND);
+        }
+        else
+        {
+            retval = log_writer_open(&log_file, LOG_FILE_PATH, LOG_BACKEND);
+        }
+        log_file_is_open = (retval == 0);
+    }
+
+    if (retval == 0)
+    {
+        retval = log_writer_set_rotation(&log_file, &log_rotation);
     }
 
     if (retval == 0)
     {
-        retval = errno_if_null(input_file = fopen(argv[1], "r"));
+        retval = lock_init(&producer_lock, LOCK_MUTEX);
+        if (retval == 0)
+        {
+            producer_lock_is_initialised = true;
+        }
+    }
+
+    if (retval == 0)
+    {
+        retval = errno_if_null(input_files = calloc(n_sources,
+                                                    sizeof(*input_files)));
+    }
+
+    for (size_t i = 0; retval == 0 && i < n_sources; ++i)
+    {
+        retval = errno_if_null(input_files[i] = fopen(argv[i + 1], "r"));
+    }
+
+    if (retval == 0)
+    {
+        retval = errno_if_null(task_threads =
+                                   malloc(sizeof(*task_threads) * n_sources));
+    }
+
+    if (retval == 0)
+    {
+        retval = errno_if_null(task_params = calloc(n_sources,
+                                                    sizeof(*task_params)));
     }
 
     if (retval == 0)
@@ -110,6 +223,36 @@ int main(int argc, char **argv)
             errno_if_null(cpu_params = malloc(sizeof(*cpu_params) * CPU_COUNT));
     }
 
+    // One shard for each cpu thread followed by one for each task thread.
+    if (retval == 0 && LOG_SHARDS)
+    {
+        retval = errno_if_null(shard_files = malloc(sizeof(*shard_files)
+                                                    * (CPU_COUNT
+                                                       + n_sources)));
+    }
+
+    while (retval == 0 && LOG_SHARDS && n_shards_open < CPU_COUNT + n_sources)
+    {
+        char shard[32];
+        if (n_shards_open < CPU_COUNT)
+        {
+            snprintf(shard, sizeof(shard), "cpu-%zu", n_shards_open + 1);
+        }
+        else
+        {
+            snprintf(shard, sizeof(shard), "task-%zu",
+                     n_shards_open - CPU_COUNT + 1);
+        }
+        retval = log_writer_open_shard(&shard_files[n_shards_open],
+                                       LOG_FILE_PATH, shard, LOG_BACKEND);
+        if (retval == 0)
+        {
+            ++n_shards_open;
+            retval = log_writer_set_rotation(&shard_files[n_shards_open - 1],
+                                             &log_rotation);
+        }
+    }
+
     if (retval == 0)
     {
         retval =
@@ -118,8 +261,62 @@ int main(int argc, char **argv)
 
     if (retval == 0)
     {
-        retval = tsqueue_create(&queue, queue_data, queue_length,
-                                sizeof(*queue_data), 0);
+        switch (READY_QUEUE_TYPE)
+        {
+        case READY_QUEUE_FIFO:
+            retval = job_queue_create(&queue.fifo, queue_data, queue_length,
+                                      0, READY_QUEUE_LOCK);
+            break;
+        case READY_QUEUE_PRIORITY:
+            retval = tsqueue_create_prio(&queue.generic, queue_data,
+                                         queue_length, sizeof(*queue_data), 0,
+                                         PRIORITY_LEVELS, &job_priority,
+                                         PRIORITY_AGING_INTERVAL,
+                                         READY_QUEUE_LOCK);
+            break;
+        case READY_QUEUE_RELAXED:
+            retval = tsqueue_create_relaxed(&queue.generic, queue_data,
+                                            queue_length,
+                                            sizeof(*queue_data), 0,
+                                            (size_t)CPU_COUNT
+                                            * RELAXED_SUBQUEUES_PER_CPU,
+                                            READY_QUEUE_LOCK);
+            break;
+        case READY_QUEUE_COMBINING:
+            // One record for each cpu thread, each task thread and the io
+            // thread.
+            retval = tsqueue_create_combining(&queue.generic, queue_data,
+                                              queue_length,
+                                              sizeof(*queue_data), 0,
+                                              (size_t)CPU_COUNT + n_sources
+                                              + 1,
+                                              READY_QUEUE_LOCK);
+            break;
+        case READY_QUEUE_SHARED:
+            retval = tsqueue_create_shared(&queue.generic, SHARED_QUEUE_NAME,
+                                           queue_length,
+                                           sizeof(*queue_data));
+            if (retval == EEXIST)
+            {
+                retval = AE_QUEUE_IN_USE;
+            }
+            break;
+        }
+    }
+
+    if (retval == 0)
+    {
+        ready_queue_set_wake_order(&queue, READY_QUEUE_WAKE_ORDER);
+    }
+
+    if (retval == 0)
+    {
+        retval = io_wait_init(&io_wait, &queue, &producer_lock);
+        if (retval == 0)
+        {
+            io_wait_is_initialised = true;
+            io_params.wait = &io_wait;
+        }
     }
 
     if (retval == 0)
@@ -128,21 +325,32 @@ int main(int argc, char **argv)
         {
             cpu_params[i] = (struct cpu_params){
                 .stats = &stats,
-                .queue = queue,
+                .lookahead = lookahead_is_initialised ? &lookahead : NULL,
+                .speculation =
+                    speculation_is_initialised ? &speculation : NULL,
+                .io = &io_wait,
+                .queue = &queue,
                 .id = i + 1,
-                .log_file = log_file
+                .log_file = LOG_SHARDS ? &shard_files[i] : &log_file
             };
         }
 
-        task_params = (struct task_params){
-            .queue = queue,
-            .job_file = input_file,
-            .job_buffer_length = TASK_JOB_BUFFER_LENGTH,
-            .log_file = log_file
-        };
-        retval = errno_if_null(task_params.job_buffer =
-                                   malloc(sizeof(*task_params.job_buffer)
-                                          * task_params.job_buffer_length));
+        for (size_t i = 0; retval == 0 && i < n_sources; ++i)
+        {
+            task_params[i] = (struct task_params){
+                .queue = &queue,
+                .job_file = input_files[i],
+                .source = (unsigned)i + 1,
+                .producer_lock = &producer_lock,
+                .io = &io_wait,
+                .job_buffer_length = TASK_JOB_BUFFER_LENGTH,
+                .log_file = LOG_SHARDS ? &shard_files[CPU_COUNT + i]
+                                       : &log_file
+            };
+            retval = errno_if_null(task_params[i].job_buffer =
+                                       malloc(sizeof(*task_params[i].job_buffer)
+                                              * task_params[i].job_buffer_length));
+        }
     }
 
     /******************************************/
@@ -151,26 +359,51 @@ int main(int argc, char **argv)
 
     if (retval == 0)
     {
-        retval = pthread_create(&task_thread, NULL, &task, &task_params);
-    }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        size_t n_tasks = 0;
+        while (retval == 0 && n_tasks < n_sources)
+        {
+            retval = pthread_create(&task_threads[n_tasks], NULL, &task,
+                                    &task_params[n_tasks]);
+            if (retval == 0)
+            {
+                ++n_tasks;
+            }
+        }
 
-    if (retval == 0)
-    {
         size_t i = 0;
         while (retval == 0 && i < CPU_COUNT)
         {
             retval =
                 pthread_create(&cpu_threads[i], NULL, &cpu, &cpu_params[i]);
-            ++i;
+            if (retval == 0)
+            {
+                ++i;
+            }
+        }
+
+        bool io_started = false;
+        if (retval == 0)
+        {
+            retval = pthread_create(&io_thread, NULL, &io, &io_params);
+            io_started = (retval == 0);
         }
 
         if (retval != 0)
         {
-            tsqueue_close(queue);
-            --i;
+            ready_queue_close(&queue);
         }
 
-        pthread_join(task_thread, NULL);
+        for (size_t j = 0; j < n_tasks; ++j)
+        {
+            pthread_join(task_threads[j], NULL);
+        }
+        // The cpu threads finish once the queue is empty, every task()
+        // thread has finished and no job has I/O bursts left.
+        io_producers_done(&io_wait);
+
         for (size_t j = 0; j < i; ++j)
         {
             pthread_join(cpu_threads[j], NULL);
@@ -180,16 +413,68 @@ int main(int argc, char **argv)
             }
         }
 
-        if (retval == 0)
+        io_wait_close(&io_wait);
+        if (io_started)
+        {
+            pthread_join(io_thread, NULL);
+            if (retval == 0)
+            {
+                retval = io_params.retval;
+            }
+        }
+
+        for (size_t j = 0; j < n_tasks && retval == 0; ++j)
         {
-            retval = task_params.retval;
+            retval = task_params[j].retval;
         }
 
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stats.run_ns = (long long)(end.tv_sec - start.tv_sec) * 1000000000
+                       + (end.tv_nsec - start.tv_nsec);
+    }
+
+    for (size_t i = 0; retval == 0 && i < n_sources; ++i)
+    {
+        struct timespec elapsed = {
+            .tv_sec = task_params[i].last_arrival.tv_sec
+                      - task_params[i].start.tv_sec,
+            .tv_nsec = task_params[i].last_arrival.tv_nsec
+                       - task_params[i].start.tv_nsec
+        };
+        if (elapsed.tv_nsec < 0)
+        {
+            --elapsed.tv_sec;
+            elapsed.tv_nsec += 1000000000;
+        }
+        retval = log_source_done(&log_file, (unsigned)i + 1, argv[i + 1],
+                                 task_params[i].n_jobs, elapsed);
     }
 
     if (retval == 0)
     {
-        retval = log_main_done(log_file, &stats);
+        retval = log_main_done(&log_file, &stats);
+    }
+
+    // Closed before the teardown code so that a failure to write the last
+    // records is reported.
+    if (log_file_is_open)
+    {
+        log_file_is_open = false;
+        int close_retval = log_writer_close(&log_file);
+        if (retval == 0)
+        {
+            retval = close_retval;
+        }
+    }
+
+    while (n_shards_open != 0)
+    {
+        int close_retval = log_writer_close(&shard_files[--n_shards_open]);
+        if (retval == 0)
+        {
+            retval = close_retval;
+        }
     }
 
     /******************************/
@@ -198,31 +483,59 @@ int main(int argc, char **argv)
 
     if (retval != 0)
     {
-        fprintf(stderr, "%s\nUsage: %s [job file] [queue size]\n",
+        fprintf(stderr, "%s\nUsage: %s [job file]... [queue size]\n",
                 errno_or_ae_to_str(retval), argv[0]);
     }
 
-    if (queue != NULL)
+    if (io_wait_is_initialised)
     {
-        tsqueue_destroy(queue, NULL);
+        io_wait_destroy(&io_wait);
     }
 
-    if (input_file != NULL)
+    ready_queue_destroy(&queue);
+
+    for (size_t i = 0; input_files != NULL && i < n_sources; ++i)
     {
-        fclose(input_file);
+        if (input_files[i] != NULL)
+        {
+            fclose(input_files[i]);
+        }
     }
 
-    if (log_file != NULL)
+    if (log_file_is_open)
     {
-        fclose(log_file);
+        log_writer_close(&log_file);
     }
 
     if (shared_is_initialised)
     {
-        pthread_mutex_destroy(&stats.lock);
+        lock_destroy(&stats.lock);
     }
 
-    free(task_params.job_buffer);
+    if (producer_lock_is_initialised)
+    {
+        lock_destroy(&producer_lock);
+    }
+
+    if (lookahead_is_initialised)
+    {
+        lock_destroy(&lookahead.lock);
+    }
+
+    free(lookahead.reservations);
+
+    if (speculation_is_initialised)
+    {
+        cpu_speculation_destroy(&speculation);
+    }
+    for (size_t i = 0; task_params != NULL && i < n_sources; ++i)
+    {
+        free(task_params[i].job_buffer);
+    }
+    free(task_params);
+    free(task_threads);
+    free(input_files);
+    free(shard_files);
     free(cpu_params);
     free(cpu_threads);
     free(queue_data);
@@ -238,3 +551,41 @@ static int errno_if_null(void *ptr)
 {
     return (ptr == NULL) ? errno : 0;
 }
+
+static unsigned job_priority(const void *job)
+{
+    return ((const struct job_struct *)job)->priority;
+}
+
+static int check_config(void)
+{
+    int retval = 0;
+
+    // Noise taking all of a cpu's time would delay a job for ever. The
+    // tenant may share a cpu with the other kinds of noise.
+    double noise_share = NOISE_BURST_RATE
+                         * (NOISE_BURST_MEAN.tv_sec
+                            + NOISE_BURST_MEAN.tv_nsec / 1e9);
+    if (NOISE_TICK_PERIOD.tv_sec != 0 || NOISE_TICK_PERIOD.tv_nsec != 0)
+    {
+        noise_share += (NOISE_TICK_COST.tv_sec + NOISE_TICK_COST.tv_nsec / 1e9)
+                       / (NOISE_TICK_PERIOD.tv_sec
+                          + NOISE_TICK_PERIOD.tv_nsec / 1e9);
+    }
+    if (NOISE_TENANT_CPUS != 0)
+    {
+        noise_share += NOISE_TENANT_SHARE;
+    }
+    if (noise_share >= 1)
+    {
+        retval = AE_BAD_CONFIG;
+    }
+
+    // Sampling divides job ids by the period.
+    if (LOG_LEVEL == LOG_LEVEL_SAMPLED && LOG_SAMPLE_PERIOD == 0)
+    {
+        retval = AE_BAD_CONFIG;
+    }
+
+    return retval;
+}
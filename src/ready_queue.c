@@ -0,0 +1,101 @@
+/**
+ * @file   ready_queue.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Implementation of ready_queue.h.
+ */
+
+#include "ready_queue.h"
+
+void ready_queue_close(struct ready_queue *queue)
+{
+    if (queue->fifo != NULL)
+    {
+        job_queue_close(queue->fifo);
+    }
+    else
+    {
+        tsqueue_close(queue->generic);
+    }
+}
+
+void ready_queue_destroy(struct ready_queue *queue)
+{
+    if (queue->fifo != NULL)
+    {
+        job_queue_destroy(queue->fifo, NULL);
+    }
+    else if (queue->generic != NULL)
+    {
+        tsqueue_destroy(queue->generic, NULL);
+    }
+    queue->fifo = NULL;
+    queue->generic = NULL;
+}
+
+size_t ready_queue_capacity(struct ready_queue *queue)
+{
+    return (queue->fifo != NULL) ? job_queue_capacity(queue->fifo)
+                                 : tsqueue_capacity(queue->generic);
+}
+
+bool ready_queue_has_space(struct ready_queue *queue, size_t n_jobs)
+{
+    return (queue->fifo != NULL) ? job_queue_has_space(queue->fifo, n_jobs)
+                                 : tsqueue_has_space(queue->generic, n_jobs);
+}
+
+int ready_queue_wait_for_space(struct ready_queue *queue, size_t n_jobs)
+{
+    return (queue->fifo != NULL)
+               ? job_queue_wait_for_space(queue->fifo, n_jobs)
+               : tsqueue_wait_for_space(queue->generic, n_jobs);
+}
+
+int ready_queue_put(struct ready_queue *queue, size_t n_jobs,
+                    struct job_struct *in)
+{
+    return (queue->fifo != NULL) ? job_queue_put(queue->fifo, n_jobs, in)
+                                 : tsqueue_put(queue->generic, n_jobs, in);
+}
+
+int ready_queue_pop(struct ready_queue *queue, size_t *n_jobs,
+                    struct job_struct *out)
+{
+    return (queue->fifo != NULL) ? job_queue_pop(queue->fifo, n_jobs, out)
+                                 : tsqueue_pop(queue->generic, n_jobs, out);
+}
+
+int ready_queue_try_pop(struct ready_queue *queue, size_t *n_jobs,
+                        struct job_struct *out)
+{
+    return (queue->fifo != NULL)
+               ? job_queue_try_pop(queue->fifo, n_jobs, out)
+               : tsqueue_try_pop(queue->generic, n_jobs, out);
+}
+
+void ready_queue_set_wake_order(struct ready_queue *queue,
+                                enum tsqueue_wake_order order)
+{
+    if (queue->fifo != NULL)
+    {
+        job_queue_set_wake_order(queue->fifo, order);
+    }
+    else
+    {
+        tsqueue_set_wake_order(queue->generic, order);
+    }
+}
+
+void ready_queue_set_done(struct ready_queue *queue, bool done)
+{
+    if (queue->fifo != NULL)
+    {
+        job_queue_set_done(queue->fifo, done);
+    }
+    else
+    {
+        tsqueue_set_done(queue->generic, done);
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ * @file   ready_queue.h
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  The queue of jobs waiting for a cpu.
+ *
+ * With READY_QUEUE_FIFO the jobs are held in a job_queue generated by
+ * TSQUEUE_DEFINE(), which moves them by assignment rather than through the
+ * element size of a generic tsqueue. The other types of ready-queue use a
+ * tsqueue. Each function behaves like the tsqueue function of the same name
+ * on whichever queue is used.
+ */
+
+#ifndef READY_QUEUE_H
+#define READY_QUEUE_H
+
+#include "tsqueue.h"
+#include "tsqueue_typed.h"
+#include "job.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A FIFO queue of jobs, see tsqueue_typed.h. */
+TSQUEUE_DEFINE(job_queue, struct job_struct)
+
+/** The ready-queue. Exactly one of the queues is set. */
+struct ready_queue
+{
+    /** The typed queue used by READY_QUEUE_FIFO, or NULL. */
+    job_queue *fifo;
+
+    /** The generic queue used by the other types, or NULL. */
+    tsqueue *generic;
+};
+
+/**
+ * @brief See tsqueue_close().
+ *
+ * @param[in] queue The ready-queue.
+ */
+void ready_queue_close(struct ready_queue *queue);
+
+/**
+ * @brief See tsqueue_destroy(), does nothing if neither queue is set.
+ *
+ * @param[in] queue The ready-queue, whose queues are set to NULL.
+ */
+void ready_queue_destroy(struct ready_queue *queue);
+
+/**
+ * @brief See tsqueue_capacity().
+ *
+ * @param[in] queue The ready-queue.
+ *
+ * @return The number of jobs the queue can hold.
+ */
+size_t ready_queue_capacity(struct ready_queue *queue);
+
+/**
+ * @brief See tsqueue_has_space().
+ *
+ * @param[in] queue The ready-queue.
+ * @param n_jobs The number of jobs.
+ *
+ * @return True if @p n_jobs jobs would fit.
+ */
+bool ready_queue_has_space(struct ready_queue *queue, size_t n_jobs);
+
+/**
+ * @brief See tsqueue_wait_for_space().
+ *
+ * @param[in] queue The ready-queue.
+ * @param n_jobs The number of jobs.
+ *
+ * @return See tsqueue_wait_for_space().
+ */
+int ready_queue_wait_for_space(struct ready_queue *queue, size_t n_jobs);
+
+/**
+ * @brief See tsqueue_put().
+ *
+ * @param[in] queue The ready-queue.
+ * @param n_jobs The number of jobs in @p in.
+ * @param[in] in The jobs.
+ *
+ * @return See tsqueue_put().
+ */
+int ready_queue_put(struct ready_queue *queue, size_t n_jobs,
+                    struct job_struct *in);
+
+/**
+ * @brief See tsqueue_pop().
+ *
+ * @param[in] queue The ready-queue.
+ * @param[in,out] n_jobs The number of jobs wanted, set to the number taken.
+ * @param[out] out The jobs.
+ *
+ * @return See tsqueue_pop().
+ */
+int ready_queue_pop(struct ready_queue *queue, size_t *n_jobs,
+                    struct job_struct *out);
+
+/**
+ * @brief See tsqueue_try_pop().
+ *
+ * @param[in] queue The ready-queue.
+ * @param[in,out] n_jobs The number of jobs wanted, set to the number taken.
+ * @param[out] out The jobs.
+ *
+ * @return See tsqueue_try_pop().
+ */
+int ready_queue_try_pop(struct ready_queue *queue, size_t *n_jobs,
+                        struct job_struct *out);
+
+/**
+ * @brief See tsqueue_set_wake_order().
+ *
+ * @param[in] queue The ready-queue.
+ * @param order The wake order.
+ */
+void ready_queue_set_wake_order(struct ready_queue *queue,
+                                enum tsqueue_wake_order order);
+
+/**
+ * @brief See tsqueue_set_done().
+ *
+ * @param[in] queue The ready-queue.
+ * @param done True if no more jobs will be placed in the queue.
+ */
+void ready_queue_set_done(struct ready_queue *queue, bool done);
+
+#endif /* READY_QUEUE_H */
@@ -0,0 +1,134 @@
+/**
+ * @file   submit.c
+ * @author Liam Powell
+ * @date   2026-10-18
+ *
+ * @brief  Submits a job to a running simulation from another process.
+ *
+ * The simulation must use READY_QUEUE_SHARED, see config.h. The job is put
+ * in the shared ready-queue named SHARED_QUEUE_NAME, which is opened with
+ * tsqueue_open_shared(), and is stamped with its arrival time as it is put.
+ * Submitted jobs have a single CPU burst and are given source zero, as they
+ * do not come from a job file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+#include "error.h"
+#include "job.h"
+#include "tsqueue.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief Parse a whole argument as an unsigned number.
+ *
+ * @param[in] str The argument.
+ * @param max The largest value allowed.
+ * @param[out] value The number.
+ *
+ * @return Zero if the function succeeds, else an error code that can be
+ *         passed to errno_or_ae_to_str().
+ */
+static int parse_unsigned(const char *str, uintmax_t max, uintmax_t *value);
+
+int main(int argc, char **argv)
+{
+    int retval = 0;
+
+    struct job_struct job = {0};
+    tsqueue *queue = NULL;
+
+    if (argc < 3 || argc > 4)
+    {
+        retval = AE_WRONG_NUM_ARGS;
+    }
+
+    uintmax_t tmp = 0;
+    if (retval == 0)
+    {
+        retval = parse_unsigned(argv[1], UINT64_MAX, &tmp);
+        job.id = (uint64_t)tmp;
+    }
+
+    if (retval == 0)
+    {
+        char *end;
+        errno = 0;
+        double seconds = strtod(argv[2], &end);
+        if (errno)
+        {
+            retval = errno;
+        }
+        else if (end == argv[2] || *end != '\0' || !isfinite(seconds)
+                 || seconds < 0 || seconds * 1e9 >= (double)UINT64_MAX)
+        {
+            retval = AE_STR_NOT_A_NUMBER;
+        }
+        else
+        {
+            job.cpu_burst_ns = (uint64_t)llround(seconds * 1e9);
+        }
+    }
+
+    if (retval == 0 && argc == 4)
+    {
+        retval = parse_unsigned(argv[3], PRIORITY_LEVELS - 1, &tmp);
+        job.priority = (unsigned)tmp;
+    }
+
+    if (retval == 0)
+    {
+        retval = tsqueue_open_shared(&queue, SHARED_QUEUE_NAME, sizeof(job));
+    }
+
+    if (retval == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &job.arrival_mono);
+        clock_gettime(CLOCK_REALTIME, &job.arrival_real);
+        job.submit_mono = job.arrival_mono;
+        retval = tsqueue_put(queue, 1, &job);
+    }
+
+    if (queue != NULL)
+    {
+        tsqueue_destroy(queue, NULL);
+    }
+
+    if (retval != 0)
+    {
+        fprintf(stderr, "%s\nUsage: %s [id] [burst] [priority]\n",
+                errno_or_ae_to_str(retval), argv[0]);
+    }
+
+    return retval;
+}
+
+static int parse_unsigned(const char *str, uintmax_t max, uintmax_t *value)
+{
+    int retval = 0;
+
+    char *end;
+    errno = 0;
+    *value = strtoumax(str, &end, 10);
+    if (errno)
+    {
+        retval = errno;
+    }
+    else if (end == str || *end != '\0' || *str == '-')
+    {
+        retval = AE_STR_NOT_A_NUMBER;
+    }
+    else if (*value > max)
+    {
+        retval = ERANGE;
+    }
+
+    return retval;
+}
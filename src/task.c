@@ -12,29 +12,133 @@
 #include "job.h"
 #include "log.h"
 #include "error.h"
+#include "config.h"
+#include "lock.h"
+#include "io.h"
+#include <ctype.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <stdlib.h>
+
+/** A range of jobs described by one line of a job file. The jobs are
+ * produced one at a time as they are needed rather than all at once. */
+struct job_range
+{
+    /** True while the range has jobs left to produce. */
+    bool active;
+
+    /** The id of the next job. */
+    uint64_t next_id;
+
+    /** The id of the last job, the range ends early if next_id plus stride
+     * passes this. */
+    uint64_t last_id;
+
+    /** The difference between consecutive ids. */
+    uint64_t stride;
+
+    /** The smallest burst in nanoseconds. */
+    uint64_t min_burst_ns;
+
+    /** The largest burst in nanoseconds, bursts are spread uniformly from
+     * min_burst_ns to this. */
+    uint64_t max_burst_ns;
+
+    /** The priority of every job. */
+    unsigned priority;
+
+    /** xorshift state used to choose bursts, seeded from the first id so
+     * the same file always produces the same jobs. */
+    uint64_t rng;
+};
 
 /**
  * @brief Fill @p buffer with jobs from @p job_file.
  *
- * The file should contain "<job id> <job time in seconds> <job id> <job time
- * in seconds> ..." separated by whitespace.
+ * The file should contain one job per line in the format "<job id> <burst>
+ * [priority]". Ids are 64 bit. A burst is a number of seconds, which may have
+ * a fractional part, optionally followed by one of the units s, ms, us or ns,
+ * such as "2", "1.5", "250ms" or "40us". The priority defaults to zero, the
+ * highest priority, and must be less than PRIORITY_LEVELS. Blank lines are
+ * ignored.
+ *
+ * A job which does I/O gives its bursts separated by colons, alternately CPU
+ * and I/O and starting and ending with CPU, such as "10ms:50ms:5ms" for a
+ * 10ms CPU burst, 50ms of I/O and a 5ms CPU burst. A job may have up to
+ * JOB_MAX_IO_BURSTS I/O bursts.
+ *
+ * A line may instead describe a range of jobs in the format
+ * "<first id>-<last id>[/<stride>] x <burst>[-<max burst>] [priority]", which
+ * gives every stride'th id from first to last id inclusive. The stride
+ * defaults to one. If a max burst is given the bursts are spread uniformly
+ * between the two. Jobs are taken from a range as they are needed, so a range
+ * costs the same to read however many jobs it holds. Jobs in a range have no
+ * I/O bursts.
  *
  * @param[in,out] job_file The file to read jobs from.
  * @param length The maximum number of jobs to read.
  * @param[out] buffer The buffer to fill with at most @p length jobs.
  * @param[out] used The number of jobs placed in the buffer. Zero if end of
  *                  file is reached.
+ * @param[in,out] range The range being expanded, carried between calls.
+ * @param[in,out] line Buffer used to read lines, see getline().
+ * @param[in,out] line_size The size of @p line, see getline().
  *
  * @return Zero if the function succeeds, else an error code that can be
  *         passed to errno_or_ae_to_str().
  */
 static int fill_job_buffer(FILE *job_file, size_t length,
-                           struct job_struct *buffer, size_t *used);
+                           struct job_struct *buffer, size_t *used,
+                           struct job_range *range, char **line,
+                           size_t *line_size);
+
+/**
+ * @brief Parse a single line of a job file.
+ *
+ * @param[in] line The line to parse, see fill_job_buffer() for the format.
+ * @param[out] job The job to fill in if @p line describes a single job.
+ * @param[out] range The range to fill in if @p line describes a range. Its
+ *                   active field is set to true.
+ * @param[out] is_blank Set to true if @p line contains only whitespace.
+ *
+ * @return Zero if the function succeeds, else AE_BAD_FILE.
+ */
+static int parse_job_line(const char *line, struct job_struct *job,
+                          struct job_range *range, bool *is_blank);
+
+/**
+ * @brief Parse a burst, see fill_job_buffer() for the format.
+ *
+ * @param[in] str The string starting with the burst.
+ * @param[out] ns The burst in nanoseconds.
+ * @param[out] end The number of characters in the burst.
+ *
+ * @return Zero if the function succeeds, else AE_BAD_FILE.
+ */
+static int parse_burst(const char *str, uint64_t *ns, int *end);
+
+/**
+ * @brief Parse the optional priority at the end of a job file line.
+ *
+ * @param[in] rest The rest of the line after the other fields.
+ * @param[out] priority The priority, zero if @p rest is empty.
+ *
+ * @return Zero if the function succeeds, else AE_BAD_FILE.
+ */
+static int parse_priority(const char *rest, unsigned *priority);
+
+/**
+ * @brief Take the next job from an active range.
+ *
+ * @param[in,out] range The range, active is cleared after its last job.
+ * @param[out] job The job to fill in.
+ */
+static void next_range_job(struct job_range *range, struct job_struct *job);
 
 void *task(void *ptr)
 {
@@ -42,42 +146,80 @@ void *task(void *ptr)
 
     // Input arguments
     struct task_params *params = ptr;
-    tsqueue *queue = params->queue;
+    struct ready_queue *queue = params->queue;
     FILE *job_file = params->job_file;
+    unsigned source = params->source;
     struct job_struct *job_buffer = params->job_buffer;
     size_t job_buffer_length = params->job_buffer_length;
-    FILE *log_file = params->log_file;
+    struct log_writer *log_file = params->log_file;
 
     // Total number of jobs processed
     unsigned long n_jobs = 0;
 
-    if (tsqueue_capacity(queue) < job_buffer_length)
+    // Used by fill_job_buffer() to read lines
+    char *line = NULL;
+    size_t line_size = 0;
+    struct job_range range = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &params->start);
+    params->last_arrival = params->start;
+
+    if (ready_queue_capacity(queue) < job_buffer_length)
     {
-        job_buffer_length = tsqueue_capacity(queue);
+        job_buffer_length = ready_queue_capacity(queue);
     }
 
 
     int queue_retval = 0;
-    while (retval == 0 && !feof(job_file) && queue_retval == 0)
+    while (retval == 0 && (range.active || !feof(job_file))
+           && queue_retval == 0)
     {
         size_t jobs_in_buffer = 0;
         retval = fill_job_buffer(job_file, job_buffer_length, job_buffer,
-                                 &jobs_in_buffer);
-        if (retval == 0)
+                                 &jobs_in_buffer, &range, &line, &line_size);
+        // The queue takes one producer at a time. Jobs are stamped with their
+        // arrival time while the lock is held so the queue stays in arrival
+        // order across sources. The lock is not held while waiting for
+        // space, so the other producers are not held up meanwhile, and once
+        // there is space with the lock held the put can not wait.
+        lock_acquire(params->producer_lock);
+        while (retval == 0 && queue_retval == 0
+               && !ready_queue_has_space(queue, jobs_in_buffer))
         {
-            queue_retval = tsqueue_wait_for_space(queue, jobs_in_buffer);
+            lock_release(params->producer_lock);
+            queue_retval = ready_queue_wait_for_space(queue, jobs_in_buffer);
+            lock_acquire(params->producer_lock);
         }
 
         if (retval == 0 && queue_retval == 0)
         {
+            unsigned long n_cycling = 0;
             for (size_t i = 0; i < jobs_in_buffer; ++i)
             {
+                job_buffer[i].source = source;
                 clock_gettime(CLOCK_MONOTONIC, &job_buffer[i].arrival_mono);
                 clock_gettime(CLOCK_REALTIME, &job_buffer[i].arrival_real);
+                job_buffer[i].submit_mono = job_buffer[i].arrival_mono;
+                if (job_buffer[i].n_later_bursts != 0)
+                {
+                    ++n_cycling;
+                }
             }
-            queue_retval = tsqueue_put(queue, jobs_in_buffer, job_buffer);
+            // Counted before they are placed in the queue so that the queue
+            // cannot be marked done while they run.
+            if (n_cycling != 0)
+            {
+                io_wait_add_jobs(params->io, n_cycling);
+            }
+            queue_retval = ready_queue_put(queue, jobs_in_buffer, job_buffer);
             n_jobs += jobs_in_buffer;
+            if (queue_retval == 0 && jobs_in_buffer != 0)
+            {
+                params->last_arrival =
+                    job_buffer[jobs_in_buffer - 1].arrival_mono;
+            }
         }
+        lock_release(params->producer_lock);
 
         if (retval == 0 && queue_retval == 0)
         {
@@ -92,7 +234,8 @@ void *task(void *ptr)
         }
     }
 
-    tsqueue_set_done(queue, true);
+    free(line);
+    params->n_jobs = n_jobs;
 
     if (retval == 0)
     {
@@ -101,33 +244,301 @@ void *task(void *ptr)
         retval = log_task_done(log_file, time, n_jobs);
     }
 
+    int flush_retval = log_writer_flush(log_file);
+    if (retval == 0)
+    {
+        retval = flush_retval;
+    }
+
     params->retval = retval;
     return NULL;
 }
 
 static int fill_job_buffer(FILE *job_file, size_t length,
-                           struct job_struct *buffer, size_t *used)
+                           struct job_struct *buffer, size_t *used,
+                           struct job_range *range, char **line,
+                           size_t *line_size)
 {
     int retval = 0;
 
     *used = 0;
-    while (!feof(job_file) && retval == 0 && *used < length)
+    while ((range->active || !feof(job_file)) && retval == 0
+           && *used < length)
     {
-        // I have used fscanf rather than a more robust function here to keep
-        // this function simple.
-        struct job_struct *job = &buffer[*used];
-        unsigned int tmp_time;
+        if (range->active)
+        {
+            next_range_job(range, &buffer[(*used)++]);
+            continue;
+        }
+
         errno = 0;
-        if (fscanf(job_file, " %u %u ", &job->id, &tmp_time) != 2)
+        if (getline(line, line_size, job_file) == -1)
+        {
+            retval = ferror(job_file) ? errno : 0;
+        }
+        else
+        {
+            bool is_blank;
+            retval = parse_job_line(*line, &buffer[*used], range, &is_blank);
+            if (retval == 0 && !is_blank && !range->active)
+            {
+                ++*used;
+            }
+        }
+    }
+
+    return retval;
+}
+
+static int parse_job_line(const char *line, struct job_struct *job,
+                          struct job_range *range, bool *is_blank)
+{
+    int retval = 0;
+
+    // I have used sscanf rather than a more robust function here to keep
+    // this function simple. %n is used to check that nothing follows the
+    // last field.
+    uint64_t first_id;
+    uint64_t last_id;
+    int end = 0;
+    *is_blank = false;
+    if (sscanf(line, " %n", &end) == 0 && line[end] == '\0')
+    {
+        *is_blank = true;
+    }
+    else if (sscanf(line, " %" SCNu64 "-%" SCNu64 "%n", &first_id, &last_id,
+                    &end) == 2)
+    {
+        struct job_range new_range = {
+            .active = true,
+            .next_id = first_id,
+            .last_id = last_id,
+            .stride = 1,
+            .rng = 0x9e3779b97f4a7c15u ^ first_id
+        };
+        int field_end = 0;
+        if (line[end] == '/'
+            && sscanf(line + end, "/%" SCNu64 "%n", &new_range.stride,
+                      &field_end) == 1)
+        {
+            end += field_end;
+        }
+        field_end = 0;
+        if (sscanf(line + end, " x %n", &field_end) != 0 || field_end == 0)
         {
-            retval = (errno != 0) ? errno : AE_BAD_FILE;
+            retval = AE_BAD_FILE;
         }
         else
         {
-            job->cpu_burst = (time_t)tmp_time;
-            ++*used;
+            end += field_end;
+            retval = parse_burst(line + end, &new_range.min_burst_ns,
+                                 &field_end);
+        }
+
+        if (retval == 0)
+        {
+            end += field_end;
+            new_range.max_burst_ns = new_range.min_burst_ns;
+            if (line[end] == '-')
+            {
+                ++end;
+                retval = parse_burst(line + end, &new_range.max_burst_ns,
+                                     &field_end);
+                end += field_end;
+            }
+        }
+
+        if (retval == 0)
+        {
+            retval = parse_priority(line + end, &new_range.priority);
+        }
+
+        if (retval == 0
+            && (first_id > last_id || new_range.stride == 0
+                || new_range.min_burst_ns > new_range.max_burst_ns))
+        {
+            retval = AE_BAD_FILE;
+        }
+
+        if (retval == 0)
+        {
+            *range = new_range;
+        }
+    }
+    else if (sscanf(line, " %" SCNu64 " %n", &job->id, &end) != 1)
+    {
+        retval = AE_BAD_FILE;
+    }
+    else
+    {
+        int burst_end = 0;
+        job->n_later_bursts = 0;
+        job->next_burst = 0;
+        job->last_cpu = 0;
+        job->waiting_ns = 0;
+        retval = parse_burst(line + end, &job->cpu_burst_ns, &burst_end);
+        end += burst_end;
+
+        // Each I/O burst is followed by another CPU burst.
+        while (retval == 0 && line[end] == ':')
+        {
+            if (job->n_later_bursts == 2 * JOB_MAX_IO_BURSTS)
+            {
+                retval = AE_BAD_FILE;
+                break;
+            }
+
+            for (int i = 0; i < 2 && retval == 0; ++i)
+            {
+                if (line[end] != ':')
+                {
+                    retval = AE_BAD_FILE;
+                    break;
+                }
+                ++end;
+                retval = parse_burst(
+                    line + end, &job->later_bursts_ns[job->n_later_bursts++],
+                    &burst_end);
+                end += burst_end;
+            }
+        }
+
+        if (retval == 0)
+        {
+            retval = parse_priority(line + end, &job->priority);
+        }
+    }
+
+    return retval;
+}
+
+static int parse_burst(const char *str, uint64_t *ns, int *end)
+{
+    int retval = 0;
+
+    // Parsed by hand rather than with strtod so that bursts are exact.
+    const char *pos = str;
+    uint64_t whole = 0;
+    uint64_t fraction = 0;
+    uint64_t fraction_scale = 1;
+    bool has_digits = false;
+    while (*pos >= '0' && *pos <= '9')
+    {
+        if (whole > (UINT64_MAX - 9) / 10)
+        {
+            retval = AE_BAD_FILE;
+        }
+        whole = whole * 10 + (uint64_t)(*pos++ - '0');
+        has_digits = true;
+    }
+    if (*pos == '.')
+    {
+        ++pos;
+        while (*pos >= '0' && *pos <= '9')
+        {
+            // Digits past nanoseconds are ignored.
+            if (fraction_scale < 1000000000)
+            {
+                fraction = fraction * 10 + (uint64_t)(*pos - '0');
+                fraction_scale *= 10;
+            }
+            ++pos;
+            has_digits = true;
         }
     }
 
+    uint64_t unit = 1000000000;
+    if (strncmp(pos, "ns", 2) == 0)
+    {
+        unit = 1;
+        pos += 2;
+    }
+    else if (strncmp(pos, "us", 2) == 0)
+    {
+        unit = 1000;
+        pos += 2;
+    }
+    else if (strncmp(pos, "ms", 2) == 0)
+    {
+        unit = 1000000;
+        pos += 2;
+    }
+    else if (*pos == 's')
+    {
+        unit = 1000000000;
+        ++pos;
+    }
+
+    if (!has_digits || whole > UINT64_MAX / unit
+        || (*pos != '\0' && *pos != '-' && *pos != ':'
+            && !isspace((unsigned char)*pos)))
+    {
+        retval = AE_BAD_FILE;
+    }
+
+    // The fraction is below one unit so this can not overflow, but adding
+    // it to the whole units still can.
+    uint64_t fraction_ns = fraction * unit / fraction_scale;
+    if (retval == 0 && fraction_ns > UINT64_MAX - whole * unit)
+    {
+        retval = AE_BAD_FILE;
+    }
+
+    if (retval == 0)
+    {
+        *ns = whole * unit + fraction_ns;
+        *end = (int)(pos - str);
+    }
+
+    return retval;
+}
+
+static int parse_priority(const char *rest, unsigned *priority)
+{
+    int retval = 0;
+
+    int end = 0;
+    *priority = 0;
+    if (sscanf(rest, " %n", &end) == 0 && rest[end] == '\0')
+    {
+        // No priority given.
+    }
+    else if (sscanf(rest, " %u %n", priority, &end) != 1
+             || rest[end] != '\0' || *priority >= PRIORITY_LEVELS)
+    {
+        retval = AE_BAD_FILE;
+    }
+
     return retval;
 }
+
+static void next_range_job(struct job_range *range, struct job_struct *job)
+{
+    uint64_t burst_ns = range->min_burst_ns;
+    if (range->max_burst_ns != range->min_burst_ns)
+    {
+        range->rng ^= range->rng << 13;
+        range->rng ^= range->rng >> 7;
+        range->rng ^= range->rng << 17;
+        uint64_t span = range->max_burst_ns - range->min_burst_ns;
+        burst_ns += (span == UINT64_MAX) ? range->rng
+                                         : range->rng % (span + 1);
+    }
+
+    job->id = range->next_id;
+    job->cpu_burst_ns = burst_ns;
+    job->n_later_bursts = 0;
+    job->next_burst = 0;
+    job->last_cpu = 0;
+    job->waiting_ns = 0;
+    job->priority = range->priority;
+
+    if (range->last_id - range->next_id < range->stride)
+    {
+        range->active = false;
+    }
+    else
+    {
+        range->next_id += range->stride;
+    }
+}
@@ -9,18 +9,32 @@
 #ifndef TASK_H
 #define TASK_H
 
-#include "tsqueue.h"
+#include "ready_queue.h"
+#include "lock.h"
+#include "io.h"
+#include "log_writer.h"
 #include <stdio.h>
 
 /** Parameters to pass to task(). */
 struct task_params
 {
     /** The ready-queue, the task() thread only acts as a producer. */
-    tsqueue *queue;
+    struct ready_queue *queue;
 
     /** The file to  get jobs from. */
     FILE *job_file;
 
+    /** The position of job_file among the job files on the command line,
+     * starting from one. Stored in each job. */
+    unsigned source;
+
+    /** Shared by the task() threads using queue, which takes one producer
+     * at a time. */
+    struct lock *producer_lock;
+
+    /** The blocked set, which counts the jobs with I/O bursts. */
+    struct io_wait *io;
+
     /** The buffer to store jobs in before placing them in the queue. */
     struct job_struct *job_buffer;
 
@@ -28,7 +42,19 @@ struct task_params
     size_t job_buffer_length;
 
     /** The file to write log messages to. */
-    FILE *log_file;
+    struct log_writer *log_file;
+
+    /** The number of jobs put in the queue. task() will set this before
+     * exiting. */
+    unsigned long n_jobs;
+
+    /** The time task() started from CLOCK_MONOTONIC. task() will set this
+     * before exiting. */
+    struct timespec start;
+
+    /** The arrival time of the last job from CLOCK_MONOTONIC, equal to start
+     * if no jobs arrived. task() will set this before exiting. */
+    struct timespec last_arrival;
 
     /** The return value of the task() call. task() will set this before
      * exiting. Zero if successful, otherwise can be passed to
@@ -40,6 +66,11 @@ struct task_params
  * @brief Places jobs in the provided queue until the end of the file is
  *        reached or an error occurs.
  *
+ * Several task() threads may share a queue, each reading its own file. Jobs
+ * arrive when they are placed in the queue, so the queue holds the jobs of
+ * all sources in arrival order. tsqueue_set_done() is left to the caller,
+ * which knows when the last task() thread has finished.
+ *
  * @param data See task_params for details.
  *
  * @return NULL, see task_params for return value.
@@ -6,20 +6,143 @@
  * @brief  Implementation of tsqueue.
  */
 
+#define _XOPEN_SOURCE 700
+
 #include "tsqueue.h"
+#include "tsqueue_shared.h"
+#include "lock.h"
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <strings.h>
+#include <time.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/** The size of a cache line, used to keep sub-queues from sharing lines. */
+#define CACHE_LINE_SIZE 64
+
+/** The number of times the calling thread has been woken in tsqueue_pop(),
+ * see tsqueue_thread_wakeups(). */
+static _Thread_local unsigned long thread_wakeups = 0;
+
+/** A sub-queue of a relaxed tsqueue. */
+struct subqueue
+{
+    /** The lock for the data in this struct other than head_stamp. */
+    _Alignas(CACHE_LINE_SIZE) struct lock lock;
+
+    /** The stamp of the first element, UINT64_MAX if the sub-queue is
+     * empty. Only written while lock is held but may be read without it so
+     * consumers can compare sub-queues before locking one. */
+    _Atomic uint64_t head_stamp;
+
+    /** The index of the first element in data and stamps. */
+    size_t head;
+
+    /** The number of elements in the sub-queue. */
+    size_t count;
+
+    /** Ring of elements, can hold as many elements as the whole queue. */
+    char *data;
+
+    /** The stamp of each element in data. Stamps increase in the order
+     * elements were put in to the queue. */
+    uint64_t *stamps;
+};
+
+/** The state of a combining record. */
+enum combining_state
+{
+    /** The record is not owned by any thread. */
+    COMBINING_FREE,
+
+    /** A thread owns the record and is filling in its request. */
+    COMBINING_CLAIMED,
+
+    /** The record holds a tsqueue_put() request. */
+    COMBINING_PUT,
+
+    /** The record holds a tsqueue_pop() request. */
+    COMBINING_POP,
+
+    /** The record holds a tsqueue_try_pop() request. */
+    COMBINING_TRY_POP,
+
+    /** The request has been carried out, the results are in the record. */
+    COMBINING_DONE
+};
+
+/** A request published to a combining tsqueue. Each record has its own cache
+ * line so a thread spinning on its record does not disturb the others. */
+struct combining_record
+{
+    /** One of enum combining_state. The owner publishes a request by storing
+     * the operation with release ordering and the combiner publishes the
+     * results by storing COMBINING_DONE, so the other values need no lock. */
+    _Alignas(CACHE_LINE_SIZE) atomic_int state;
+
+    /** The number of elements to put or pop, set to the number popped. */
+    size_t n_elems;
+
+    /** The elements to put or the buffer to pop elements in to. */
+    void *buf;
+
+    /** The return value of the request. */
+    int retval;
+
+    /** True if the owner is waiting on wakeup. Protected by the queue
+     * lock. */
+    bool sleeping;
+
+    /** Signalled when the request is completed while the owner is
+     * sleeping. */
+    struct lock_cond wakeup;
+};
+
+/** A consumer waiting in tsqueue_pop(). Lives on the consumer's stack and is
+ * protected by the queue lock. */
+struct waiter
+{
+    /** Signalled to wake only this consumer. */
+    struct lock_cond wakeup;
+
+    /** The consumer's output buffer. */
+    void *out;
+
+    /** The number of elements the consumer wants. */
+    size_t n_wanted;
+
+    /** True if a producer has copied the elements directly in to out. */
+    bool handed_off;
+
+    /** True if the waiter is in the queue's list of waiters. Waiters are
+     * removed from the list when they are woken. */
+    bool queued;
+
+    /** Identifies the consumer thread, used for TSQUEUE_WAKE_ROUND_ROBIN. */
+    unsigned long consumer_id;
+
+    /** The previous waiter in the list. */
+    struct waiter *prev;
+
+    /** The next waiter in the list. */
+    struct waiter *next;
+};
 
 /** The internal structure of tsqueue. */
 struct tsqueue
 {
     /** The lock for the data in this struct. Must be held before reading or
      * writing any values in this struct. */
-    pthread_mutex_t lock;
+    struct lock lock;
 
     /** The capacity of the queue. */
     size_t capacity;
@@ -35,33 +158,407 @@ struct tsqueue
      * when elements are removed. */
     void *data;
 
-    /** The number of unused elements that a producer is waiting for, or zero
-     * if no producer is waiting. */
-    size_t producer_n_elems;
+    /** The smallest number of unused elements that any waiting producer is
+     * waiting for, or zero if no producer is waiting. Atomic so relaxed
+     * queues can check it without holding lock, it must still only be
+     * written with lock held. */
+    atomic_size_t producer_n_elems;
+
+    /** The number of producers waiting for space. */
+    size_t n_producers_waiting;
+
+    /** Broadcast to the waiting producers by consumers if they find there
+     * are enough free elements for one of them after consuming some. */
+    struct lock_cond producer_wakeup;
+
+    /** The number of waiting consumers. Atomic for the same reason as
+     * producer_n_elems. */
+    atomic_size_t n_consumers_waiting;
 
-    /** Used to signal the waiting producer to be called by consumers if they
-     * find there is enough free elements after consuming some. */
-    pthread_cond_t producer_wakeup;
+    /** Used to signal waiting consumers of relaxed queues and the owners of
+     * waiting private requests of combining queues. */
+    struct lock_cond consumer_wakeup;
 
-    /** The number of waiting consumers. */
-    size_t n_consumers_waiting;
+    /** Consumers waiting in tsqueue_pop(), oldest first. Used instead of
+     * consumer_wakeup by queues other than relaxed and shared queues so that
+     * a specific consumer can be woken. */
+    struct waiter *waiters_head;
 
-    /** Used to signal waiting consumers. */
-    pthread_cond_t consumer_wakeup;
+    /** The last waiter in waiters_head. */
+    struct waiter *waiters_tail;
+
+    /** The order waiters are woken in. */
+    enum tsqueue_wake_order wake_order;
+
+    /** For TSQUEUE_WAKE_ROUND_ROBIN, the lowest consumer id that has not been
+     * woken in the current round. */
+    unsigned long next_consumer_id;
 
     /** Used to signal to tsqueue_destroy() that all consumers and producers
      * have exited. */
-    pthread_cond_t all_dead;
+    struct lock_cond all_dead;
 
     /** Indicates that consumers should not wait for more items to be
-     * inserted. */
-    bool producers_done;
+     * inserted. Atomic for the same reason as producer_n_elems. */
+    atomic_bool producers_done;
 
     /** Indicates that the queue is about to be destroyed and all functions
-     * should return an error indicator. */
-    bool die;
+     * should return an error indicator. Atomic for the same reason as
+     * producer_n_elems. */
+    atomic_bool die;
+
+    /** The number of priority levels, zero if this is a plain FIFO queue.
+     * When this is non-zero data is used as a pool of slots and each level
+     * is a ring of slot indices rather than data being kept in order. */
+    unsigned n_levels;
+
+    /** Returns the priority of an element, zero is the highest priority. */
+    unsigned (*priority)(const void *elem);
+
+    /** The length of an aging interval in nanoseconds, zero if elements do
+     * not age. */
+    unsigned long long aging_ns;
+
+    /** The key of the first level that may be non-empty. Every element has
+     * a key in the range [base, base + n_levels) and is stored in level
+     * `key % n_levels`, so advancing base rotates the levels and raises the
+     * effective priority of every waiting element at once. */
+    unsigned long long base;
+
+    /** Bit i is set if level i is not empty. This allows the highest
+     * priority level to be found with a single ffs() call. */
+    unsigned nonempty;
+
+    /** The index in a level's ring of the first slot in each level. */
+    size_t *heads;
+
+    /** The number of slots in each level. */
+    size_t *counts;
+
+    /** One ring of slot indices for each level, each ring can hold capacity
+     * indices. Level i uses rings[i * capacity] to
+     * rings[(i + 1) * capacity - 1]. */
+    size_t *rings;
+
+    /** Stack of unused slots. */
+    size_t *free_slots;
+
+    /** The number of unused slots in free_slots. */
+    size_t n_free;
+
+    /** Scratch space used by tsqueue_destroy() to put slots back in order. */
+    size_t *order;
+
+    /** The number of sub-queues, zero unless this is a relaxed queue. A
+     * relaxed queue keeps its elements in the sub-queues and only uses data
+     * to return elements from tsqueue_destroy(). */
+    size_t n_subqueues;
+
+    /** The sub-queues of a relaxed queue. */
+    struct subqueue *subqueues;
+
+    /** The number of elements in a relaxed queue which have not been
+     * reserved by a consumer. A consumer that reserves an element is
+     * guaranteed to find one in some sub-queue. */
+    atomic_size_t available;
+
+    /** The number of elements stored in the sub-queues of a relaxed queue,
+     * including reserved elements which have not been removed yet. This is
+     * what is limited to capacity. */
+    atomic_size_t present;
+
+    /** The stamp to give the next element put in to a relaxed queue. Only
+     * used by the producer. */
+    uint64_t next_stamp;
+
+    /** The number of combining records, zero unless this is a combining
+     * queue. A combining queue stores elements in data in the same way as a
+     * FIFO queue but threads do not operate on it directly. They publish
+     * requests in records and whichever thread holds the lock carries out
+     * every pending request, so the queue stays in that thread's cache. */
+    size_t n_records;
+
+    /** The records of a combining queue. */
+    struct combining_record *records;
+
+    /** The number of threads waiting on consumer_wakeup with a request that
+     * is not in records, see combining_op(). */
+    size_t n_private_waiting;
+
+    /** The shared memory segment holding the queue, NULL unless this is a
+     * shared queue. A shared queue keeps everything in the segment and
+     * none of the other values in this struct other than capacity and
+     * elem_size are used. */
+    struct tsqueue_shared *shared;
+
+    /** The name of the shared memory segment if this process created it and
+     * is responsible for removing it, otherwise NULL. */
+    char *shared_name;
+
+    /** An eventfd which is readable while tsqueue_try_pop() would not return
+     * TSQUEUE_EMPTY, -1 if tsqueue_enable_eventfds() has not been called. */
+    int not_empty_fd;
+
+    /** An eventfd which is readable while there is space in the queue, -1 if
+     * tsqueue_enable_eventfds() has not been called. */
+    int not_full_fd;
+
+    /** True if not_empty_fd is currently readable. */
+    bool not_empty_set;
+
+    /** True if not_full_fd is currently readable. */
+    bool not_full_set;
 };
 
+/**
+ * @brief Common part of tsqueue_create() and tsqueue_create_prio().
+ *
+ * @param[out] queue The tsqueue, will be NULL if creation fails.
+ * @param[in] init Initial value of the queue, everything other than the
+ *                 synchronisation primitives should be set.
+ * @param lock The kind of lock to use.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int create_internal(struct tsqueue **queue,
+                           const struct tsqueue *init, enum lock_kind lock);
+
+/**
+ * @brief Appends the element already stored in @p slot to its level, the
+ *        queue lock must be held when calling this function.
+ *
+ * @param queue The queue, must be a priority queue.
+ * @param slot The slot to append.
+ */
+static void prio_link(struct tsqueue *queue, size_t slot);
+
+/**
+ * @brief Removes the highest priority slot from its level, the queue lock must
+ *        be held when calling this function and the queue must not be empty.
+ *
+ * @param queue The queue, must be a priority queue.
+ *
+ * @return The slot that was removed. The caller is responsible for returning
+ *         it to the free list.
+ */
+static size_t prio_unlink(struct tsqueue *queue);
+
+/**
+ * @brief Moves the contents of a priority queue to the start of data in the
+ *        order they would have been popped, the queue lock must be held when
+ *        calling this function.
+ *
+ * @param queue The queue, must be a priority queue.
+ */
+static void prio_compact(struct tsqueue *queue);
+
+/**
+ * @brief Creates the sub-queues of a relaxed queue and moves the first @p used
+ *        elements of data in to them.
+ *
+ * @param queue The queue, n_subqueues and all non-synchronisation values
+ *              other than subqueues must be set.
+ * @param used The number of elements in data.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int relaxed_init(struct tsqueue *queue, size_t used);
+
+/**
+ * @brief Frees everything allocated by relaxed_init() after moving all
+ *        elements back to data in the order they were put.
+ *
+ * @param queue The queue, must be a relaxed queue.
+ *
+ * @return The number of elements placed in data.
+ */
+static size_t relaxed_free(struct tsqueue *queue);
+
+/**
+ * @brief tsqueue_put() for relaxed queues.
+ */
+static int relaxed_put(struct tsqueue *queue, size_t n_elems, void *in);
+
+/**
+ * @brief tsqueue_pop() and tsqueue_try_pop() for relaxed queues.
+ *
+ * @param wait True to wait for elements, false to return TSQUEUE_EMPTY
+ *             instead.
+ */
+static int relaxed_pop(struct tsqueue *queue, size_t *n_elems, void *out,
+                       bool wait);
+
+/**
+ * @brief Reserves up to @p n_elems elements of a relaxed queue without
+ *        blocking.
+ *
+ * @param queue The queue, must be a relaxed queue.
+ * @param n_elems The number of elements wanted.
+ * @param partial Reserve fewer than @p n_elems elements if that is all that
+ *                is available, otherwise reserve @p n_elems or nothing.
+ *
+ * @return The number of elements reserved.
+ */
+static size_t relaxed_reserve(struct tsqueue *queue, size_t n_elems,
+                              bool partial);
+
+/**
+ * @brief Removes one element from a relaxed queue, the caller must have
+ *        reserved it with relaxed_reserve().
+ *
+ * The element is taken from whichever of two randomly chosen sub-queues has
+ * the older first element.
+ *
+ * @param queue The queue, must be a relaxed queue.
+ * @param[out] out Buffer to place the element in.
+ */
+static void relaxed_remove(struct tsqueue *queue, void *out);
+
+/**
+ * @brief Returns a pseudo-random number, the state is per-thread.
+ *
+ * @return A pseudo-random number.
+ */
+static uint64_t thread_random(void);
+
+/**
+ * @brief tsqueue_put(), tsqueue_pop() and tsqueue_try_pop() for combining
+ *        queues.
+ *
+ * Publishes the request in a record and waits for it to be carried out,
+ * becoming the combiner if the lock is free.
+ *
+ * @param queue The queue, must be a combining queue.
+ * @param op COMBINING_PUT, COMBINING_POP or COMBINING_TRY_POP.
+ * @param[in,out] n_elems The number of elements to put or pop, set to the
+ *                        number popped.
+ * @param buf The elements to put or the buffer to pop elements in to.
+ *
+ * @return See tsqueue_put(), tsqueue_pop() and tsqueue_try_pop().
+ */
+static int combining_op(struct tsqueue *queue, int op, size_t *n_elems,
+                        void *buf);
+
+/**
+ * @brief Carries out every pending request that can be completed, the queue
+ *        lock must be held when calling this function.
+ *
+ * @param queue The queue, must be a combining queue.
+ * @param changed True if the caller has just changed the state of the queue.
+ */
+static void combine(struct tsqueue *queue, bool changed);
+
+/**
+ * @brief Tries to carry out the request in @p record, the queue lock must be
+ *        held when calling this function.
+ *
+ * @param queue The queue, must be a combining queue.
+ * @param record A record holding a request.
+ *
+ * @return True if the request was completed, false if it must wait.
+ */
+static bool combine_one(struct tsqueue *queue,
+                        struct combining_record *record);
+
+/**
+ * @brief Moves the first @p n_elems elements of a FIFO or combining queue in
+ *        to @p out, the queue lock must be held when calling this function.
+ *
+ * @param queue The queue.
+ * @param n_elems The number of elements, no more than used.
+ * @param[out] out Buffer to place the elements in.
+ */
+static void fifo_take(struct tsqueue *queue, size_t n_elems, void *out);
+
+/**
+ * @brief tsqueue_pop() and tsqueue_try_pop() for queues other than relaxed,
+ *        combining and shared queues.
+ *
+ * @param wait True to wait for elements, false to return TSQUEUE_EMPTY
+ *             instead.
+ */
+static int pop_internal(struct tsqueue *queue, size_t *n_elems, void *out,
+                        bool wait);
+
+/**
+ * @brief Adds @p waiter to the end of the list of waiters, the queue lock must
+ *        be held when calling this function.
+ *
+ * @param queue The queue.
+ * @param waiter The waiter to add.
+ */
+static void waiter_push(struct tsqueue *queue, struct waiter *waiter);
+
+/**
+ * @brief Removes @p waiter from the list of waiters, the queue lock must be
+ *        held when calling this function.
+ *
+ * @param queue The queue.
+ * @param waiter The waiter to remove.
+ */
+static void waiter_remove(struct tsqueue *queue, struct waiter *waiter);
+
+/**
+ * @brief Chooses the waiter to wake next according to the queue's wake order,
+ *        the queue lock must be held when calling this function.
+ *
+ * @param queue The queue.
+ *
+ * @return The waiter, NULL if there are no waiters.
+ */
+static struct waiter *choose_waiter(struct tsqueue *queue);
+
+/**
+ * @brief Removes the waiter chosen by choose_waiter() from the list and wakes
+ *        it, the queue lock must be held when calling this function. Does
+ *        nothing if there are no waiters.
+ *
+ * @param queue The queue.
+ */
+static void wake_waiter(struct tsqueue *queue);
+
+/**
+ * @brief Removes @p waiter from the list and wakes it, the queue lock must be
+ *        held when calling this function.
+ *
+ * @param queue The queue.
+ * @param waiter The waiter to wake.
+ */
+static void wake(struct tsqueue *queue, struct waiter *waiter);
+
+/**
+ * @brief Returns an id unique to the calling thread.
+ *
+ * @return The id, never zero.
+ */
+static unsigned long thread_consumer_id(void);
+
+/**
+ * @brief Removes all waiters from the list and wakes them, the queue lock
+ *        must be held when calling this function.
+ *
+ * @param queue The queue.
+ */
+static void wake_all_waiters(struct tsqueue *queue);
+
+/**
+ * @brief Makes the eventfds readable or not to match the state of the queue,
+ *        the queue lock must be held when calling this function. Must be
+ *        called after anything that changes the state of the queue.
+ *
+ * @param queue The queue.
+ */
+static void sync_eventfds(struct tsqueue *queue);
+
+/**
+ * @brief Makes an eventfd readable or not.
+ *
+ * @param fd The eventfd, nothing is done if it is -1.
+ * @param[in,out] is_set True if @p fd is currently readable.
+ * @param should_be_set True if @p fd should be readable.
+ */
+static void sync_eventfd(int fd, bool *is_set, bool should_be_set);
+
 /**
  * @brief Wait for space in the queue, the queue lock must be held when
  *        calling this function.
@@ -74,277 +571,1616 @@ struct tsqueue
  */
 static int wait_for_space_internal(struct tsqueue *queue, size_t n_elems);
 
-/**
- * @brief Signals queue.all_dead if there are no producers or consumers
- *        waiting, the queue lock must be held when calling this function.
- *
- * @param queue The queue.
- */
-static void signal_if_all_dead(struct tsqueue *queue);
+/**
+ * @brief Signals queue.all_dead if there are no producers or consumers
+ *        waiting, the queue lock must be held when calling this function.
+ *
+ * @param queue The queue.
+ */
+static void signal_if_all_dead(struct tsqueue *queue);
+
+int tsqueue_create(struct tsqueue **queue, void *data, size_t capacity,
+                   size_t elem_size, size_t used, enum lock_kind lock)
+{
+    return create_internal(queue, &(struct tsqueue){
+            .capacity = capacity,
+            .elem_size = elem_size,
+            .data = data,
+            .used = used
+        }, lock);
+}
+
+int tsqueue_create_prio(struct tsqueue **queue, void *data, size_t capacity,
+                        size_t elem_size, size_t used, unsigned n_levels,
+                        unsigned (*priority)(const void *elem),
+                        struct timespec aging_interval, enum lock_kind lock)
+{
+    int retval = 0;
+
+    if (n_levels == 0 || n_levels > TSQUEUE_MAX_LEVELS)
+    {
+        retval = EINVAL;
+    }
+
+    size_t *links = NULL;
+    if (retval == 0)
+    {
+        links = malloc(sizeof(*links)
+                       * (2 * (size_t)n_levels + ((size_t)n_levels + 2)
+                          * capacity));
+        if (links == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        retval = create_internal(queue, &(struct tsqueue){
+                .capacity = capacity,
+                .elem_size = elem_size,
+                .data = data,
+                .used = used,
+                .n_levels = n_levels,
+                .priority = priority,
+                .aging_ns = (unsigned long long)aging_interval.tv_sec
+                            * 1000000000 + aging_interval.tv_nsec,
+                .heads = links,
+                .counts = links + n_levels,
+                .rings = links + 2 * (size_t)n_levels,
+                .free_slots = links + 2 * (size_t)n_levels
+                              + (size_t)n_levels * capacity,
+                .order = links + 2 * (size_t)n_levels
+                         + ((size_t)n_levels + 1) * capacity
+            }, lock);
+        if (retval != 0)
+        {
+            free(links);
+        }
+    }
+
+    if (retval == 0)
+    {
+        for (unsigned i = 0; i < n_levels; ++i)
+        {
+            (*queue)->heads[i] = 0;
+            (*queue)->counts[i] = 0;
+        }
+
+        for (size_t i = capacity; i > used; --i)
+        {
+            (*queue)->free_slots[(*queue)->n_free++] = i - 1;
+        }
+
+        for (size_t i = 0; i < used; ++i)
+        {
+            prio_link(*queue, i);
+        }
+    }
+
+    return retval;
+}
+
+int tsqueue_create_relaxed(struct tsqueue **queue, void *data,
+                           size_t capacity, size_t elem_size, size_t used,
+                           size_t n_subqueues, enum lock_kind lock)
+{
+    int retval = 0;
+
+    if (n_subqueues < 2)
+    {
+        retval = EINVAL;
+    }
+
+    if (retval == 0)
+    {
+        retval = create_internal(queue, &(struct tsqueue){
+                .capacity = capacity,
+                .elem_size = elem_size,
+                .data = data,
+                .n_subqueues = n_subqueues
+            }, lock);
+    }
+
+    if (retval == 0)
+    {
+        retval = relaxed_init(*queue, used);
+        if (retval != 0)
+        {
+            (*queue)->n_subqueues = 0;
+            tsqueue_destroy(*queue, NULL);
+            *queue = NULL;
+        }
+    }
+
+    return retval;
+}
+
+int tsqueue_create_combining(struct tsqueue **queue, void *data,
+                             size_t capacity, size_t elem_size, size_t used,
+                             size_t n_records, enum lock_kind lock)
+{
+    int retval = 0;
+
+    if (n_records == 0)
+    {
+        retval = EINVAL;
+    }
+
+    struct combining_record *records = NULL;
+    if (retval == 0)
+    {
+        records = aligned_alloc(CACHE_LINE_SIZE, sizeof(*records) * n_records);
+        if (records == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    size_t n_conds = 0;
+    while (retval == 0 && n_conds < n_records)
+    {
+        atomic_init(&records[n_conds].state, COMBINING_FREE);
+        retval = lock_cond_init(&records[n_conds].wakeup, lock);
+        if (retval == 0)
+        {
+            ++n_conds;
+        }
+    }
+
+    if (retval == 0)
+    {
+        retval = create_internal(queue, &(struct tsqueue){
+                .capacity = capacity,
+                .elem_size = elem_size,
+                .data = data,
+                .used = used,
+                .n_records = n_records,
+                .records = records
+            }, lock);
+    }
+
+    if (retval != 0)
+    {
+        for (size_t i = 0; i < n_conds; ++i)
+        {
+            lock_cond_destroy(&records[i].wakeup);
+        }
+        free(records);
+    }
+
+    return retval;
+}
+
+int tsqueue_create_shared(struct tsqueue **queue, const char *name,
+                          size_t capacity, size_t elem_size)
+{
+    // The queue lock is only used by tsqueue_close(), the segment has its
+    // own process-shared lock.
+    int retval = create_internal(queue, &(struct tsqueue){
+            .capacity = capacity,
+            .elem_size = elem_size
+        }, LOCK_MUTEX);
+
+    char *name_copy = NULL;
+    if (retval == 0)
+    {
+        name_copy = strdup(name);
+        if (name_copy == NULL)
+        {
+            retval = errno;
+        }
+    }
+
+    struct tsqueue_shared *shared = NULL;
+    if (retval == 0)
+    {
+        retval = tsqueue_shared_create(&shared, name, capacity, elem_size);
+    }
+
+    if (retval == 0)
+    {
+        (*queue)->shared = shared;
+        (*queue)->shared_name = name_copy;
+    }
+    else if (*queue != NULL)
+    {
+        free(name_copy);
+        tsqueue_destroy(*queue, NULL);
+        *queue = NULL;
+    }
+
+    return retval;
+}
+
+int tsqueue_open_shared(struct tsqueue **queue, const char *name,
+                        size_t elem_size)
+{
+    int retval = create_internal(queue, &(struct tsqueue){
+            .elem_size = elem_size
+        }, LOCK_MUTEX);
+
+    struct tsqueue_shared *shared = NULL;
+    size_t capacity = 0;
+    if (retval == 0)
+    {
+        retval = tsqueue_shared_open(&shared, name, elem_size, &capacity);
+    }
+
+    if (retval == 0)
+    {
+        (*queue)->shared = shared;
+        (*queue)->capacity = capacity;
+    }
+    else if (*queue != NULL)
+    {
+        tsqueue_destroy(*queue, NULL);
+        *queue = NULL;
+    }
+
+    return retval;
+}
+
+static int create_internal(struct tsqueue **queue,
+                           const struct tsqueue *init, enum lock_kind lock)
+{
+    int retval = 0;
+
+    // The lock is over-aligned, which malloc() does not allow for. The size
+    // of a struct is always a multiple of its alignment, as aligned_alloc()
+    // requires.
+    *queue = aligned_alloc(_Alignof(struct tsqueue), sizeof(**queue));
+
+    if (*queue == NULL) {
+        retval = errno;
+    }
+
+    if (retval == 0) {
+        **queue = *init;
+        (*queue)->not_empty_fd = -1;
+        (*queue)->not_full_fd = -1;
+    }
+
+    int steps_done = 0;
+    if (retval == 0)
+    {
+        retval = lock_init(&(*queue)->lock, lock);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 1;
+        retval = lock_cond_init(&(*queue)->producer_wakeup, lock);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 2;
+        retval = lock_cond_init(&(*queue)->consumer_wakeup, lock);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 3;
+        retval = lock_cond_init(&(*queue)->all_dead, lock);
+    }
+
+    if (retval == 0)
+    {
+        steps_done = 4;
+    }
+
+    if  (retval != 0)
+    {
+        switch (steps_done)
+        {
+        case 4:
+            lock_cond_destroy(&(*queue)->all_dead);
+            /* FALL THROUGH */
+        case 3:
+            lock_cond_destroy(&(*queue)->consumer_wakeup);
+            /* FALL THROUGH */
+        case 2:
+            lock_cond_destroy(&(*queue)->producer_wakeup);
+            /* FALL THROUGH */
+        case 1:
+            lock_destroy(&(*queue)->lock);
+            /* FALL THROUGH */
+        default:
+            break;
+        }
+
+        free(*queue);
+        *queue = NULL;
+    }
+
+    return retval;
+}
+
+void tsqueue_close(struct tsqueue *queue)
+{
+    if (queue->shared != NULL)
+    {
+        tsqueue_shared_close(queue->shared);
+        return;
+    }
+
+    lock_acquire(&queue->lock);
+
+    queue->die = true;
+    sync_eventfds(queue);
+
+    // Fail every pending combining request, this also wakes their owners.
+    if (queue->n_records != 0)
+    {
+        combine(queue, true);
+    }
+
+    if (queue->producer_n_elems != 0)
+    {
+        lock_cond_broadcast(&queue->producer_wakeup);
+    }
+
+    for (size_t i = 0; i < queue->n_consumers_waiting; ++i)
+    {
+        lock_cond_signal(&queue->consumer_wakeup);
+    }
+    wake_all_waiters(queue);
+
+    while (queue->producer_n_elems != 0 && queue->n_consumers_waiting != 0)
+    {
+        lock_cond_wait(&queue->all_dead, &queue->lock);
+    }
+
+    lock_release(&queue->lock);
+}
+
+void tsqueue_destroy(struct tsqueue *queue, size_t *used)
+{
+    // Destroying a shared queue opened by another process should not stop
+    // the process that created it.
+    if (queue->shared == NULL || queue->shared_name != NULL)
+    {
+        tsqueue_close(queue);
+    }
+
+    if (queue->shared != NULL)
+    {
+        if (queue->shared_name != NULL)
+        {
+            shm_unlink(queue->shared_name);
+        }
+        tsqueue_shared_unmap(queue->shared);
+        free(queue->shared_name);
+    }
+
+    if (queue->n_levels != 0)
+    {
+        prio_compact(queue);
+    }
+
+    if (queue->n_subqueues != 0)
+    {
+        queue->used = relaxed_free(queue);
+    }
+
+    if (used != NULL)
+    {
+        *used = queue->used;
+    }
+
+    lock_destroy(&queue->lock);
+    lock_cond_destroy(&queue->producer_wakeup);
+    lock_cond_destroy(&queue->consumer_wakeup);
+    lock_cond_destroy(&queue->all_dead);
+    if (queue->not_empty_fd != -1)
+    {
+        close(queue->not_empty_fd);
+        close(queue->not_full_fd);
+    }
+    for (size_t i = 0; i < queue->n_records; ++i)
+    {
+        lock_cond_destroy(&queue->records[i].wakeup);
+    }
+    free(queue->heads);
+    free(queue->records);
+    free(queue);
+}
+
+size_t tsqueue_capacity(struct tsqueue *queue)
+{
+    lock_acquire(&queue->lock);
+    size_t capacity = queue->capacity;
+    lock_release(&queue->lock);
+    return capacity;
+}
+
+bool tsqueue_has_space(struct tsqueue *queue, size_t n_elems)
+{
+    if (queue->shared != NULL)
+    {
+        return tsqueue_shared_has_space(queue->shared, n_elems);
+    }
+
+    lock_acquire(&queue->lock);
+    size_t used = (queue->n_subqueues != 0) ? queue->present : queue->used;
+    bool has_space = (queue->capacity - used >= n_elems);
+    lock_release(&queue->lock);
+    return has_space;
+}
+
+int tsqueue_wait_for_space(struct tsqueue *queue, size_t n_elems)
+{
+    if (queue->shared != NULL)
+    {
+        return tsqueue_shared_wait_for_space(queue->shared, n_elems);
+    }
+
+    lock_acquire(&queue->lock);
+    int retval = wait_for_space_internal(queue, n_elems);
+    lock_release(&queue->lock);
+    return retval;
+}
+
+int tsqueue_put(struct tsqueue *queue, size_t n_elems, void *in)
+{
+    if (queue->n_subqueues != 0)
+    {
+        return relaxed_put(queue, n_elems, in);
+    }
+
+    if (queue->n_records != 0)
+    {
+        return combining_op(queue, COMBINING_PUT, &n_elems, in);
+    }
+
+    if (queue->shared != NULL)
+    {
+        return tsqueue_shared_put(queue->shared, n_elems, in);
+    }
+
+    int retval = 0;
+
+    lock_acquire(&queue->lock);
+
+    retval = wait_for_space_internal(queue, n_elems);
+
+    if (retval == 0 && queue->n_levels != 0)
+    {
+        for (size_t i = 0; i < n_elems; ++i)
+        {
+            size_t slot = queue->free_slots[--queue->n_free];
+            memcpy((char *)queue->data + (slot * queue->elem_size),
+                   (char *)in + (i * queue->elem_size), queue->elem_size);
+            prio_link(queue, slot);
+        }
+    }
+    else if (retval == 0)
+    {
+        // Waiting consumers of an empty queue would be the next to pop these
+        // elements, so copy them straight in to their buffers. This saves a
+        // copy and means each consumer does not have to compete for the lock
+        // again once it wakes.
+        size_t given = 0;
+        struct waiter *waiter;
+        while (queue->used == 0 && (waiter = choose_waiter(queue)) != NULL
+               && waiter->n_wanted <= n_elems - given)
+        {
+            memcpy(waiter->out, (char *)in + (given * queue->elem_size),
+                   waiter->n_wanted * queue->elem_size);
+            given += waiter->n_wanted;
+            waiter->handed_off = true;
+            wake(queue, waiter);
+        }
+
+        n_elems -= given;
+        memcpy((char *)queue->data + (queue->used * queue->elem_size),
+               (char *)in + (given * queue->elem_size),
+               n_elems * queue->elem_size);
+    }
+
+    if (retval == 0)
+    {
+        if (n_elems != 0)
+        {
+            wake_waiter(queue);
+        }
+
+        queue->used += n_elems;
+        sync_eventfds(queue);
+    }
+
+    lock_release(&queue->lock);
+
+    return retval;
+}
+
+int tsqueue_pop(struct tsqueue *queue, size_t *n_elems, void *out)
+{
+    if (queue->n_subqueues != 0)
+    {
+        return relaxed_pop(queue, n_elems, out, true);
+    }
+
+    if (queue->n_records != 0)
+    {
+        return combining_op(queue, COMBINING_POP, n_elems, out);
+    }
+
+    if (queue->shared != NULL)
+    {
+        return tsqueue_shared_pop(queue->shared, n_elems, out);
+    }
+
+    return pop_internal(queue, n_elems, out, true);
+}
+
+int tsqueue_try_pop(struct tsqueue *queue, size_t *n_elems, void *out)
+{
+    if (queue->n_subqueues != 0)
+    {
+        return relaxed_pop(queue, n_elems, out, false);
+    }
+
+    if (queue->n_records != 0)
+    {
+        return combining_op(queue, COMBINING_TRY_POP, n_elems, out);
+    }
+
+    if (queue->shared != NULL)
+    {
+        *n_elems = 0;
+        return ENOTSUP;
+    }
+
+    return pop_internal(queue, n_elems, out, false);
+}
+
+void tsqueue_set_wake_order(struct tsqueue *queue,
+                            enum tsqueue_wake_order order)
+{
+    lock_acquire(&queue->lock);
+    queue->wake_order = order;
+    lock_release(&queue->lock);
+}
+
+unsigned long tsqueue_thread_wakeups(void)
+{
+    return thread_wakeups;
+}
+
+void tsqueue_count_wakeup(void)
+{
+    ++thread_wakeups;
+}
+
+unsigned long tsqueue_thread_consumer_id(void)
+{
+    return thread_consumer_id();
+}
+
+int tsqueue_enable_eventfds(struct tsqueue *queue, int *not_empty_fd,
+                            int *not_full_fd)
+{
+    int retval = 0;
+
+    if (queue->n_subqueues != 0 || queue->shared != NULL)
+    {
+        retval = ENOTSUP;
+    }
+
+    if (retval == 0)
+    {
+        lock_acquire(&queue->lock);
+
+        if (queue->not_empty_fd == -1)
+        {
+            int fds[2] = {-1, -1};
+            for (int i = 0; i < 2 && retval == 0; ++i)
+            {
+                fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (fds[i] == -1)
+                {
+                    retval = errno;
+                }
+            }
+
+            if (retval == 0)
+            {
+                queue->not_empty_fd = fds[0];
+                queue->not_full_fd = fds[1];
+                sync_eventfds(queue);
+            }
+            else if (fds[0] != -1)
+            {
+                close(fds[0]);
+            }
+        }
+
+        if (retval == 0)
+        {
+            *not_empty_fd = queue->not_empty_fd;
+            *not_full_fd = queue->not_full_fd;
+        }
+
+        lock_release(&queue->lock);
+    }
+
+    return retval;
+}
+
+static int pop_internal(struct tsqueue *queue, size_t *n_elems, void *out,
+                        bool wait)
+{
+    int retval = 0;
+    bool handed_off = false;
+
+    lock_acquire(&queue->lock);
+
+    if (*n_elems > queue->capacity)
+    {
+        retval = TSQUEUE_TOO_MANY;
+    }
+
+    if (retval == 0 && !wait)
+    {
+        if (!queue->producers_done && !queue->die && queue->used == 0
+            && *n_elems != 0)
+        {
+            retval = TSQUEUE_EMPTY;
+            *n_elems = 0;
+        }
+    }
+    else if (retval == 0)
+    {
+        struct waiter self = {
+            .out = out,
+            .n_wanted = *n_elems,
+            .consumer_id = thread_consumer_id()
+        };
+        bool self_initialised = false;
+
+        ++queue->n_consumers_waiting;
+        while (retval == 0 && !self.handed_off && !queue->producers_done
+               && !queue->die && queue->used < *n_elems)
+        {
+            if (!self_initialised)
+            {
+                retval = lock_cond_init(&self.wakeup, queue->lock.kind);
+                self_initialised = (retval == 0);
+            }
+
+            if (retval == 0)
+            {
+                if (!self.queued)
+                {
+                    waiter_push(queue, &self);
+                }
+                lock_cond_wait(&self.wakeup, &queue->lock);
+
+                // Waiters are only removed from the list by wake_waiter(),
+                // anything else is a spurious wakeup.
+                if (!self.queued)
+                {
+                    ++thread_wakeups;
+                }
+            }
+        }
+        --queue->n_consumers_waiting;
+
+        if (self.queued)
+        {
+            waiter_remove(queue, &self);
+        }
+
+        if (self_initialised)
+        {
+            lock_cond_destroy(&self.wakeup);
+        }
+
+        handed_off = self.handed_off;
+    }
+
+    if (queue->die)
+    {
+        // A consumer that has been handed elements has already been given
+        // everything it asked for.
+        if (!handed_off)
+        {
+            retval = TSQUEUE_CLOSED;
+            *n_elems = 0;
+        }
+        signal_if_all_dead(queue);
+    }
+
+    if (retval == 0 && !handed_off)
+    {
+        if (queue->used < *n_elems)
+        {
+            *n_elems = queue->used;
+        }
+        if (queue->n_levels != 0)
+        {
+            for (size_t i = 0; i < *n_elems; ++i)
+            {
+                size_t slot = prio_unlink(queue);
+                memcpy((char *)out + (i * queue->elem_size),
+                       (char *)queue->data + (slot * queue->elem_size),
+                       queue->elem_size);
+                queue->free_slots[queue->n_free++] = slot;
+            }
+            queue->used -= *n_elems;
+        }
+        else
+        {
+            fifo_take(queue, *n_elems, out);
+        }
+
+        if (queue->producer_n_elems != 0
+            && queue->producer_n_elems <= (queue->capacity - queue->used))
+        {
+            lock_cond_broadcast(&queue->producer_wakeup);
+        }
+
+        if (queue->used != 0)
+        {
+            wake_waiter(queue);
+        }
+
+        sync_eventfds(queue);
+    }
+
+    lock_release(&queue->lock);
+
+    return retval;
+}
+
+static int combining_op(struct tsqueue *queue, int op, size_t *n_elems,
+                        void *buf)
+{
+    // Claim a record, starting from one chosen by thread so that threads
+    // usually keep using the same record. Records may all be held by waiting
+    // consumers, so rather than waiting for one a thread that finds none
+    // free carries out its own request under the lock using a private record.
+    struct combining_record private = {0};
+    atomic_init(&private.state, COMBINING_CLAIMED);
+    struct combining_record *record = &private;
+    size_t start = thread_consumer_id() % queue->n_records;
+    for (size_t i = 0; i < queue->n_records && record == &private; ++i)
+    {
+        struct combining_record *candidate =
+            &queue->records[(start + i) % queue->n_records];
+        int expected = COMBINING_FREE;
+        if (atomic_compare_exchange_strong(&candidate->state, &expected,
+                                           COMBINING_CLAIMED))
+        {
+            record = candidate;
+        }
+    }
+    bool published = (record != &private);
+
+    record->n_elems = *n_elems;
+    record->buf = buf;
+    record->sleeping = false;
+    atomic_store_explicit(&record->state, op, memory_order_release);
+
+    // Another thread holding the lock will carry out a published request,
+    // only become the combiner if nobody else is.
+    while (atomic_load_explicit(&record->state, memory_order_acquire)
+           != COMBINING_DONE)
+    {
+        if (!published)
+        {
+            lock_acquire(&queue->lock);
+        }
+        else if (!lock_try_acquire(&queue->lock))
+        {
+            sched_yield();
+            continue;
+        }
+
+        while (true)
+        {
+            bool changed = !published && combine_one(queue, record);
+            if (changed)
+            {
+                atomic_store_explicit(&record->state, COMBINING_DONE,
+                                      memory_order_relaxed);
+            }
+            combine(queue, changed);
+
+            // Anything still pending after combining has to wait for
+            // another request to change the state of the queue.
+            if (atomic_load_explicit(&record->state, memory_order_acquire)
+                == COMBINING_DONE)
+            {
+                break;
+            }
+            record->sleeping = true;
+            ++queue->n_consumers_waiting;
+            if (published)
+            {
+                lock_cond_wait(&record->wakeup, &queue->lock);
+            }
+            else
+            {
+                ++queue->n_private_waiting;
+                lock_cond_wait(&queue->consumer_wakeup, &queue->lock);
+                --queue->n_private_waiting;
+            }
+            --queue->n_consumers_waiting;
+            record->sleeping = false;
+        }
+
+        if (queue->die)
+        {
+            signal_if_all_dead(queue);
+        }
+        lock_release(&queue->lock);
+    }
+
+    *n_elems = record->n_elems;
+    int retval = record->retval;
+    atomic_store_explicit(&record->state, COMBINING_FREE,
+                          memory_order_release);
+
+    return retval;
+}
+
+static void combine(struct tsqueue *queue, bool changed)
+{
+    // A put can allow a pop in an earlier record to complete and the other
+    // way around, so keep passing over the records until nothing changes.
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (size_t i = 0; i < queue->n_records; ++i)
+        {
+            struct combining_record *record = &queue->records[i];
+            int state = atomic_load_explicit(&record->state,
+                                             memory_order_acquire);
+            if ((state == COMBINING_PUT || state == COMBINING_POP
+                 || state == COMBINING_TRY_POP)
+                && combine_one(queue, record))
+            {
+                // The owner may reuse the record as soon as it sees it is
+                // done, so sleeping must be read first.
+                bool sleeping = record->sleeping;
+                progress = true;
+                changed = true;
+                atomic_store_explicit(&record->state, COMBINING_DONE,
+                                      memory_order_release);
+                if (sleeping)
+                {
+                    lock_cond_signal(&record->wakeup);
+                }
+            }
+        }
+    }
+
+    if (queue->producer_n_elems != 0
+        && queue->producer_n_elems <= (queue->capacity - queue->used))
+    {
+        lock_cond_broadcast(&queue->producer_wakeup);
+    }
+
+    // Private requests are not seen here, so their owners have to check
+    // again whenever anything changes.
+    if (changed && queue->n_private_waiting != 0)
+    {
+        lock_cond_broadcast(&queue->consumer_wakeup);
+    }
+
+    sync_eventfds(queue);
+}
+
+static bool combine_one(struct tsqueue *queue,
+                        struct combining_record *record)
+{
+    int state = atomic_load_explicit(&record->state, memory_order_relaxed);
+    bool done = true;
+
+    record->retval = 0;
+    if (queue->die)
+    {
+        record->retval = TSQUEUE_CLOSED;
+        record->n_elems = 0;
+    }
+    else if (record->n_elems > queue->capacity)
+    {
+        record->retval = TSQUEUE_TOO_MANY;
+        record->n_elems = 0;
+    }
+    else if (state == COMBINING_PUT)
+    {
+        done = (queue->capacity - queue->used >= record->n_elems);
+        if (done)
+        {
+            memcpy((char *)queue->data + (queue->used * queue->elem_size),
+                   record->buf, record->n_elems * queue->elem_size);
+            queue->used += record->n_elems;
+        }
+    }
+    else if (queue->used >= record->n_elems || queue->producers_done)
+    {
+        if (queue->used < record->n_elems)
+        {
+            record->n_elems = queue->used;
+        }
+        fifo_take(queue, record->n_elems, record->buf);
+    }
+    else if (state == COMBINING_TRY_POP)
+    {
+        record->n_elems = queue->used;
+        if (queue->used == 0)
+        {
+            record->retval = TSQUEUE_EMPTY;
+        }
+        fifo_take(queue, record->n_elems, record->buf);
+    }
+    else
+    {
+        done = false;
+    }
+
+    return done;
+}
 
-int tsqueue_create(struct tsqueue **queue, void *data, size_t capacity,
-                   size_t elem_size, size_t used)
+static void fifo_take(struct tsqueue *queue, size_t n_elems, void *out)
 {
-    int retval = 0;
+    memcpy(out, queue->data, n_elems * queue->elem_size);
+    queue->used -= n_elems;
+    memmove(queue->data, (char *)queue->data + (n_elems * queue->elem_size),
+            queue->used * queue->elem_size);
+}
+
+void tsqueue_set_done(struct tsqueue *queue, bool done)
+{
+    if (queue->shared != NULL)
+    {
+        tsqueue_shared_set_done(queue->shared, done);
+        return;
+    }
 
-    *queue = malloc(sizeof(**queue));
+    lock_acquire(&queue->lock);
 
-    if (queue == NULL) {
-        retval = errno;
+    queue->producers_done = done;
+    if (queue->n_records != 0)
+    {
+        combine(queue, true);
     }
+    for (size_t i = 0; i < queue->n_consumers_waiting; ++i)
+    {
+        lock_cond_signal(&queue->consumer_wakeup);
+    }
+    wake_all_waiters(queue);
+    sync_eventfds(queue);
 
-    if (retval == 0) {
-        **queue = (struct tsqueue){
-            .capacity = capacity,
-            .elem_size = elem_size,
-            .data = data,
-            .used = used
-        };
+    lock_release(&queue->lock);
+}
+
+static int wait_for_space_internal(struct tsqueue *queue, size_t n_elems)
+{
+    int retval = 0;
+
+    if (n_elems > queue->capacity)
+    {
+        retval = TSQUEUE_TOO_MANY;
     }
 
-    int steps_done = 0;
-    if (retval == 0)
+    if (retval == 0 && n_elems != 0)
     {
-        retval = pthread_mutex_init(&(*queue)->lock, NULL);
+        // Relaxed queues only take the lock here to wait, consumers check
+        // producer_n_elems after updating present. When a producer with the
+        // smallest request stops waiting the others keep its value, which
+        // only costs them spurious wakeups.
+        ++queue->n_producers_waiting;
+        if (queue->producer_n_elems == 0 || n_elems < queue->producer_n_elems)
+        {
+            queue->producer_n_elems = n_elems;
+        }
+        while (!queue->die
+               && (queue->capacity
+                   - ((queue->n_subqueues != 0) ? queue->present
+                                                : queue->used)) < n_elems)
+        {
+            lock_cond_wait(&queue->producer_wakeup, &queue->lock);
+        }
+        if (--queue->n_producers_waiting == 0)
+        {
+            queue->producer_n_elems = 0;
+        }
     }
 
-    if (retval == 0)
+    if (queue->die)
     {
-        steps_done = 1;
-        retval = pthread_cond_init(&(*queue)->producer_wakeup, NULL);
+        retval = TSQUEUE_CLOSED;
+        signal_if_all_dead(queue);
     }
 
-    if (retval == 0)
+    return retval;
+}
+
+static void waiter_push(struct tsqueue *queue, struct waiter *waiter)
+{
+    waiter->next = NULL;
+    waiter->prev = queue->waiters_tail;
+    if (queue->waiters_tail != NULL)
     {
-        steps_done = 2;
-        retval = pthread_cond_init(&(*queue)->consumer_wakeup, NULL);
+        queue->waiters_tail->next = waiter;
+    }
+    else
+    {
+        queue->waiters_head = waiter;
     }
+    queue->waiters_tail = waiter;
+    waiter->queued = true;
+}
 
-    if (retval == 0)
+static void waiter_remove(struct tsqueue *queue, struct waiter *waiter)
+{
+    if (waiter->prev != NULL)
     {
-        steps_done = 3;
-        retval = pthread_cond_init(&(*queue)->all_dead, NULL);
+        waiter->prev->next = waiter->next;
+    }
+    else
+    {
+        queue->waiters_head = waiter->next;
     }
 
-    if (retval == 0)
+    if (waiter->next != NULL)
     {
-        steps_done = 4;
+        waiter->next->prev = waiter->prev;
+    }
+    else
+    {
+        queue->waiters_tail = waiter->prev;
     }
+    waiter->queued = false;
+}
 
-    if  (retval != 0)
+static struct waiter *choose_waiter(struct tsqueue *queue)
+{
+    struct waiter *chosen = NULL;
+
+    switch (queue->wake_order)
     {
-        switch (steps_done)
+    case TSQUEUE_WAKE_FIFO:
+        chosen = queue->waiters_head;
+        break;
+    case TSQUEUE_WAKE_LIFO:
+        chosen = queue->waiters_tail;
+        break;
+    case TSQUEUE_WAKE_ROUND_ROBIN:
+    {
+        // The waiter with the lowest id not yet woken this round, or the
+        // lowest id overall to start a new round.
+        struct waiter *lowest = NULL;
+        for (struct waiter *w = queue->waiters_head; w != NULL; w = w->next)
         {
-        case 4:
-            pthread_cond_destroy(&(*queue)->all_dead);
-            /* FALL THROUGH */
-        case 3:
-            pthread_cond_destroy(&(*queue)->consumer_wakeup);
-            /* FALL THROUGH */
-        case 2:
-            pthread_cond_destroy(&(*queue)->producer_wakeup);
-            /* FALL THROUGH */
-        case 1:
-            pthread_mutex_destroy(&(*queue)->lock);
-            /* FALL THROUGH */
-        default:
-            break;
+            if (w->consumer_id >= queue->next_consumer_id
+                && (chosen == NULL || w->consumer_id < chosen->consumer_id))
+            {
+                chosen = w;
+            }
+            if (lowest == NULL || w->consumer_id < lowest->consumer_id)
+            {
+                lowest = w;
+            }
         }
-
-        free(*queue);
+        if (chosen == NULL)
+        {
+            chosen = lowest;
+        }
+        break;
+    }
     }
 
-    return retval;
+    return chosen;
 }
 
-void tsqueue_close(struct tsqueue *queue)
+static void wake_waiter(struct tsqueue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-
-    queue->die = true;
-
-    if (queue->producer_n_elems != 0)
+    struct waiter *waiter = choose_waiter(queue);
+    if (waiter != NULL)
     {
-        pthread_cond_signal(&queue->producer_wakeup);
+        wake(queue, waiter);
     }
+}
 
-    for (size_t i = 0; i < queue->n_consumers_waiting; ++i)
+static void wake(struct tsqueue *queue, struct waiter *waiter)
+{
+    waiter_remove(queue, waiter);
+    queue->next_consumer_id = waiter->consumer_id + 1;
+    lock_cond_signal(&waiter->wakeup);
+}
+
+static void wake_all_waiters(struct tsqueue *queue)
+{
+    while (queue->waiters_head != NULL)
     {
-        pthread_cond_signal(&queue->consumer_wakeup);
+        struct waiter *waiter = queue->waiters_head;
+        waiter_remove(queue, waiter);
+        lock_cond_signal(&waiter->wakeup);
     }
+}
 
-    while (queue->producer_n_elems != 0 && queue->n_consumers_waiting != 0)
+static unsigned long thread_consumer_id(void)
+{
+    static atomic_ulong next_id = 1;
+    static _Thread_local unsigned long id = 0;
+    if (id == 0)
     {
-        pthread_cond_wait(&queue->all_dead, &queue->lock);
+        id = atomic_fetch_add(&next_id, 1);
     }
-
-    pthread_mutex_unlock(&queue->lock);
+    return id;
 }
 
-void tsqueue_destroy(struct tsqueue *queue, size_t *used)
+static void sync_eventfds(struct tsqueue *queue)
 {
-    tsqueue_close(queue);
+    sync_eventfd(queue->not_empty_fd, &queue->not_empty_set,
+                 queue->used != 0 || queue->producers_done || queue->die);
+    sync_eventfd(queue->not_full_fd, &queue->not_full_set,
+                 queue->used < queue->capacity || queue->die);
+}
 
-    if (used != NULL)
+static void sync_eventfd(int fd, bool *is_set, bool should_be_set)
+{
+    if (fd != -1 && *is_set != should_be_set)
     {
-        *used = queue->used;
+        // The counter only ever holds zero or one so a read always clears
+        // it. Neither call can fail on a valid non-blocking eventfd in this
+        // state.
+        uint64_t value = 1;
+        ssize_t res = should_be_set ? write(fd, &value, sizeof(value))
+                                    : read(fd, &value, sizeof(value));
+        (void)res;
+        *is_set = should_be_set;
     }
-
-    pthread_mutex_destroy(&queue->lock);
-    pthread_cond_destroy(&queue->producer_wakeup);
-    pthread_cond_destroy(&queue->consumer_wakeup);
-    pthread_cond_destroy(&queue->all_dead);
-    free(queue);
 }
 
-size_t tsqueue_capacity(struct tsqueue *queue)
+static void signal_if_all_dead(struct tsqueue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-    size_t capacity = queue->capacity;
-    pthread_mutex_unlock(&queue->lock);
-    return capacity;
+    if (queue->producer_n_elems == 0 && queue->n_consumers_waiting == 0)
+    {
+        lock_cond_signal(&queue->all_dead);
+    }
 }
 
-int tsqueue_wait_for_space(struct tsqueue *queue, size_t n_elems)
+static void prio_link(struct tsqueue *queue, size_t slot)
 {
-    pthread_mutex_lock(&queue->lock);
-    int retval = wait_for_space_internal(queue, n_elems);
-    pthread_mutex_unlock(&queue->lock);
-    return retval;
+    unsigned priority =
+        queue->priority((char *)queue->data + (slot * queue->elem_size));
+    if (priority >= queue->n_levels)
+    {
+        priority = queue->n_levels - 1;
+    }
+
+    unsigned long long key = priority;
+    if (queue->aging_ns != 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        unsigned long long interval =
+            ((unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec)
+            / queue->aging_ns;
+
+        // Nothing is waiting so no element can be overtaken by moving the
+        // base forward.
+        if (queue->used == 0 && interval > queue->base)
+        {
+            queue->base = interval;
+        }
+
+        // An element that arrives later than one already in the queue starts
+        // from a lower effective priority, this is what ages waiting
+        // elements. Keys are capped to the range covered by the levels, which
+        // still leaves every element with only a bounded number of keys in
+        // front of it.
+        key = ((interval > queue->base) ? interval : queue->base) + priority;
+        if (key > queue->base + queue->n_levels - 1)
+        {
+            key = queue->base + queue->n_levels - 1;
+        }
+    }
+
+    size_t level = key % queue->n_levels;
+    size_t index = queue->heads[level] + queue->counts[level];
+    if (index >= queue->capacity)
+    {
+        index -= queue->capacity;
+    }
+    queue->rings[level * queue->capacity + index] = slot;
+    ++queue->counts[level];
+    queue->nonempty |= 1u << level;
 }
 
-int tsqueue_put(struct tsqueue *queue, size_t n_elems, void *in)
+static size_t prio_unlink(struct tsqueue *queue)
 {
-    int retval = 0;
+    // The first non-empty level at or after the one holding base is the
+    // highest priority. Every key before it is empty so base can be moved up
+    // to it.
+    unsigned start = queue->base % queue->n_levels;
+    unsigned after_start = queue->nonempty & (~0u << start);
+    unsigned level =
+        (unsigned)ffs((int)((after_start != 0) ? after_start
+                                                : queue->nonempty)) - 1;
+
+    if (queue->aging_ns != 0)
+    {
+        queue->base += (level + queue->n_levels - start) % queue->n_levels;
+    }
 
-    pthread_mutex_lock(&queue->lock);
+    size_t slot = queue->rings[level * queue->capacity + queue->heads[level]];
+    ++queue->heads[level];
+    if (queue->heads[level] == queue->capacity)
+    {
+        queue->heads[level] = 0;
+    }
+    --queue->counts[level];
+    if (queue->counts[level] == 0)
+    {
+        queue->nonempty &= ~(1u << level);
+    }
+    return slot;
+}
 
-    retval = wait_for_space_internal(queue, n_elems);
+static void prio_compact(struct tsqueue *queue)
+{
+    size_t used = queue->used;
+    for (size_t i = 0; i < used; ++i)
+    {
+        queue->order[i] = prio_unlink(queue);
+    }
 
-    if (retval == 0)
+    // Apply the permutation in place, element i is moved to the front by
+    // following where earlier swaps have moved it to.
+    for (size_t i = 0; i < used; ++i)
     {
-        memcpy((char *)queue->data + (queue->used * queue->elem_size),
-               in, n_elems * queue->elem_size);
-        if (n_elems != 0 && queue->n_consumers_waiting != 0)
+        size_t j = queue->order[i];
+        while (j < i)
         {
-            pthread_cond_signal(&queue->consumer_wakeup);
+            j = queue->order[j];
         }
 
-        queue->used += n_elems;
+        char *a = (char *)queue->data + (i * queue->elem_size);
+        char *b = (char *)queue->data + (j * queue->elem_size);
+        for (size_t k = 0; k < queue->elem_size && a != b; ++k)
+        {
+            char tmp = a[k];
+            a[k] = b[k];
+            b[k] = tmp;
+        }
     }
-
-    pthread_mutex_unlock(&queue->lock);
-
-    return retval;
 }
 
-int tsqueue_pop(struct tsqueue *queue, size_t *n_elems, void *out)
+static int relaxed_init(struct tsqueue *queue, size_t used)
 {
     int retval = 0;
 
-    pthread_mutex_lock(&queue->lock);
-
-    if (*n_elems > queue->capacity)
+    size_t n = queue->n_subqueues;
+    queue->subqueues = aligned_alloc(CACHE_LINE_SIZE,
+                                     sizeof(*queue->subqueues) * n);
+    if (queue->subqueues == NULL)
     {
-        retval = TSQUEUE_TOO_MANY;
+        retval = errno;
     }
 
+    char *data = NULL;
+    uint64_t *stamps = NULL;
     if (retval == 0)
     {
-        ++queue->n_consumers_waiting;
-        while (!queue->producers_done && !queue->die && queue->used < *n_elems)
+        data = malloc(queue->elem_size * queue->capacity * n);
+        stamps = malloc(sizeof(*stamps) * queue->capacity * n);
+        if (data == NULL || stamps == NULL)
         {
-            pthread_cond_wait(&queue->consumer_wakeup, &queue->lock);
+            retval = errno;
         }
-        --queue->n_consumers_waiting;
     }
 
-    if (queue->die)
+    size_t n_locks = 0;
+    while (retval == 0 && n_locks < n)
     {
-        retval = TSQUEUE_CLOSED;
-        *n_elems = 0;
-        signal_if_all_dead(queue);
+        struct subqueue *sub = &queue->subqueues[n_locks];
+        retval = lock_init(&sub->lock, queue->lock.kind);
+        if (retval == 0)
+        {
+            atomic_init(&sub->head_stamp, UINT64_MAX);
+            sub->head = 0;
+            sub->count = 0;
+            sub->data = data + (queue->elem_size * queue->capacity * n_locks);
+            sub->stamps = stamps + (queue->capacity * n_locks);
+            ++n_locks;
+        }
     }
 
     if (retval == 0)
     {
-        if (queue->used < *n_elems)
+        // Deal the initial elements out to the sub-queues in order so they
+        // keep their order when stamped.
+        for (size_t i = 0; i < used; ++i)
         {
-            *n_elems = queue->used;
+            struct subqueue *sub = &queue->subqueues[i % n];
+            memcpy(sub->data + (sub->count * queue->elem_size),
+                   (char *)queue->data + (i * queue->elem_size),
+                   queue->elem_size);
+            sub->stamps[sub->count] = queue->next_stamp++;
+            if (sub->count++ == 0)
+            {
+                atomic_store(&sub->head_stamp, sub->stamps[0]);
+            }
+        }
+        atomic_store(&queue->available, used);
+        atomic_store(&queue->present, used);
+    }
+    else
+    {
+        for (size_t i = 0; i < n_locks; ++i)
+        {
+            lock_destroy(&queue->subqueues[i].lock);
         }
-        memcpy(out, queue->data, *n_elems * queue->elem_size);
-        queue->used -= *n_elems;
-        memmove(queue->data,
-                (char *)queue->data + (*n_elems * queue->elem_size),
-                queue->used * queue->elem_size);
+        free(stamps);
+        free(data);
+        free(queue->subqueues);
+        queue->subqueues = NULL;
+    }
 
-        if (queue->producer_n_elems != 0
-            && queue->producer_n_elems <= (queue->capacity - queue->used))
+    return retval;
+}
+
+static size_t relaxed_free(struct tsqueue *queue)
+{
+    size_t used = 0;
+
+    // Merge the sub-queues by stamp, this is slow but only done once.
+    while (true)
+    {
+        struct subqueue *oldest = NULL;
+        for (size_t i = 0; i < queue->n_subqueues; ++i)
         {
-            pthread_cond_signal(&queue->producer_wakeup);
+            struct subqueue *sub = &queue->subqueues[i];
+            if (sub->count != 0
+                && (oldest == NULL
+                    || sub->stamps[sub->head] < oldest->stamps[oldest->head]))
+            {
+                oldest = sub;
+            }
         }
 
-        if (queue->used != 0 && queue->n_consumers_waiting != 0)
+        if (oldest == NULL)
         {
-            pthread_cond_signal(&queue->consumer_wakeup);
+            break;
         }
+
+        memcpy((char *)queue->data + (used * queue->elem_size),
+               oldest->data + (oldest->head * queue->elem_size),
+               queue->elem_size);
+        oldest->head = (oldest->head + 1) % queue->capacity;
+        --oldest->count;
+        ++used;
     }
 
-    pthread_mutex_unlock(&queue->lock);
+    for (size_t i = 0; i < queue->n_subqueues; ++i)
+    {
+        lock_destroy(&queue->subqueues[i].lock);
+    }
+    free(queue->subqueues[0].stamps);
+    free(queue->subqueues[0].data);
+    free(queue->subqueues);
 
-    return retval;
+    return used;
 }
 
-void tsqueue_set_done(struct tsqueue *queue, bool done)
+static int relaxed_put(struct tsqueue *queue, size_t n_elems, void *in)
 {
-    pthread_mutex_lock(&queue->lock);
+    int retval = 0;
 
-    queue->producers_done = done;
-    for (size_t i = 0; i < queue->n_consumers_waiting; ++i)
+    lock_acquire(&queue->lock);
+    retval = wait_for_space_internal(queue, n_elems);
+    if (retval == 0)
+    {
+        atomic_fetch_add(&queue->present, n_elems);
+    }
+    lock_release(&queue->lock);
+
+    for (size_t i = 0; i < n_elems && retval == 0; ++i)
+    {
+        // present never exceeds capacity and every sub-queue can hold
+        // capacity elements, so the chosen sub-queue can not be full.
+        struct subqueue *sub =
+            &queue->subqueues[thread_random() % queue->n_subqueues];
+        lock_acquire(&sub->lock);
+        size_t index = (sub->head + sub->count) % queue->capacity;
+        memcpy(sub->data + (index * queue->elem_size),
+               (char *)in + (i * queue->elem_size), queue->elem_size);
+        sub->stamps[index] = queue->next_stamp++;
+        if (sub->count++ == 0)
+        {
+            atomic_store(&sub->head_stamp, sub->stamps[index]);
+        }
+        lock_release(&sub->lock);
+    }
+
+    if (retval == 0 && n_elems != 0)
     {
-        pthread_cond_signal(&queue->consumer_wakeup);
+        atomic_fetch_add(&queue->available, n_elems);
+
+        // Consumers increment n_consumers_waiting before checking available
+        // so either they will see the new elements or we will see them.
+        if (queue->n_consumers_waiting != 0)
+        {
+            lock_acquire(&queue->lock);
+            for (size_t i = 0;
+                 i < n_elems && i < queue->n_consumers_waiting; ++i)
+            {
+                lock_cond_signal(&queue->consumer_wakeup);
+            }
+            lock_release(&queue->lock);
+        }
     }
 
-    pthread_mutex_unlock(&queue->lock);
+    return retval;
 }
 
-static int wait_for_space_internal(struct tsqueue *queue, size_t n_elems)
+static int relaxed_pop(struct tsqueue *queue, size_t *n_elems, void *out,
+                       bool wait)
 {
     int retval = 0;
+    size_t reserved = 0;
 
-    if (n_elems > queue->capacity)
+    if (*n_elems > queue->capacity)
     {
         retval = TSQUEUE_TOO_MANY;
     }
 
-    if (queue->producer_n_elems != 0)
+    if (retval == 0 && !queue->die)
     {
-        retval = TSQUEUE_SINGLE_PRODUCER;
+        reserved = relaxed_reserve(queue, *n_elems, false);
     }
 
-    if (retval == 0)
+    if (retval == 0 && reserved == 0 && *n_elems != 0 && !wait)
+    {
+        reserved = relaxed_reserve(queue, *n_elems, true);
+        if (reserved == 0 && !queue->producers_done && !queue->die)
+        {
+            retval = TSQUEUE_EMPTY;
+        }
+    }
+    else if (retval == 0 && reserved == 0 && *n_elems != 0)
     {
-        queue->producer_n_elems = n_elems;
-        while (!queue->die && (queue->capacity - queue->used) < n_elems)
+        lock_acquire(&queue->lock);
+        ++queue->n_consumers_waiting;
+        while (!queue->die
+               && (reserved = relaxed_reserve(queue, *n_elems,
+                                              queue->producers_done)) == 0
+               && !queue->producers_done)
+        {
+            lock_cond_wait(&queue->consumer_wakeup, &queue->lock);
+        }
+        --queue->n_consumers_waiting;
+
+        if (queue->die)
         {
-            pthread_cond_wait(&queue->producer_wakeup, &queue->lock);
+            signal_if_all_dead(queue);
         }
-        queue->producer_n_elems = 0;
+        lock_release(&queue->lock);
     }
 
     if (queue->die)
     {
+        atomic_fetch_add(&queue->available, reserved);
         retval = TSQUEUE_CLOSED;
-        signal_if_all_dead(queue);
+        reserved = 0;
+    }
+
+    for (size_t i = 0; i < reserved; ++i)
+    {
+        relaxed_remove(queue, (char *)out + (i * queue->elem_size));
+    }
+
+    if (reserved != 0)
+    {
+        atomic_fetch_sub(&queue->present, reserved);
+
+        // See relaxed_put().
+        if (queue->producer_n_elems != 0)
+        {
+            lock_acquire(&queue->lock);
+            if (queue->producer_n_elems != 0
+                && queue->producer_n_elems
+                   <= queue->capacity - queue->present)
+            {
+                lock_cond_broadcast(&queue->producer_wakeup);
+            }
+            lock_release(&queue->lock);
+        }
     }
 
+    *n_elems = reserved;
     return retval;
 }
 
-static void signal_if_all_dead(struct tsqueue *queue)
+static size_t relaxed_reserve(struct tsqueue *queue, size_t n_elems,
+                              bool partial)
 {
-    if (queue->producer_n_elems == 0 && queue->n_consumers_waiting == 0)
+    size_t available = atomic_load(&queue->available);
+    size_t reserved;
+    do
+    {
+        if (available >= n_elems)
+        {
+            reserved = n_elems;
+        }
+        else
+        {
+            reserved = partial ? available : 0;
+        }
+    } while (reserved != 0
+             && !atomic_compare_exchange_weak(&queue->available, &available,
+                                              available - reserved));
+
+    return reserved;
+}
+
+static void relaxed_remove(struct tsqueue *queue, void *out)
+{
+    size_t n = queue->n_subqueues;
+    size_t attempts = 0;
+    bool found = false;
+
+    while (!found)
+    {
+        struct subqueue *sub;
+        if (attempts < n)
+        {
+            uint64_t r = thread_random();
+            struct subqueue *a = &queue->subqueues[r % n];
+            struct subqueue *b = &queue->subqueues[(r >> 32) % n];
+            sub = (atomic_load_explicit(&a->head_stamp, memory_order_relaxed)
+                   <= atomic_load_explicit(&b->head_stamp,
+                                           memory_order_relaxed))
+                  ? a : b;
+        }
+        else
+        {
+            // With few elements left two random choices rarely find one, so
+            // fall back to walking the sub-queues.
+            sub = &queue->subqueues[attempts % n];
+        }
+        ++attempts;
+
+        if (atomic_load_explicit(&sub->head_stamp, memory_order_relaxed)
+            != UINT64_MAX)
+        {
+            lock_acquire(&sub->lock);
+            if (sub->count != 0)
+            {
+                memcpy(out, sub->data + (sub->head * queue->elem_size),
+                       queue->elem_size);
+                sub->head = (sub->head + 1) % queue->capacity;
+                --sub->count;
+                atomic_store(&sub->head_stamp,
+                             (sub->count != 0) ? sub->stamps[sub->head]
+                                               : UINT64_MAX);
+                found = true;
+            }
+            lock_release(&sub->lock);
+        }
+    }
+}
+
+static uint64_t thread_random(void)
+{
+    // xorshift64*, seeded from the address of the state so each thread gets
+    // a different sequence.
+    static _Thread_local uint64_t state = 0;
+    if (state == 0)
     {
-        pthread_cond_signal(&queue->all_dead);
+        state = (uint64_t)(uintptr_t)&state | 1;
     }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * UINT64_C(2685821657736338717);
 }
@@ -14,18 +14,53 @@
  * - Supports pushing and popping multiple elements atomically.
  * - Leaves elements in the user provided memory after destroying the queue in
  *   the order they would have been popped.
+ * - Optionally orders elements by priority instead, with waiting elements
+ *   aging towards the highest priority so they can not be starved.
+ * - Optionally relaxes FIFO order so that many consumers do not contend on a
+ *   single lock.
+ * - Optionally uses flat combining, where one thread carries out the
+ *   operations of every waiting thread, so the queue stays in one cache.
+ * - Optionally lives in POSIX shared memory so that producers in other
+ *   processes can put elements in to it.
+ * - The kind of lock protecting the queue can be chosen when it is created,
+ *   see lock.h.
+ * - Optionally provides eventfds so that it can be waited on with poll() or
+ *   epoll alongside other file descriptors.
  */
 
 #ifndef TSQUEUE_H
 #define TSQUEUE_H
 
+#include "lock.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <limits.h>
+#include <time.h>
 
-/** Thread safe single-producer, multi-consumer FIFO queue. */
+/** Thread safe single-producer, multi-consumer FIFO or priority queue. */
 typedef struct tsqueue tsqueue;
 
+/** The order consumers waiting in tsqueue_pop() are woken in. */
+enum tsqueue_wake_order
+{
+    /** Wake the consumer that has been waiting the longest. This spreads
+     * work evenly over all consumers. */
+    TSQUEUE_WAKE_FIFO,
+
+    /** Wake the consumer that started waiting most recently. Under light
+     * load this keeps work on a few consumers whose caches are warm while
+     * the rest stay asleep. */
+    TSQUEUE_WAKE_LIFO,
+
+    /** Wake consumers in turn in the order they first used any tsqueue,
+     * skipping consumers that are not waiting. */
+    TSQUEUE_WAKE_ROUND_ROBIN
+};
+
+/** The maximum number of priority levels supported by tsqueue_create_prio(),
+ * one for each bit in an int. */
+#define TSQUEUE_MAX_LEVELS (sizeof(int) * CHAR_BIT)
+
 /**
  * @brief Create a new tsqueue.
  *
@@ -37,11 +72,150 @@ typedef struct tsqueue tsqueue;
  * @param used The number of items already in @p data, these elements will be
  *             accessible via tsqueue_pop(). The first element to be popped
  *             will be the first element of @p data.
+ * @param lock The kind of lock to protect the queue with.
  *
  * @return Zero if the function succeeds, else a POSIX error number.
  */
 int tsqueue_create(tsqueue **queue, void *data, size_t capacity,
-                   size_t elem_size, size_t used);
+                   size_t elem_size, size_t used, enum lock_kind lock);
+
+/**
+ * @brief Create a new tsqueue which pops elements in priority order.
+ *
+ * Elements of equal priority are popped in FIFO order. If @p aging_interval
+ * is non-zero then every element that has waited for an interval is treated
+ * as having one higher priority than elements that arrive after it, so an
+ * element of priority p can only be overtaken by elements arriving within p
+ * intervals of it. Each level is a separate ring and a bitmap of non-empty
+ * levels is kept, so both puts and pops are O(1).
+ *
+ * @param[out] queue The tsqueue, will be NULL if creation fails.
+ * @param[in] data Array used to store queue elements, must not be used until
+ *                 tsqueue_destroy() is called.
+ * @param capacity The number of elements that @p data can hold.
+ * @param elem_size The size of an element in @p data.
+ * @param used The number of items already in @p data, these elements will be
+ *             accessible via tsqueue_pop().
+ * @param n_levels The number of priority levels, must be non-zero and no more
+ *                 than TSQUEUE_MAX_LEVELS.
+ * @param[in] priority Returns the priority of an element, zero is the highest
+ *                     priority. Values of @p n_levels or more are treated as
+ *                     the lowest priority.
+ * @param aging_interval The time taken for a waiting element to gain one level
+ *                       of priority, zero to disable aging.
+ * @param lock The kind of lock to protect the queue with.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int tsqueue_create_prio(tsqueue **queue, void *data, size_t capacity,
+                        size_t elem_size, size_t used, unsigned n_levels,
+                        unsigned (*priority)(const void *elem),
+                        struct timespec aging_interval, enum lock_kind lock);
+
+/**
+ * @brief Create a new tsqueue which pops elements in approximately FIFO
+ *        order.
+ *
+ * Elements are spread over @p n_subqueues sub-queues which each have their own
+ * lock. Each element is put in a random sub-queue and consumers take the
+ * oldest element of two random sub-queues, so an element may be popped before
+ * an older one but the expected error in its position is small. Consumers
+ * only take the queue-wide lock when the queue is empty. This scales with the
+ * number of consumers where a strict FIFO queue does not, @p n_subqueues
+ * should be a small multiple of the number of consumers.
+ *
+ * The memory used by the queue is allocated by the queue, @p data is only
+ * used for the initial elements and the elements returned by
+ * tsqueue_destroy().
+ *
+ * @param[out] queue The tsqueue, will be NULL if creation fails.
+ * @param[in] data Array holding the initial queue elements, must not be used
+ *                 until tsqueue_destroy() is called.
+ * @param capacity The number of elements that @p data can hold.
+ * @param elem_size The size of an element in @p data.
+ * @param used The number of items already in @p data.
+ * @param n_subqueues The number of sub-queues, must be at least two.
+ * @param lock The kind of lock to protect the queue and each sub-queue with.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int tsqueue_create_relaxed(tsqueue **queue, void *data, size_t capacity,
+                           size_t elem_size, size_t used,
+                           size_t n_subqueues, enum lock_kind lock);
+
+/**
+ * @brief Create a new FIFO tsqueue which uses flat combining.
+ *
+ * Rather than each thread taking the lock and operating on the queue, threads
+ * publish their requests in one of @p n_records records. Whichever thread
+ * holds the lock carries out every pending request before releasing it, while
+ * the other threads wait for their own record to be completed. The queue and
+ * its metadata therefore stay in the cache of a single core and the lock is
+ * taken far less often under contention. Any number of producers may put
+ * elements at once. @p n_records should be at least the number of threads
+ * using the queue. A thread that finds no free record takes the lock and
+ * carries out its own request instead, which loses the benefit of
+ * combining.
+ *
+ * @param[out] queue The tsqueue, will be NULL if creation fails.
+ * @param[in] data Array used to store queue elements, must not be used until
+ *                 tsqueue_destroy() is called.
+ * @param capacity The number of elements that @p data can hold.
+ * @param elem_size The size of an element in @p data.
+ * @param used The number of items already in @p data.
+ * @param n_records The number of request records, must be non-zero.
+ * @param lock The kind of lock taken by the combining thread.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+int tsqueue_create_combining(tsqueue **queue, void *data, size_t capacity,
+                             size_t elem_size, size_t used,
+                             size_t n_records, enum lock_kind lock);
+
+/**
+ * @brief Create a new FIFO tsqueue in a POSIX shared memory segment.
+ *
+ * Other processes can use the queue after calling tsqueue_open_shared(). A
+ * shared queue allows any number of producers, in this process or others, to
+ * call tsqueue_put() and tsqueue_wait_for_space() at once. A producer process
+ * that dies while using the queue does not prevent others from using it.
+ *
+ * The segment is removed by tsqueue_destroy(), elements left in the queue at
+ * that point are discarded.
+ *
+ * @param[out] queue The tsqueue, will be NULL if creation fails.
+ * @param[in] name The name of the segment, see shm_open(). A segment of
+ *                 the same name left behind by a process that has died is
+ *                 removed, even if it died while creating the segment, any
+ *                 other must not already exist.
+ * @param capacity The number of elements the queue can hold.
+ * @param elem_size The size of an element. Elements must not contain
+ *                  pointers as the segment may be mapped at a different
+ *                  address in each process.
+ *
+ * @return Zero if the function succeeds, EEXIST if the segment belongs to a
+ *         running process, else a POSIX error number.
+ */
+int tsqueue_create_shared(tsqueue **queue, const char *name, size_t capacity,
+                          size_t elem_size);
+
+/**
+ * @brief Open a tsqueue created by tsqueue_create_shared() in another
+ *        process.
+ *
+ * Calling tsqueue_destroy() on the returned queue only unmaps it, it does not
+ * close the queue for other processes.
+ *
+ * @param[out] queue The tsqueue, will be NULL if opening fails.
+ * @param[in] name The name given to tsqueue_create_shared().
+ * @param elem_size The size of an element, must match the size given to
+ *                  tsqueue_create_shared().
+ *
+ * @return Zero if the function succeeds, EAGAIN if the queue is still being
+ *         created, EINVAL if @p elem_size does not match the queue, else a
+ *         POSIX error number.
+ */
+int tsqueue_open_shared(tsqueue **queue, const char *name, size_t elem_size);
 
 /**
  * @brief Forces all tsqueue_put() and tsqueue_pop() functions using this
@@ -50,7 +224,8 @@ int tsqueue_create(tsqueue **queue, void *data, size_t capacity,
  * Will block until all calls have exited. This function is intended to be
  * used before tsqueue_destroy as a way to signal to other threads that they
  * should stop reading from the queue. All future calls to tsqueue_put() and
- * tsqueue_pop() will also return TSQUEUE_CLOSED.
+ * tsqueue_pop() will also return TSQUEUE_CLOSED. For a shared queue this
+ * only waits for calls in this process.
  *
  * @param[in] queue The tsqueue to close.
  */
@@ -81,9 +256,27 @@ void tsqueue_destroy(tsqueue *queue, size_t *used);
  */
 size_t tsqueue_capacity(tsqueue *queue);
 
+/**
+ * @brief Checks whether there are @p n_elems free spaces in the queue.
+ *
+ * Consumers only ever free space, so while no other producer puts elements
+ * a tsqueue_put() of @p n_elems elements after this returns true will not
+ * wait.
+ *
+ * @param[in] queue The tsqueue.
+ * @param n_elems The number of elements.
+ *
+ * @return True if @p n_elems elements could be put without waiting.
+ */
+bool tsqueue_has_space(tsqueue *queue, size_t n_elems);
+
 /**
  * @brief Blocks until there are @p n_elems free spaces in the queue.
  *
+ * Unlike tsqueue_put(), any number of threads may wait for space at once,
+ * including while another thread puts elements. Producers which take turns
+ * to put can therefore wait without holding up each other.
+ *
  * @param[in] queue The tsqueue.
  * @param n_elems The number of elements to wait for.
  *
@@ -93,9 +286,6 @@ size_t tsqueue_capacity(tsqueue *queue);
  *
  *         TSQUEUE_TOO_MANY if @p n_elems is greater than the queue's
  *         capacity.
- *
- *         TSQUEUE_SINGLE_PRODUCER if a tsqueue_put() or
- *         tsqueue_wait_for_space() call is already running.
  */
 int tsqueue_wait_for_space(tsqueue *queue, size_t n_elems);
 
@@ -116,9 +306,6 @@ int tsqueue_wait_for_space(tsqueue *queue, size_t n_elems);
  *
  *         TSQUEUE_TOO_MANY if @p n_elems is greater than the queue's
  *         capacity.
- *
- *         TSQUEUE_SINGLE_PRODUCER if a a tsqueue_put() or
- *         tsqueue_wait_for_space() call is already running.
  */
 int tsqueue_put(tsqueue *queue, size_t n_elems, void *in);
 
@@ -144,6 +331,87 @@ int tsqueue_put(tsqueue *queue, size_t n_elems, void *in);
  */
 int tsqueue_pop(tsqueue *queue, size_t *n_elems, void *out);
 
+/**
+ * @brief Retrieve elements from a tsqueue without blocking.
+ *
+ * Retrieves as many elements as are available, up to @p n_elems.
+ *
+ * @param[in] queue The tsqueue.
+ * @param[in,out] n_elems The maximum number of elements to place in @p
+ *                        out. Will be set to the actual number of elements
+ *                        retrieved.
+ * @param[out] out Buffer to place the elements in. The first element was
+ *                 first in the queue.
+ *
+ * @return Zero if the function is successful. Zero elements are only
+ *         retrieved if `tsqueue_set_done(queue, true)` has been called.
+ *
+ *         TSQUEUE_EMPTY if there are no elements and more may be added.
+ *
+ *         TSQUEUE_CLOSED if the queue is closed.
+ *
+ *         ENOTSUP if the queue is a shared queue.
+ */
+int tsqueue_try_pop(tsqueue *queue, size_t *n_elems, void *out);
+
+/**
+ * @brief Get eventfds which reflect the state of the queue, creating them if
+ *        this is the first call.
+ *
+ * @p not_empty_fd is readable while tsqueue_try_pop() would not return
+ * TSQUEUE_EMPTY. @p not_full_fd is readable while there is space for at least
+ * one element or the queue is closed. The descriptors are level triggered
+ * from the point of view of poll() and epoll, they must not be read or written
+ * by the caller. They are closed by tsqueue_destroy().
+ *
+ * As other consumers may take elements first, consumers woken by
+ * @p not_empty_fd should use tsqueue_try_pop() rather than tsqueue_pop().
+ *
+ * @param[in] queue The tsqueue.
+ * @param[out] not_empty_fd Set to the eventfd signalling available elements.
+ * @param[out] not_full_fd Set to the eventfd signalling available space.
+ *
+ * @return Zero if the function succeeds, ENOTSUP for relaxed and shared
+ *         queues, else a POSIX error number.
+ */
+int tsqueue_enable_eventfds(tsqueue *queue, int *not_empty_fd,
+                            int *not_full_fd);
+
+/**
+ * @brief Set the order that waiting consumers are woken in, the default is
+ *        TSQUEUE_WAKE_FIFO.
+ *
+ * Has no effect on relaxed, combining and shared queues.
+ *
+ * @param[in] queue The tsqueue.
+ * @param order The wake order.
+ */
+void tsqueue_set_wake_order(tsqueue *queue, enum tsqueue_wake_order order);
+
+/**
+ * @brief Returns the number of times the calling thread has been woken while
+ *        waiting in tsqueue_pop() on any FIFO or priority queue, or in the
+ *        pop function of a queue from tsqueue_typed.h.
+ *
+ * @return The number of wakeups.
+ */
+unsigned long tsqueue_thread_wakeups(void);
+
+/**
+ * @brief Count a wakeup of the calling thread, see tsqueue_thread_wakeups().
+ *        Used by the queues from tsqueue_typed.h.
+ */
+void tsqueue_count_wakeup(void);
+
+/**
+ * @brief Returns the id of the calling thread used by
+ *        TSQUEUE_WAKE_ROUND_ROBIN, given out in the order threads first ask
+ *        for one. Used by the queues from tsqueue_typed.h.
+ *
+ * @return The id, never zero.
+ */
+unsigned long tsqueue_thread_consumer_id(void);
+
 /**
  * @brief Indicate that no more items will be placed in the queue. Can be
  *        reversed.
@@ -166,9 +434,8 @@ enum
     /** tsqueue_put() was called with more items than the queue can hold. */
     TSQUEUE_TOO_MANY,
 
-    /** A tsqueue_put() or tsqueue_wait_for_space() call was made while one
-     * was already running. */
-    TSQUEUE_SINGLE_PRODUCER
+    /** tsqueue_try_pop() was called on an empty queue. */
+    TSQUEUE_EMPTY
 };
 
 #endif /* TSQUEUE_H */
@@ -0,0 +1,691 @@
+/**
+ * @file   tsqueue_shared.c
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  Implementation of tsqueue_shared.h.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "tsqueue_shared.h"
+#include "tsqueue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The value of the ready field of a header once it is initialised. */
+#define SHARED_READY_MAGIC 0x74737172u
+
+/** How long to wait for the creator of a segment to record its pid before
+ * deciding that it died first, in milliseconds. */
+#define SHARED_OWNER_TIMEOUT_MS 1000
+
+/** How often to look for the pid of the creator of a segment, in
+ * milliseconds. */
+#define SHARED_OWNER_POLL_MS 10
+
+/** The header at the start of the shared memory segment. */
+struct tsqueue_shared
+{
+    /** The lock for the data in this struct, process-shared and robust. */
+    pthread_mutex_t lock;
+
+    /** Used to signal waiting producers. */
+    pthread_cond_t producer_wakeup;
+
+    /** Used to signal waiting consumers. */
+    pthread_cond_t consumer_wakeup;
+
+    /** SHARED_READY_MAGIC once the rest of the header is initialised, stored
+     * last with release ordering. */
+    atomic_uint ready;
+
+    /** The process that created the segment, zero until it is recorded,
+     * which is the first store to a new header. */
+    _Atomic pid_t owner;
+
+    /** The size of the whole segment. */
+    size_t size;
+
+    /** The capacity of the queue. */
+    size_t capacity;
+
+    /** The size of an element in the queue. */
+    size_t elem_size;
+
+    /** The offset of the ring of elements from the start of this struct. */
+    size_t data_offset;
+
+    /** The index in the ring of the first element. */
+    size_t head;
+
+    /** The number of used elements in the ring. */
+    size_t used;
+
+    /** The number of waiting producers. */
+    size_t n_producers_waiting;
+
+    /** The number of waiting consumers. */
+    size_t n_consumers_waiting;
+
+    /** Indicates that consumers should not wait for more items to be
+     * inserted. */
+    bool producers_done;
+
+    /** Indicates that the queue is about to be destroyed and all functions
+     * should return an error indicator. */
+    bool die;
+};
+
+/**
+ * @brief Lock the header, recovering the lock if its owner died.
+ *
+ * @param shared The header.
+ */
+static void shared_lock(struct tsqueue_shared *shared);
+
+/**
+ * @brief pthread_cond_wait() on @p cond, recovering the lock if its owner
+ *        died.
+ *
+ * @param shared The header, must be locked.
+ * @param cond The condition variable to wait on.
+ */
+static void shared_wait(struct tsqueue_shared *shared, pthread_cond_t *cond);
+
+/**
+ * @brief Wait for space in the queue, the lock must be held.
+ *
+ * @param shared The header.
+ * @param n_elems Number of unused elements to wait for.
+ *
+ * @return Zero if successful, TSQUEUE_TOO_MANY or TSQUEUE_CLOSED.
+ */
+static int shared_wait_for_space(struct tsqueue_shared *shared,
+                                 size_t n_elems);
+
+/**
+ * @brief Initialise the synchronisation primitives of a new header.
+ *
+ * @param shared The header.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int shared_init_sync(struct tsqueue_shared *shared);
+
+/**
+ * @brief Map the header of an existing segment and check that it is
+ *        initialised.
+ *
+ * @param[out] shared The mapped segment, will be NULL if mapping fails.
+ * @param[in] name The name of the segment, see shm_open().
+ *
+ * @return Zero if the function succeeds, EAGAIN if the segment is still
+ *         being initialised, EINVAL if it is too small to be a queue, else a
+ *         POSIX error number.
+ */
+static int shared_map(struct tsqueue_shared **shared, const char *name);
+
+/**
+ * @brief Read the pid of the process that created a segment, whether or not
+ *        the header is initialised.
+ *
+ * @param[in] name The name of the segment, see shm_open().
+ * @param[out] owner The pid, zero if it has not been recorded yet.
+ *
+ * @return Zero if the function succeeds, else a POSIX error number.
+ */
+static int shared_owner(const char *name, pid_t *owner);
+
+/**
+ * @brief Remove a segment left behind by a process that died without
+ *        destroying its queue, including one that died before it finished
+ *        creating the segment.
+ *
+ * @param[in] name The name of the segment, see shm_open().
+ *
+ * @return True if the segment was stale and has been removed, or has
+ *         already gone.
+ */
+static bool shared_unlink_stale(const char *name);
+
+/**
+ * @brief Copy between the ring and a linear buffer, wrapping at the end of
+ *        the ring.
+ *
+ * @param shared The header.
+ * @param index The index in the ring of the first element.
+ * @param n_elems The number of elements to copy.
+ * @param buffer The linear buffer.
+ * @param to_ring True to copy from @p buffer to the ring, false for the
+ *                reverse.
+ */
+static void shared_copy(struct tsqueue_shared *shared, size_t index,
+                        size_t n_elems, void *buffer, bool to_ring);
+
+int tsqueue_shared_create(struct tsqueue_shared **shared, const char *name,
+                          size_t capacity, size_t elem_size)
+{
+    int retval = 0;
+
+    *shared = NULL;
+
+    // Round the header up so that elements are suitably aligned.
+    size_t data_offset =
+        (sizeof(**shared) + _Alignof(max_align_t) - 1)
+        / _Alignof(max_align_t) * _Alignof(max_align_t);
+    size_t size = data_offset + capacity * elem_size;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1 && errno == EEXIST && shared_unlink_stale(name))
+    {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    }
+    if (fd == -1)
+    {
+        retval = errno;
+    }
+
+    if (retval == 0 && ftruncate(fd, (off_t)size) == -1)
+    {
+        retval = errno;
+    }
+
+    void *map = MAP_FAILED;
+    if (retval == 0)
+    {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        // The segment is zero filled by ftruncate(), so ready is not yet
+        // set and other processes will not use the header. The owner is
+        // recorded first so that they can tell if this process dies before
+        // setting ready.
+        *shared = map;
+        atomic_store_explicit(&(*shared)->owner, getpid(),
+                              memory_order_relaxed);
+        (*shared)->size = size;
+        (*shared)->capacity = capacity;
+        (*shared)->elem_size = elem_size;
+        (*shared)->data_offset = data_offset;
+        retval = shared_init_sync(*shared);
+    }
+
+    if (retval == 0)
+    {
+        atomic_store_explicit(&(*shared)->ready, SHARED_READY_MAGIC,
+                              memory_order_release);
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    if (retval != 0)
+    {
+        if (map != MAP_FAILED)
+        {
+            munmap(map, size);
+        }
+        if (fd != -1)
+        {
+            shm_unlink(name);
+        }
+        *shared = NULL;
+    }
+
+    return retval;
+}
+
+int tsqueue_shared_open(struct tsqueue_shared **shared, const char *name,
+                        size_t elem_size, size_t *capacity)
+{
+    int retval = shared_map(shared, name);
+
+    if (retval == 0)
+    {
+        if ((*shared)->elem_size != elem_size)
+        {
+            retval = EINVAL;
+            tsqueue_shared_unmap(*shared);
+            *shared = NULL;
+        }
+        else
+        {
+            *capacity = (*shared)->capacity;
+        }
+    }
+
+    return retval;
+}
+
+void tsqueue_shared_unmap(struct tsqueue_shared *shared)
+{
+    // The synchronisation primitives are not destroyed as other processes
+    // may still be using them.
+    munmap(shared, shared->size);
+}
+
+void tsqueue_shared_close(struct tsqueue_shared *shared)
+{
+    shared_lock(shared);
+    shared->die = true;
+    pthread_cond_broadcast(&shared->producer_wakeup);
+    pthread_cond_broadcast(&shared->consumer_wakeup);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+bool tsqueue_shared_has_space(struct tsqueue_shared *shared, size_t n_elems)
+{
+    shared_lock(shared);
+    bool has_space = (shared->capacity - shared->used >= n_elems);
+    pthread_mutex_unlock(&shared->lock);
+    return has_space;
+}
+
+int tsqueue_shared_wait_for_space(struct tsqueue_shared *shared,
+                                  size_t n_elems)
+{
+    shared_lock(shared);
+    int retval = shared_wait_for_space(shared, n_elems);
+    pthread_mutex_unlock(&shared->lock);
+    return retval;
+}
+
+int tsqueue_shared_put(struct tsqueue_shared *shared, size_t n_elems,
+                       void *in)
+{
+    shared_lock(shared);
+
+    int retval = shared_wait_for_space(shared, n_elems);
+
+    if (retval == 0 && n_elems != 0)
+    {
+        size_t tail = (shared->head + shared->used) % shared->capacity;
+        shared_copy(shared, tail, n_elems, in, true);
+
+        // This publishes the elements, see the file description.
+        shared->used += n_elems;
+
+        if (shared->n_consumers_waiting != 0)
+        {
+            pthread_cond_broadcast(&shared->consumer_wakeup);
+        }
+    }
+
+    pthread_mutex_unlock(&shared->lock);
+
+    return retval;
+}
+
+int tsqueue_shared_pop(struct tsqueue_shared *shared, size_t *n_elems,
+                       void *out)
+{
+    int retval = 0;
+
+    shared_lock(shared);
+
+    if (*n_elems > shared->capacity)
+    {
+        retval = TSQUEUE_TOO_MANY;
+    }
+
+    if (retval == 0)
+    {
+        ++shared->n_consumers_waiting;
+        while (!shared->producers_done && !shared->die
+               && shared->used < *n_elems)
+        {
+            shared_wait(shared, &shared->consumer_wakeup);
+        }
+        --shared->n_consumers_waiting;
+    }
+
+    if (shared->die)
+    {
+        retval = TSQUEUE_CLOSED;
+        *n_elems = 0;
+    }
+
+    if (retval == 0)
+    {
+        if (shared->used < *n_elems)
+        {
+            *n_elems = shared->used;
+        }
+        // The elements are read before head is advanced past them, with
+        // the lock held, so a producer can not reuse their slots first. A
+        // consumer that dies part way through leaves them in the queue.
+        shared_copy(shared, shared->head, *n_elems, out, false);
+        shared->head = (shared->head + *n_elems) % shared->capacity;
+        shared->used -= *n_elems;
+
+        // Producers may be waiting for different amounts of space so they
+        // all need to check.
+        if (*n_elems != 0 && shared->n_producers_waiting != 0)
+        {
+            pthread_cond_broadcast(&shared->producer_wakeup);
+        }
+    }
+
+    pthread_mutex_unlock(&shared->lock);
+
+    return retval;
+}
+
+void tsqueue_shared_set_done(struct tsqueue_shared *shared, bool done)
+{
+    shared_lock(shared);
+    shared->producers_done = done;
+    pthread_cond_broadcast(&shared->consumer_wakeup);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+static void shared_lock(struct tsqueue_shared *shared)
+{
+    if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD)
+    {
+        // The header is always consistent between stores, see the file
+        // description.
+        pthread_mutex_consistent(&shared->lock);
+    }
+}
+
+static void shared_wait(struct tsqueue_shared *shared, pthread_cond_t *cond)
+{
+    if (pthread_cond_wait(cond, &shared->lock) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&shared->lock);
+    }
+}
+
+static int shared_wait_for_space(struct tsqueue_shared *shared,
+                                 size_t n_elems)
+{
+    int retval = 0;
+
+    if (n_elems > shared->capacity)
+    {
+        retval = TSQUEUE_TOO_MANY;
+    }
+
+    if (retval == 0)
+    {
+        // A producer that dies while waiting leaves this count too high,
+        // which only costs spurious broadcasts.
+        ++shared->n_producers_waiting;
+        while (!shared->die && (shared->capacity - shared->used) < n_elems)
+        {
+            shared_wait(shared, &shared->producer_wakeup);
+        }
+        --shared->n_producers_waiting;
+    }
+
+    if (shared->die)
+    {
+        retval = TSQUEUE_CLOSED;
+    }
+
+    return retval;
+}
+
+static int shared_init_sync(struct tsqueue_shared *shared)
+{
+    int retval = 0;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    bool mutex_attr_init = false;
+    bool cond_attr_init = false;
+
+    retval = pthread_mutexattr_init(&mutex_attr);
+    if (retval == 0)
+    {
+        mutex_attr_init = true;
+        retval = pthread_mutexattr_setpshared(&mutex_attr,
+                                              PTHREAD_PROCESS_SHARED);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_mutexattr_setrobust(&mutex_attr,
+                                             PTHREAD_MUTEX_ROBUST);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_condattr_init(&cond_attr);
+    }
+
+    if (retval == 0)
+    {
+        cond_attr_init = true;
+        retval = pthread_condattr_setpshared(&cond_attr,
+                                             PTHREAD_PROCESS_SHARED);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_mutex_init(&shared->lock, &mutex_attr);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_cond_init(&shared->producer_wakeup, &cond_attr);
+    }
+
+    if (retval == 0)
+    {
+        retval = pthread_cond_init(&shared->consumer_wakeup, &cond_attr);
+    }
+
+    if (mutex_attr_init)
+    {
+        pthread_mutexattr_destroy(&mutex_attr);
+    }
+
+    if (cond_attr_init)
+    {
+        pthread_condattr_destroy(&cond_attr);
+    }
+
+    return retval;
+}
+
+static void shared_copy(struct tsqueue_shared *shared, size_t index,
+                        size_t n_elems, void *buffer, bool to_ring)
+{
+    char *ring = (char *)shared + shared->data_offset;
+    size_t first = shared->capacity - index;
+    if (first > n_elems)
+    {
+        first = n_elems;
+    }
+
+    char *parts[2] = {ring + (index * shared->elem_size), ring};
+    size_t lengths[2] = {first, n_elems - first};
+    char *linear = buffer;
+    for (int i = 0; i < 2; ++i)
+    {
+        size_t bytes = lengths[i] * shared->elem_size;
+        if (to_ring)
+        {
+            memcpy(parts[i], linear, bytes);
+        }
+        else
+        {
+            memcpy(linear, parts[i], bytes);
+        }
+        linear += bytes;
+    }
+}
+
+static int shared_map(struct tsqueue_shared **shared, const char *name)
+{
+    int retval = 0;
+
+    *shared = NULL;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+    {
+        retval = errno;
+    }
+
+    struct stat st;
+    if (retval == 0 && fstat(fd, &st) == -1)
+    {
+        retval = errno;
+    }
+
+    // A segment whose creator has not yet called ftruncate() is empty.
+    if (retval == 0 && st.st_size == 0)
+    {
+        retval = EAGAIN;
+    }
+
+    if (retval == 0 && (size_t)st.st_size < sizeof(**shared))
+    {
+        retval = EINVAL;
+    }
+
+    void *map = MAP_FAILED;
+    if (retval == 0)
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            retval = errno;
+        }
+    }
+
+    if (retval == 0)
+    {
+        *shared = map;
+        if (atomic_load_explicit(&(*shared)->ready, memory_order_acquire)
+            != SHARED_READY_MAGIC)
+        {
+            retval = EAGAIN;
+        }
+        else if ((*shared)->size != (size_t)st.st_size)
+        {
+            retval = EINVAL;
+        }
+
+        if (retval != 0)
+        {
+            munmap(map, (size_t)st.st_size);
+            *shared = NULL;
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return retval;
+}
+
+static int shared_owner(const char *name, pid_t *owner)
+{
+    int retval = 0;
+
+    *owner = 0;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        retval = errno;
+    }
+
+    struct stat st;
+    if (retval == 0 && fstat(fd, &st) == -1)
+    {
+        retval = errno;
+    }
+
+    // A segment whose creator has not yet called ftruncate() has no owner.
+    if (retval == 0 && (size_t)st.st_size >= sizeof(struct tsqueue_shared))
+    {
+        struct tsqueue_shared *shared =
+            mmap(NULL, sizeof(*shared), PROT_READ, MAP_SHARED, fd, 0);
+        if (shared == MAP_FAILED)
+        {
+            retval = errno;
+        }
+        else
+        {
+            *owner = atomic_load_explicit(&shared->owner,
+                                          memory_order_relaxed);
+            munmap(shared, sizeof(*shared));
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return retval;
+}
+
+static bool shared_unlink_stale(const char *name)
+{
+    bool stale = false;
+    bool gone = false;
+    bool decided = false;
+
+    // A live creator records its pid moments after creating the segment, so
+    // a segment still without an owner after SHARED_OWNER_TIMEOUT_MS was
+    // left by a creator that died first. A segment with a live owner is
+    // never stale, even if that owner has not yet set ready.
+    for (unsigned waited_ms = 0; !decided; waited_ms += SHARED_OWNER_POLL_MS)
+    {
+        pid_t owner = 0;
+        int owner_retval = shared_owner(name, &owner);
+        if (owner_retval != 0)
+        {
+            gone = (owner_retval == ENOENT);
+            decided = true;
+        }
+        else if (owner != 0)
+        {
+            stale = kill(owner, 0) == -1 && errno == ESRCH;
+            decided = true;
+        }
+        else if (waited_ms >= SHARED_OWNER_TIMEOUT_MS)
+        {
+            stale = true;
+            decided = true;
+        }
+        else
+        {
+            const struct timespec poll = {
+                .tv_nsec = SHARED_OWNER_POLL_MS * 1000000L
+            };
+            nanosleep(&poll, NULL);
+        }
+    }
+
+    return gone || (stale && shm_unlink(name) == 0);
+}
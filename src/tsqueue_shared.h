@@ -0,0 +1,106 @@
+/**
+ * @file   tsqueue_shared.h
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  FIFO queue stored in a POSIX shared memory segment, used by tsqueue
+ *         for queues created with tsqueue_create_shared().
+ *
+ * The segment holds a header followed by a ring of elements. The header only
+ * contains offsets so each process can map the segment at a different
+ * address, and it is synchronised with process-shared robust mutexes and
+ * condition variables. Unlike the other tsqueue modes any number of
+ * producers, in any number of processes, may put elements at once.
+ *
+ * Elements only become visible to consumers when the used count in the
+ * header is updated, which is the last step of a put. A producer that dies
+ * part way through a put therefore leaves the queue consistent and the next
+ * process to take the lock simply marks it as consistent again. Likewise a
+ * pop copies the elements out before it moves the head past them.
+ */
+
+#ifndef TSQUEUE_SHARED_H
+#define TSQUEUE_SHARED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The header of a shared memory segment holding a queue. */
+struct tsqueue_shared;
+
+/**
+ * @brief Create and map a new shared memory segment holding an empty queue.
+ *
+ * @param[out] shared The mapped segment, will be NULL if creation fails.
+ * @param[in] name The name of the segment, see shm_open(). A segment of
+ *                 the same name left behind by a process that has died is
+ *                 removed, even if it died while creating the segment, any
+ *                 other must not already exist.
+ * @param capacity The number of elements the queue can hold.
+ * @param elem_size The size of an element.
+ *
+ * @return Zero if the function succeeds, EEXIST if the segment belongs to a
+ *         running process, else a POSIX error number.
+ */
+int tsqueue_shared_create(struct tsqueue_shared **shared, const char *name,
+                          size_t capacity, size_t elem_size);
+
+/**
+ * @brief Map an existing shared memory segment created by
+ *        tsqueue_shared_create().
+ *
+ * @param[out] shared The mapped segment, will be NULL if opening fails.
+ * @param[in] name The name of the segment, see shm_open().
+ * @param elem_size The size of an element, must match the value given to
+ *                  tsqueue_shared_create().
+ * @param[out] capacity The capacity of the queue.
+ *
+ * @return Zero if the function succeeds, EAGAIN if the segment is still
+ *         being created, EINVAL if @p elem_size does not match, else a POSIX
+ *         error number.
+ */
+int tsqueue_shared_open(struct tsqueue_shared **shared, const char *name,
+                        size_t elem_size, size_t *capacity);
+
+/**
+ * @brief Unmap a segment. Other processes may keep using it.
+ *
+ * @param[in] shared The segment.
+ */
+void tsqueue_shared_unmap(struct tsqueue_shared *shared);
+
+/**
+ * @brief See tsqueue_close(). Does not wait for calls in other processes to
+ *        exit.
+ */
+void tsqueue_shared_close(struct tsqueue_shared *shared);
+
+/**
+ * @brief See tsqueue_has_space().
+ */
+bool tsqueue_shared_has_space(struct tsqueue_shared *shared, size_t n_elems);
+
+/**
+ * @brief See tsqueue_wait_for_space().
+ */
+int tsqueue_shared_wait_for_space(struct tsqueue_shared *shared,
+                                  size_t n_elems);
+
+/**
+ * @brief See tsqueue_put().
+ */
+int tsqueue_shared_put(struct tsqueue_shared *shared, size_t n_elems,
+                       void *in);
+
+/**
+ * @brief See tsqueue_pop().
+ */
+int tsqueue_shared_pop(struct tsqueue_shared *shared, size_t *n_elems,
+                       void *out);
+
+/**
+ * @brief See tsqueue_set_done().
+ */
+void tsqueue_shared_set_done(struct tsqueue_shared *shared, bool done);
+
+#endif /* TSQUEUE_SHARED_H */
@@ -0,0 +1,566 @@
+/**
+ * @file   tsqueue_typed.h
+ * @author Liam Powell
+ * @date   2026-10-17
+ *
+ * @brief  Type specialised FIFO queues generated at compile time.
+ *
+ * TSQUEUE_DEFINE() generates a thread safe FIFO queue for a single element
+ * type. It behaves like a queue created with tsqueue_create() but every
+ * function is static inline and elements are moved by assignment, so the
+ * element size and alignment are constants the compiler can use to inline
+ * and vectorise copies. Elements are kept in a ring so a pop does not move
+ * the elements left in the queue. Waiting consumers are woken in a
+ * tsqueue_wake_order and counted by tsqueue_thread_wakeups() as they are for
+ * a FIFO tsqueue. The generic tsqueue API remains for queues whose element
+ * type is only known at runtime and for the other queue modes.
+ */
+
+#ifndef TSQUEUE_TYPED_H
+#define TSQUEUE_TYPED_H
+
+#include "tsqueue.h"
+#include "lock.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/** A consumer waiting in the pop function of a typed queue. */
+struct tsqueue_typed_waiter
+{
+    /** Signalled when the waiter is removed from the list to wake it. */
+    struct lock_cond wakeup;
+
+    /** The waiter which started waiting before this one. */
+    struct tsqueue_typed_waiter *prev;
+
+    /** The waiter which started waiting after this one. */
+    struct tsqueue_typed_waiter *next;
+
+    /** See tsqueue_thread_consumer_id(). */
+    unsigned long consumer_id;
+
+    /** True while the waiter is in the list. */
+    bool queued;
+};
+
+/** The consumers waiting on a typed queue, oldest first. */
+struct tsqueue_typed_waiters
+{
+    /** The waiter which has waited longest, NULL if there are none. */
+    struct tsqueue_typed_waiter *head;
+
+    /** The waiter which started waiting most recently. */
+    struct tsqueue_typed_waiter *tail;
+
+    /** The order waiters are woken in. */
+    enum tsqueue_wake_order order;
+
+    /** The consumer id after the last one woken, for
+     * TSQUEUE_WAKE_ROUND_ROBIN. */
+    unsigned long next_consumer_id;
+};
+
+/**
+ * @brief Add a waiter to the end of a list.
+ *
+ * @param[in,out] waiters The list.
+ * @param[in] waiter The waiter.
+ */
+static inline void tsqueue_typed_waiter_push(
+    struct tsqueue_typed_waiters *waiters, struct tsqueue_typed_waiter *waiter)
+{
+    waiter->next = NULL;
+    waiter->prev = waiters->tail;
+    if (waiters->tail != NULL)
+    {
+        waiters->tail->next = waiter;
+    }
+    else
+    {
+        waiters->head = waiter;
+    }
+    waiters->tail = waiter;
+    waiter->queued = true;
+}
+
+/**
+ * @brief Remove a waiter from a list.
+ *
+ * @param[in,out] waiters The list.
+ * @param[in] waiter The waiter, which must be in the list.
+ */
+static inline void tsqueue_typed_waiter_remove(
+    struct tsqueue_typed_waiters *waiters, struct tsqueue_typed_waiter *waiter)
+{
+    if (waiter->prev != NULL)
+    {
+        waiter->prev->next = waiter->next;
+    }
+    else
+    {
+        waiters->head = waiter->next;
+    }
+
+    if (waiter->next != NULL)
+    {
+        waiter->next->prev = waiter->prev;
+    }
+    else
+    {
+        waiters->tail = waiter->prev;
+    }
+    waiter->queued = false;
+}
+
+/**
+ * @brief Wake the waiter chosen by the wake order of a list, if there is one.
+ *
+ * @param[in,out] waiters The list.
+ */
+static inline void tsqueue_typed_wake_one(
+    struct tsqueue_typed_waiters *waiters)
+{
+    struct tsqueue_typed_waiter *chosen = NULL;
+
+    switch (waiters->order)
+    {
+    case TSQUEUE_WAKE_FIFO:
+        chosen = waiters->head;
+        break;
+    case TSQUEUE_WAKE_LIFO:
+        chosen = waiters->tail;
+        break;
+    case TSQUEUE_WAKE_ROUND_ROBIN:
+    {
+        // The waiter with the lowest id not yet woken this round, or the
+        // lowest id overall to start a new round.
+        struct tsqueue_typed_waiter *lowest = NULL;
+        for (struct tsqueue_typed_waiter *w = waiters->head; w != NULL;
+             w = w->next)
+        {
+            if (w->consumer_id >= waiters->next_consumer_id
+                && (chosen == NULL || w->consumer_id < chosen->consumer_id))
+            {
+                chosen = w;
+            }
+            if (lowest == NULL || w->consumer_id < lowest->consumer_id)
+            {
+                lowest = w;
+            }
+        }
+        if (chosen == NULL)
+        {
+            chosen = lowest;
+        }
+        break;
+    }
+    }
+
+    if (chosen != NULL)
+    {
+        tsqueue_typed_waiter_remove(waiters, chosen);
+        waiters->next_consumer_id = chosen->consumer_id + 1;
+        lock_cond_signal(&chosen->wakeup);
+    }
+}
+
+/**
+ * @brief Wake every waiter in a list.
+ *
+ * @param[in,out] waiters The list.
+ */
+static inline void tsqueue_typed_wake_all(
+    struct tsqueue_typed_waiters *waiters)
+{
+    while (waiters->head != NULL)
+    {
+        struct tsqueue_typed_waiter *waiter = waiters->head;
+        tsqueue_typed_waiter_remove(waiters, waiter);
+        lock_cond_signal(&waiter->wakeup);
+    }
+}
+
+/**
+ * @brief Define a FIFO queue type @p name holding elements of type @p type.
+ *
+ * The following are defined, each behaving like the tsqueue function of the
+ * same name:
+ *
+ * - `typedef struct name name;`
+ * - `int name_create(name **queue, type *data, size_t capacity, size_t used,
+ *   enum lock_kind lock);`
+ * - `void name_close(name *queue);`
+ * - `void name_destroy(name *queue, size_t *used);`
+ * - `size_t name_capacity(name *queue);`
+ * - `bool name_has_space(name *queue, size_t n_elems);`
+ * - `int name_wait_for_space(name *queue, size_t n_elems);`
+ * - `int name_put(name *queue, size_t n_elems, const type *in);`
+ * - `int name_pop(name *queue, size_t *n_elems, type *out);`
+ * - `int name_try_pop(name *queue, size_t *n_elems, type *out);`
+ * - `void name_set_wake_order(name *queue, enum tsqueue_wake_order order);`
+ * - `void name_set_done(name *queue, bool done);`
+ *
+ * Any number of producers may call name_put() at once.
+ *
+ * @param name The name of the queue type, used as a prefix for functions.
+ * @param type The element type, must be assignable.
+ */
+#define TSQUEUE_DEFINE(name, type)                                            \
+    typedef struct name                                                       \
+    {                                                                         \
+        /* The lock for the data in this struct. */                           \
+        struct lock lock;                                                     \
+        /* Broadcast when space is freed for waiting producers. */            \
+        struct lock_cond producer_wakeup;                                     \
+        /* Signalled when the last waiting call exits a closed queue. */      \
+        struct lock_cond all_dead;                                            \
+        /* The consumers waiting for elements. */                             \
+        struct tsqueue_typed_waiters waiters;                                 \
+        /* Ring of elements provided by the user. */                          \
+        type *data;                                                           \
+        /* The number of elements data can hold. */                           \
+        size_t capacity;                                                      \
+        /* The index in data of the first element. */                         \
+        size_t head;                                                          \
+        /* The number of elements in the queue. */                            \
+        size_t used;                                                          \
+        /* The number of producers waiting for space. */                      \
+        size_t n_producers_waiting;                                           \
+        /* The number of consumers waiting for elements. */                   \
+        size_t n_consumers_waiting;                                           \
+        /* See tsqueue_set_done(). */                                         \
+        bool producers_done;                                                  \
+        /* See tsqueue_close(). */                                            \
+        bool die;                                                             \
+    } name;                                                                   \
+                                                                              \
+    static inline int name##_create(name **queue, type *data,                 \
+                                    size_t capacity, size_t used,             \
+                                    enum lock_kind lock)                      \
+    {                                                                         \
+        int retval = 0;                                                       \
+        int steps_done = 0;                                                   \
+                                                                              \
+        /* The lock is over-aligned, which malloc() does not allow for. */    \
+        *queue = aligned_alloc(_Alignof(name), sizeof(**queue));              \
+        if (*queue == NULL)                                                   \
+        {                                                                     \
+            retval = errno;                                                   \
+        }                                                                     \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            **queue = (name){                                                 \
+                .waiters = {.order = TSQUEUE_WAKE_FIFO},                      \
+                .data = data,                                                 \
+                .capacity = capacity,                                         \
+                .used = used                                                  \
+            };                                                                \
+            retval = lock_init(&(*queue)->lock, lock);                        \
+        }                                                                     \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            steps_done = 1;                                                   \
+            retval = lock_cond_init(&(*queue)->producer_wakeup, lock);        \
+        }                                                                     \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            steps_done = 2;                                                   \
+            retval = lock_cond_init(&(*queue)->all_dead, lock);               \
+        }                                                                     \
+                                                                              \
+        if (retval != 0 && *queue != NULL)                                    \
+        {                                                                     \
+            switch (steps_done)                                               \
+            {                                                                 \
+            case 2:                                                           \
+                lock_cond_destroy(&(*queue)->producer_wakeup);                \
+                /* FALL THROUGH */                                            \
+            case 1:                                                           \
+                lock_destroy(&(*queue)->lock);                                \
+                /* FALL THROUGH */                                            \
+            default:                                                          \
+                break;                                                        \
+            }                                                                 \
+                                                                              \
+            free(*queue);                                                     \
+            *queue = NULL;                                                    \
+        }                                                                     \
+                                                                              \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline void name##_close(name *queue)                              \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        queue->die = true;                                                    \
+        lock_cond_broadcast(&queue->producer_wakeup);                         \
+        tsqueue_typed_wake_all(&queue->waiters);                              \
+        while (queue->n_producers_waiting != 0                                \
+               || queue->n_consumers_waiting != 0)                            \
+        {                                                                     \
+            lock_cond_wait(&queue->all_dead, &queue->lock);                   \
+        }                                                                     \
+        lock_release(&queue->lock);                                           \
+    }                                                                         \
+                                                                              \
+    static inline void name##_reverse(type *data, size_t first, size_t end)   \
+    {                                                                         \
+        while (first + 1 < end)                                               \
+        {                                                                     \
+            type tmp = data[first];                                           \
+            data[first++] = data[--end];                                      \
+            data[end] = tmp;                                                  \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    static inline void name##_destroy(name *queue, size_t *used)              \
+    {                                                                         \
+        name##_close(queue);                                                  \
+                                                                              \
+        /* Rotate the ring so the first element is at the start of data. */   \
+        name##_reverse(queue->data, 0, queue->capacity);                      \
+        name##_reverse(queue->data, 0, queue->capacity - queue->head);        \
+        name##_reverse(queue->data, queue->capacity - queue->head,            \
+                       queue->capacity);                                      \
+                                                                              \
+        if (used != NULL)                                                     \
+        {                                                                     \
+            *used = queue->used;                                              \
+        }                                                                     \
+                                                                              \
+        lock_cond_destroy(&queue->all_dead);                                  \
+        lock_cond_destroy(&queue->producer_wakeup);                           \
+        lock_destroy(&queue->lock);                                           \
+        free(queue);                                                          \
+    }                                                                         \
+                                                                              \
+    static inline size_t name##_capacity(name *queue)                         \
+    {                                                                         \
+        /* The capacity never changes once the queue is created. */           \
+        return queue->capacity;                                               \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_has_space(name *queue, size_t n_elems)          \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        bool has_space = (queue->capacity - queue->used >= n_elems);          \
+        lock_release(&queue->lock);                                           \
+        return has_space;                                                     \
+    }                                                                         \
+                                                                              \
+    /* Wait with the lock held until there is space for n_elems. */           \
+    static inline int name##_wait_locked(name *queue, size_t n_elems)         \
+    {                                                                         \
+        int retval = 0;                                                       \
+                                                                              \
+        if (n_elems > queue->capacity)                                        \
+        {                                                                     \
+            retval = TSQUEUE_TOO_MANY;                                        \
+        }                                                                     \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            ++queue->n_producers_waiting;                                     \
+            while (!queue->die                                                \
+                   && queue->capacity - queue->used < n_elems)                \
+            {                                                                 \
+                lock_cond_wait(&queue->producer_wakeup, &queue->lock);        \
+            }                                                                 \
+            --queue->n_producers_waiting;                                     \
+        }                                                                     \
+                                                                              \
+        if (queue->die)                                                       \
+        {                                                                     \
+            retval = TSQUEUE_CLOSED;                                          \
+            lock_cond_signal(&queue->all_dead);                               \
+        }                                                                     \
+                                                                              \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline int name##_wait_for_space(name *queue, size_t n_elems)      \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        int retval = name##_wait_locked(queue, n_elems);                      \
+        lock_release(&queue->lock);                                           \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline int name##_put(name *queue, size_t n_elems,                 \
+                                 const type *in)                              \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+                                                                              \
+        int retval = name##_wait_locked(queue, n_elems);                      \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            size_t tail = queue->head + queue->used;                          \
+            if (tail >= queue->capacity)                                      \
+            {                                                                 \
+                tail -= queue->capacity;                                      \
+            }                                                                 \
+            for (size_t i = 0; i < n_elems; ++i)                              \
+            {                                                                 \
+                queue->data[tail] = in[i];                                    \
+                if (++tail == queue->capacity)                                \
+                {                                                             \
+                    tail = 0;                                                 \
+                }                                                             \
+            }                                                                 \
+            queue->used += n_elems;                                           \
+                                                                              \
+            /* Each consumer passes the wakeup on if elements are left. */    \
+            if (n_elems != 0)                                                 \
+            {                                                                 \
+                tsqueue_typed_wake_one(&queue->waiters);                      \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        lock_release(&queue->lock);                                           \
+                                                                              \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    /* Pop with the lock held, waiting for elements if wait is true. */       \
+    static inline int name##_pop_locked(name *queue, size_t *n_elems,         \
+                                        type *out, bool wait)                 \
+    {                                                                         \
+        int retval = 0;                                                       \
+                                                                              \
+        if (*n_elems > queue->capacity)                                       \
+        {                                                                     \
+            retval = TSQUEUE_TOO_MANY;                                        \
+        }                                                                     \
+                                                                              \
+        if (retval == 0 && !wait)                                             \
+        {                                                                     \
+            if (!queue->producers_done && !queue->die && queue->used == 0     \
+                && *n_elems != 0)                                             \
+            {                                                                 \
+                retval = TSQUEUE_EMPTY;                                       \
+                *n_elems = 0;                                                 \
+            }                                                                 \
+        }                                                                     \
+        else if (retval == 0)                                                 \
+        {                                                                     \
+            struct tsqueue_typed_waiter self = {                              \
+                .consumer_id = tsqueue_thread_consumer_id()                   \
+            };                                                                \
+            bool self_initialised = false;                                    \
+                                                                              \
+            ++queue->n_consumers_waiting;                                     \
+            while (retval == 0 && !queue->producers_done && !queue->die       \
+                   && queue->used < *n_elems)                                 \
+            {                                                                 \
+                if (!self_initialised)                                        \
+                {                                                             \
+                    retval = lock_cond_init(&self.wakeup, queue->lock.kind);  \
+                    self_initialised = (retval == 0);                         \
+                }                                                             \
+                                                                              \
+                if (retval == 0)                                              \
+                {                                                             \
+                    if (!self.queued)                                         \
+                    {                                                         \
+                        tsqueue_typed_waiter_push(&queue->waiters, &self);    \
+                    }                                                         \
+                    lock_cond_wait(&self.wakeup, &queue->lock);               \
+                                                                              \
+                    /* Anything but being taken off the list is spurious. */  \
+                    if (!self.queued)                                         \
+                    {                                                         \
+                        tsqueue_count_wakeup();                               \
+                    }                                                         \
+                }                                                             \
+            }                                                                 \
+            --queue->n_consumers_waiting;                                     \
+                                                                              \
+            if (self.queued)                                                  \
+            {                                                                 \
+                tsqueue_typed_waiter_remove(&queue->waiters, &self);          \
+            }                                                                 \
+                                                                              \
+            if (self_initialised)                                             \
+            {                                                                 \
+                lock_cond_destroy(&self.wakeup);                              \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        if (queue->die)                                                       \
+        {                                                                     \
+            retval = TSQUEUE_CLOSED;                                          \
+            *n_elems = 0;                                                     \
+            lock_cond_signal(&queue->all_dead);                               \
+        }                                                                     \
+                                                                              \
+        if (retval == 0)                                                      \
+        {                                                                     \
+            if (queue->used < *n_elems)                                       \
+            {                                                                 \
+                *n_elems = queue->used;                                       \
+            }                                                                 \
+            for (size_t i = 0; i < *n_elems; ++i)                             \
+            {                                                                 \
+                out[i] = queue->data[queue->head];                            \
+                if (++queue->head == queue->capacity)                         \
+                {                                                             \
+                    queue->head = 0;                                          \
+                }                                                             \
+            }                                                                 \
+            queue->used -= *n_elems;                                          \
+                                                                              \
+            /* Producers may be waiting for different amounts of space. */    \
+            if (*n_elems != 0 && queue->n_producers_waiting != 0)             \
+            {                                                                 \
+                lock_cond_broadcast(&queue->producer_wakeup);                 \
+            }                                                                 \
+                                                                              \
+            if (queue->used != 0)                                             \
+            {                                                                 \
+                tsqueue_typed_wake_one(&queue->waiters);                      \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline int name##_pop(name *queue, size_t *n_elems, type *out)     \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        int retval = name##_pop_locked(queue, n_elems, out, true);            \
+        lock_release(&queue->lock);                                           \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline int name##_try_pop(name *queue, size_t *n_elems,            \
+                                     type *out)                               \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        int retval = name##_pop_locked(queue, n_elems, out, false);           \
+        lock_release(&queue->lock);                                           \
+        return retval;                                                        \
+    }                                                                         \
+                                                                              \
+    static inline void name##_set_wake_order(name *queue,                     \
+                                             enum tsqueue_wake_order order)   \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        queue->waiters.order = order;                                         \
+        lock_release(&queue->lock);                                           \
+    }                                                                         \
+                                                                              \
+    static inline void name##_set_done(name *queue, bool done)                \
+    {                                                                         \
+        lock_acquire(&queue->lock);                                           \
+        queue->producers_done = done;                                         \
+        tsqueue_typed_wake_all(&queue->waiters);                              \
+        lock_release(&queue->lock);                                           \
+    }
+
+#endif /* TSQUEUE_TYPED_H */